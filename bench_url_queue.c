@@ -0,0 +1,235 @@
+/*
+ * Benchmark for pending URL storage.
+ *
+ * Compares array of PetWay strings, ring buffer of separately allocated
+ * URLs which pw_frontier.c used before, and front-coded queue from
+ * pw_url_queue.c. URLs are generated per host in discovery order,
+ * with shared directories, like links extracted from pages.
+ *
+ * Memory is measured with mallinfo2, so the default allocator
+ * must be malloc-based.
+ *
+ * Build: cc -O2 bench_url_queue.c pw_url_queue.c -lpw -o bench_url_queue
+ */
+
+#include <malloc.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <time.h>
+
+#include <pw.h>
+
+#include "pw_curl.h"
+
+#define NUM_HOSTS      1000
+#define URLS_PER_HOST  1000
+
+static double now()
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ts.tv_sec + ts.tv_nsec / 1e9;
+}
+
+static size_t heap_used()
+{
+    return mallinfo2().uordblks;
+}
+
+static unsigned make_url(char* buf, unsigned host, unsigned i)
+{
+    static char* sections[] = { "news", "blog", "products", "docs", "forum/thread", "category/books" };
+    static char* words[] = { "how", "to", "make", "best", "guide", "review", "2024", "new", "top", "ten" };
+    unsigned section = (i / 50) % (sizeof(sections) / sizeof(sections[0]));
+    return sprintf(buf, "https://www.site-%u.example.com/%s/%u/%s-%s-%s-%u.html",
+                   host, sections[section], i / 10,
+                   words[i % 10], words[(i * 7) % 10], words[(i * 3) % 10], i);
+}
+
+static uint64_t checksum(char* url, unsigned length)
+{
+    uint64_t sum = length;
+    for (unsigned i = 0; i < length; i++) {
+        sum = sum * 31 + (unsigned char) url[i];
+    }
+    return sum;
+}
+
+typedef struct {
+    char* name;
+    size_t memory;
+    double push_ns;
+    double pop_ns;
+    uint64_t checksum;
+} Result;
+
+static void print_result(Result* r, Result* baseline)
+{
+    unsigned n = NUM_HOSTS * URLS_PER_HOST;
+    printf("%-14s %12.1f %10.1f %10.1f %10.1fx\n", r->name, (double) r->memory / n,
+           r->push_ns, r->pop_ns, (double) baseline->memory / r->memory);
+}
+
+static bool bench_pw_array(Result* result)
+{
+    _PwValue* arrays = calloc(NUM_HOSTS, sizeof(_PwValue));
+    char buf[256];
+    size_t base = heap_used();
+    double start = now();
+    for (unsigned host = 0; host < NUM_HOSTS; host++) {
+        if (!pw_create_array(&arrays[host])) {
+            return false;
+        }
+    }
+    for (unsigned i = 0; i < URLS_PER_HOST; i++) {
+        for (unsigned host = 0; host < NUM_HOSTS; host++) {{
+            make_url(buf, host, i);
+            PwValue url = PW_NULL;
+            if (!pw_create_string(buf, &url) || !pw_array_append(&arrays[host], &url)) {
+                return false;
+            }
+        }}
+    }
+    result->push_ns = (now() - start) * 1e9 / (NUM_HOSTS * URLS_PER_HOST);
+    result->memory = heap_used() - base;
+
+    // arrays have no cheap pop from the front, read them in order
+    start = now();
+    for (unsigned host = 0; host < NUM_HOSTS; host++) {
+        for (unsigned i = 0; i < URLS_PER_HOST; i++) {{
+            PwValue url = PW_NULL;
+            if (!pw_array_item(&arrays[host], i, &url)) {
+                return false;
+            }
+            PW_CSTRING_LOCAL(url_cstr, &url);
+            result->checksum += checksum(url_cstr, strlen(url_cstr));
+        }}
+        pw_destroy(&arrays[host]);
+    }
+    result->pop_ns = (now() - start) * 1e9 / (NUM_HOSTS * URLS_PER_HOST);
+    free(arrays);
+    return true;
+}
+
+typedef struct {
+    char* url;
+    unsigned length;
+    unsigned depth;
+} Entry;
+
+typedef struct {
+    Entry* entries;
+    unsigned capacity;  // power of two
+    unsigned head;
+    unsigned length;
+} Ring;
+
+static bool bench_ring(Result* result)
+{
+    Ring* rings = calloc(NUM_HOSTS, sizeof(Ring));
+    char buf[256];
+    size_t base = heap_used();
+    double start = now();
+    for (unsigned i = 0; i < URLS_PER_HOST; i++) {
+        for (unsigned host = 0; host < NUM_HOSTS; host++) {
+            Ring* ring = &rings[host];
+            if (ring->length == ring->capacity) {
+                unsigned new_capacity = ring->capacity? ring->capacity * 2 : 8;
+                Entry* entries = malloc(new_capacity * sizeof(Entry));
+                if (!entries) {
+                    return false;
+                }
+                for (unsigned j = 0; j < ring->length; j++) {
+                    entries[j] = ring->entries[(ring->head + j) & (ring->capacity - 1)];
+                }
+                free(ring->entries);
+                ring->entries = entries;
+                ring->capacity = new_capacity;
+                ring->head = 0;
+            }
+            unsigned length = make_url(buf, host, i);
+            Entry* entry = &ring->entries[(ring->head + ring->length) & (ring->capacity - 1)];
+            entry->url = malloc(length + 1);
+            if (!entry->url) {
+                return false;
+            }
+            memcpy(entry->url, buf, length + 1);
+            entry->length = length;
+            entry->depth = 1;
+            ring->length++;
+        }
+    }
+    result->push_ns = (now() - start) * 1e9 / (NUM_HOSTS * URLS_PER_HOST);
+    result->memory = heap_used() - base;
+
+    start = now();
+    for (unsigned host = 0; host < NUM_HOSTS; host++) {
+        Ring* ring = &rings[host];
+        while (ring->length) {
+            Entry entry = ring->entries[ring->head];
+            ring->head = (ring->head + 1) & (ring->capacity - 1);
+            ring->length--;
+            result->checksum += checksum(entry.url, entry.length);
+            free(entry.url);
+        }
+        free(ring->entries);
+    }
+    result->pop_ns = (now() - start) * 1e9 / (NUM_HOSTS * URLS_PER_HOST);
+    free(rings);
+    return true;
+}
+
+static bool bench_url_queue(Result* result)
+{
+    CurlUrlQueue* queues = calloc(NUM_HOSTS, sizeof(CurlUrlQueue));
+    char buf[256];
+    size_t base = heap_used();
+    double start = now();
+    for (unsigned i = 0; i < URLS_PER_HOST; i++) {
+        for (unsigned host = 0; host < NUM_HOSTS; host++) {
+            unsigned length = make_url(buf, host, i);
+            if (!curl_url_queue_push(&queues[host], buf, length, 1)) {
+                return false;
+            }
+        }
+    }
+    result->push_ns = (now() - start) * 1e9 / (NUM_HOSTS * URLS_PER_HOST);
+    result->memory = heap_used() - base;
+
+    start = now();
+    for (unsigned host = 0; host < NUM_HOSTS; host++) {
+        unsigned length, depth;
+        char* url;
+        while ((url = curl_url_queue_pop(&queues[host], &length, &depth))) {
+            result->checksum += checksum(url, length);
+        }
+        curl_url_queue_fini(&queues[host]);
+    }
+    result->pop_ns = (now() - start) * 1e9 / (NUM_HOSTS * URLS_PER_HOST);
+    free(queues);
+    return true;
+}
+
+int main(int argc, char* argv[])
+{
+    Result results[] = {
+        { .name = "pw array" },
+        { .name = "entry ring" },
+        { .name = "url queue" }
+    };
+    if (!bench_pw_array(&results[0]) || !bench_ring(&results[1]) || !bench_url_queue(&results[2])) {
+        fprintf(stderr, "Out of memory\n");
+        return 1;
+    }
+    if (results[0].checksum != results[1].checksum || results[0].checksum != results[2].checksum) {
+        fprintf(stderr, "MISMATCH\n");
+        return 1;
+    }
+    printf("%u hosts, %u URLs per host\n", NUM_HOSTS, URLS_PER_HOST);
+    printf("%-14s %12s %10s %10s %11s\n", "storage", "bytes/URL", "push ns", "pop ns", "vs array");
+    for (unsigned i = 0; i < sizeof(results) / sizeof(results[0]); i++) {
+        print_result(&results[i], &results[0]);
+    }
+    return 0;
+}
@@ -1,5 +1,14 @@
+#include <errno.h>
+#include <fcntl.h>
 #include <signal.h>
+#include <stdlib.h>
 #include <string.h>
+#include <unistd.h>
+
+#if __has_include(<zstd.h>)
+#   include <zstd.h>
+#   define HAVE_ZSTD
+#endif
 
 #include <pw_parse.h>
 #include "pw_curl.h"
@@ -16,6 +25,12 @@ typedef struct {
 
     _PwValue file;  // autocleaned PwValue is not suitable for manually managed data,
                     // using bare structure that starts with underscore
+
+    unsigned depth;               // crawl depth of the URL
+    CurlLinkExtractor* extractor; // created for HTML pages if crawling deeper
+    bool not_html;
+    bool scanned;                 // scan record is printed
+    bool completed;               // response is received
 } FileRequestData;
 
 // this macro gets pointer to FileRequestData from PwValue
@@ -26,10 +41,246 @@ typedef struct {
 _PwValue proxy   = PW_NULL;
 _PwValue verbose = PW_BOOL(false);
 
+// crawl depth, 0 fetches given URLs only
+unsigned max_depth = 0;
+
+// print metadata instead of downloading, see scan= argument
+bool scan_mode = false;
+
+// product token for robots.txt groups, it's obeyed when crawling
+#define ROBOTS_AGENT  "pw-curl"
+
+// file to keep fetched URLs across runs, see seen= argument
+#define SEEN_FILTER_CAPACITY  10000000
+
+// session state is kept across runs in ~/.cache/pw-curl-fetch.*
+#define STATE_FILE_NAME  "/.cache/pw-curl-fetch"
+
+// max permanent redirects kept in session state
+#define REDIRECT_CACHE_SIZE  100000
+
+// response filter from types= and max_size= arguments
+#define MAX_MEDIA_TYPES  16
+char media_types_buffer[1024];
+char* media_types[MAX_MEDIA_TYPES + 1];
+CurlResponseFilter response_filter = {};
+uint64_t num_filtered = 0;
+
 
 // CURL session
 void* curl_session = nullptr;
 
+// pending URLs
+void* frontier = nullptr;
+
+
+// URL input, see input= argument
+//
+// URLs are read one per line, as many as needed to keep INPUT_READ_AHEAD
+// of them queued in the frontier, so long lists take constant memory
+// and fetching starts immediately. Zstd-compressed input is detected
+// by magic number.
+
+#define INPUT_BUFFER_SIZE  65536  // longer lines are skipped
+#define INPUT_READ_AHEAD   1000
+
+typedef struct {
+    int fd;
+    char buffer[INPUT_BUFFER_SIZE + 1];  // extra byte to terminate the last line
+    unsigned start;  // beginning of unread data
+    unsigned end;
+    bool eof;
+    bool skip_line;  // the rest of too long line is in the buffer
+#   ifdef HAVE_ZSTD
+        ZSTD_DCtx* zstd;
+        char zbuffer[INPUT_BUFFER_SIZE];
+        ZSTD_inBuffer zinput;
+#   endif
+} UrlInput;
+
+UrlInput* url_input = nullptr;
+
+[[nodiscard]] bool open_url_input(char* path)
+{
+    url_input = calloc(1, sizeof(UrlInput));
+    if (!url_input) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    if (strcmp(path, "-") == 0) {
+        url_input->fd = 0;
+    } else {
+        url_input->fd = open(path, O_RDONLY);
+        if (url_input->fd == -1) {
+            pw_set_status(PwStatus(PW_ERROR), "Cannot open %s: %s", path, strerror(errno));
+            free(url_input);
+            url_input = nullptr;
+            return false;
+        }
+    }
+    // peek at magic number, this works for pipes too
+    while (url_input->end < 4) {
+        ssize_t n = read(url_input->fd, url_input->buffer + url_input->end, 4 - url_input->end);
+        if (n <= 0) {
+            break;
+        }
+        url_input->end += n;
+    }
+    if (url_input->end == 4 && memcmp(url_input->buffer, "\x28\xB5\x2F\xFD", 4) == 0) {
+#       ifdef HAVE_ZSTD
+            url_input->zstd = ZSTD_createDCtx();
+            if (!url_input->zstd) {
+                pw_set_status(PwStatus(PW_ERROR_OOM));
+                return false;
+            }
+            memcpy(url_input->zbuffer, url_input->buffer, 4);
+            url_input->zinput = (ZSTD_inBuffer) { .src = url_input->zbuffer, .size = 4, .pos = 0 };
+            url_input->end = 0;
+#       else
+            pw_set_status(PwStatus(PW_ERROR), "%s is compressed with zstd, which is not supported by this build", path);
+            return false;
+#       endif
+    }
+    return true;
+}
+
+void close_url_input()
+{
+    if (!url_input) {
+        return;
+    }
+#   ifdef HAVE_ZSTD
+        if (url_input->zstd) {
+            ZSTD_freeDCtx(url_input->zstd);
+        }
+#   endif
+    if (url_input->fd != 0) {
+        close(url_input->fd);
+    }
+    free(url_input);
+    url_input = nullptr;
+}
+
+[[nodiscard]] static bool read_input(UrlInput* input)
+/*
+ * Append more data to the buffer.
+ */
+{
+    char* dest = input->buffer + input->end;
+    size_t size = INPUT_BUFFER_SIZE - input->end;
+#   ifdef HAVE_ZSTD
+        if (input->zstd) {
+            ZSTD_outBuffer output = { .dst = dest, .size = size, .pos = 0 };
+            while (output.pos == 0) {
+                if (input->zinput.pos == input->zinput.size) {
+                    ssize_t n = read(input->fd, input->zbuffer, INPUT_BUFFER_SIZE);
+                    if (n == -1) {
+                        pw_set_status(PwStatus(PW_ERROR), "Read error: %s", strerror(errno));
+                        return false;
+                    }
+                    if (n == 0) {
+                        input->eof = true;
+                        return true;
+                    }
+                    input->zinput = (ZSTD_inBuffer) { .src = input->zbuffer, .size = n, .pos = 0 };
+                }
+                size_t rc = ZSTD_decompressStream(input->zstd, &output, &input->zinput);
+                if (ZSTD_isError(rc)) {
+                    pw_set_status(PwStatus(PW_ERROR), "Zstd error: %s", ZSTD_getErrorName(rc));
+                    return false;
+                }
+            }
+            input->end += output.pos;
+            return true;
+        }
+#   endif
+    ssize_t n = read(input->fd, dest, size);
+    if (n == -1) {
+        pw_set_status(PwStatus(PW_ERROR), "Read error: %s", strerror(errno));
+        return false;
+    }
+    if (n == 0) {
+        input->eof = true;
+    }
+    input->end += n;
+    return true;
+}
+
+[[nodiscard]] bool read_url(PwValuePtr url)
+/*
+ * Read next URL from input, skipping empty lines and comments.
+ * Set url to null at the end of input.
+ */
+{
+    UrlInput* input = url_input;
+    pw_destroy(url);
+    for (;;) {
+        char* line = input->buffer + input->start;
+        char* newline = memchr(line, '\n', input->end - input->start);
+        if (!newline) {
+            if (input->eof) {
+                if (input->start == input->end || input->skip_line) {
+                    return true;
+                }
+                // last line without newline
+                newline = input->buffer + input->end;
+            } else {
+                if (input->start == 0 && input->end == INPUT_BUFFER_SIZE) {
+                    fprintf(stderr, "WARNING: skipping too long line in input\n");
+                    input->skip_line = true;
+                    input->end = 0;
+                } else {
+                    memmove(input->buffer, line, input->end - input->start);
+                    input->end -= input->start;
+                    input->start = 0;
+                }
+                if (!read_input(input)) {
+                    return false;
+                }
+                continue;
+            }
+        }
+        input->start = (newline < input->buffer + input->end)? newline + 1 - input->buffer : input->end;
+        if (input->skip_line) {
+            input->skip_line = false;
+            continue;
+        }
+        char* end = newline;
+        while (line < end && (*line == ' ' || *line == '\t')) {
+            line++;
+        }
+        while (end > line && (end[-1] == ' ' || end[-1] == '\t' || end[-1] == '\r')) {
+            end--;
+        }
+        if (line == end || *line == '#') {
+            continue;
+        }
+        *end = 0;  // there's always room: newline or the extra byte
+        return pw_create_string(line, url);
+    }
+}
+
+[[nodiscard]] bool refill_frontier()
+/*
+ * Add URLs from input until the frontier has enough of them queued.
+ */
+{
+    while (url_input && curl_frontier_queued(frontier) < INPUT_READ_AHEAD) {{
+        PwValue url = PW_NULL;
+        if (!read_url(&url)) {
+            return false;
+        }
+        if (pw_is_null(&url)) {
+            close_url_input();
+            break;
+        }
+        if (!curl_frontier_add_seed(frontier, &url)) {
+            return false;
+        }
+    }}
+    return true;
+}
+
 
 // signal handling
 
@@ -41,7 +292,7 @@ void sigint_handler(int sig)
     pending_sigint = 1;
 }
 
-[[nodiscard]] bool create_request(PwValuePtr url)
+[[nodiscard]] bool create_request(PwValuePtr url, unsigned depth)
 /*
  * Helper function to create Curl request of our custom FileRequest type
  */
@@ -49,12 +300,18 @@ void sigint_handler(int sig)
     PwValue request = PW_NULL;
     if (!pw_create(PwTypeId_FileRequest, &request)) {
         pw_print_status(stdout, &current_task->status);
+        curl_frontier_done(frontier, url, false);
         return false;
     }
 
-    PW_CSTRING_LOCAL(url_cstr, url);
-    printf("Requesting %s\n", url_cstr);
+    file_request_data_ptr(&request)->depth = depth;
 
+    if (scan_mode) {
+        curl_request_set_scan_mode(&request, true);
+    } else {
+        PW_CSTRING_LOCAL(url_cstr, url);
+        printf("Requesting %s\n", url_cstr);
+    }
     curl_request_set_url(&request, url);
     curl_request_set_proxy(&request, &proxy);
     if (verbose.bool_value) {
@@ -63,11 +320,64 @@ void sigint_handler(int sig)
     add_curl_request(curl_session, &request);
 
     // request is now held by Curl handle
-    // and will be destroyed in curl_perform
+    // and will be destroyed in curl_perform;
+    // the frontier is notified when this happens, see fini_file_request
 
     return true;
 }
 
+[[nodiscard]] bool extract_links(FileRequestData* file_req, char* data, size_t size)
+/*
+ * Feed HTML page to link extractor and add found links to the frontier.
+ */
+{
+    if (file_req->depth >= max_depth || file_req->not_html) {
+        return true;
+    }
+    CurlRequestData* req = &file_req->curl_request;
+    if (!file_req->extractor) {
+        if (curl_request_media_type_atom(req) != &curl_atom_text
+            || curl_request_media_subtype_atom(req) != &curl_atom_html) {
+            file_req->not_html = true;
+            return true;
+        }
+        // links are relative to the URL after redirects
+        char* base_url = nullptr;
+        curl_easy_getinfo(req->easy_handle, CURLINFO_EFFECTIVE_URL, &base_url);
+        if (!base_url) {
+            file_req->not_html = true;
+            return true;
+        }
+        file_req->extractor = default_allocator.allocate(sizeof(CurlLinkExtractor), false);
+        if (!file_req->extractor) {
+            return false;
+        }
+        if (!curl_links_init(file_req->extractor, base_url)) {
+            default_allocator.release((void**) &file_req->extractor, sizeof(CurlLinkExtractor));
+            file_req->not_html = true;
+            return true;
+        }
+    }
+    PwValue links = PW_NULL;
+    if (!pw_create_array(&links)) {
+        return false;
+    }
+    if (!curl_links_feed(file_req->extractor, data, size, &links)) {
+        return false;
+    }
+    unsigned n = pw_array_length(&links);
+    for (unsigned i = 0; i < n; i++) {{
+        PwValue link = PW_NULL;
+        if (!pw_array_item(&links, i, &link)) {
+            return false;
+        }
+        if (!curl_frontier_add(frontier, &link, file_req->depth + 1)) {
+            return false;
+        }
+    }}
+    return true;
+}
+
 size_t write_data(void* data, size_t always_1, size_t size, PwValuePtr self)
 /*
  * Overloaded method of Curl interface.
@@ -93,7 +403,6 @@ size_t write_data(void* data, size_t always_1, size_t size, PwValuePtr self)
         // the file is not created yet, do that
 
         // get file name from response headers
-        curl_request_parse_headers(&file_req->curl_request);
         PwValue filename_info = PW_NULL;
         if (!curl_request_get_filename(&file_req->curl_request, &filename_info)) {
             return 0;
@@ -133,6 +442,11 @@ size_t write_data(void* data, size_t always_1, size_t size, PwValuePtr self)
         printf("Downloading %s -> %s\n", url_cstr, filename_cstr);
     }
 
+    if (!extract_links(file_req, data, size)) {
+        pw_print_status(stdout, &current_task->status);
+        return 0;
+    }
+
     // write data to file
 
     unsigned bytes_written;
@@ -143,6 +457,24 @@ size_t write_data(void* data, size_t always_1, size_t size, PwValuePtr self)
     return bytes_written;
 }
 
+void print_scan_record(FileRequestData* file_req)
+/*
+ * Print tab-separated status, length, media type, time to first byte
+ * and total time in milliseconds, URL, and real URL.
+ * Failed transfers have zero status.
+ */
+{
+    CurlScanResult result = {};
+    curl_request_scan_result(&file_req->curl_request, &result);
+    PW_CSTRING_LOCAL(url_cstr, &file_req->curl_request.url);
+    printf("%u\t%lld\t%.*s\t%.1f\t%.1f\t%s\t%s\n",
+           file_req->scanned? result.status : 0,
+           (long long) result.content_length,
+           (int) result.media_type_length, result.media_type? result.media_type : "",
+           result.starttransfer_time / 1000.0, result.total_time / 1000.0,
+           url_cstr, result.real_url? result.real_url : "");
+}
+
 void request_complete(PwValuePtr self)
 /*
  * Overloaded method of Curl interface.
@@ -150,6 +482,13 @@ void request_complete(PwValuePtr self)
 {
     FileRequestData* file_req = file_request_data_ptr(self);
 
+    file_req->completed = true;
+    if (scan_mode) {
+        file_req->scanned = true;
+        print_scan_record(file_req);
+        return;
+    }
+
     if(file_req->curl_request.status != 200) {
         PW_CSTRING_LOCAL(url_cstr, &file_req->curl_request.url);
         printf("FAILED: %u %s\n", file_req->curl_request.status, url_cstr);
@@ -173,9 +512,48 @@ void fini_file_request(PwValuePtr self)
 {
     FileRequestData* req = file_request_data_ptr(self);
 
+    if (scan_mode && !req->scanned && req->curl_request.easy_handle) {
+        print_scan_record(req);
+    }
+    if (req->curl_request.filtered) {
+        static char* reasons[] = {
+            [CURL_FILTERED_STATUS]         = "status",
+            [CURL_FILTERED_MEDIA_TYPE]     = "media type",
+            [CURL_FILTERED_CONTENT_LENGTH] = "size"
+        };
+        PW_CSTRING_LOCAL(url_cstr, &req->curl_request.url);
+        printf("SKIPPED (%s): %s\n", reasons[req->curl_request.filtered], url_cstr);
+        num_filtered++;
+    }
+
+    // release host slot, whether the request succeeded or not;
+    // server errors and transfer failures are retried by the next run
+    unsigned status = req->curl_request.status;
+    bool fetched = req->curl_request.filtered
+                   || (req->completed && status >= 200 && status < 500 && status != 429);
+    curl_frontier_done(frontier, &req->curl_request.url, fetched);
+
+    if (req->extractor) {
+        curl_links_fini(req->extractor);
+        default_allocator.release((void**) &req->extractor, sizeof(CurlLinkExtractor));
+    }
     pw_destroy(&req->file);
 }
 
+void parse_media_types(char* list)
+/*
+ * Split comma-separated list of media types for the response filter.
+ */
+{
+    strncpy(media_types_buffer, list, sizeof(media_types_buffer) - 1);
+    unsigned n = 0;
+    for (char* type = strtok(media_types_buffer, ","); type && n < MAX_MEDIA_TYPES; type = strtok(nullptr, ",")) {
+        media_types[n++] = type;
+    }
+    media_types[n] = nullptr;
+    response_filter.media_types = media_types;
+}
+
 static bool pw_main(int argc, char* argv[])
 {
     // parse command line arguments
@@ -184,6 +562,12 @@ static bool pw_main(int argc, char* argv[])
         return false;
     }
     PwValue parallel = PW_UNSIGNED(1);
+    PwValue prewarm = PW_UNSIGNED(0);
+    PwValue delay = PW_UNSIGNED(0);
+    PwValue per_host = PW_UNSIGNED(0);
+    PwValue burst = PW_UNSIGNED(0);
+    PwValue seen_file = PW_NULL;
+    PwValue input_file = PW_NULL;
     for (int i = 1; i < argc; i++) {{  // mind double curly brackets for nested scope
         // nested scope makes autocleaning working after each iteration
 
@@ -215,21 +599,112 @@ static bool pw_main(int argc, char* argv[])
             if (pw_parse_number(&s, &n)) {
                 parallel = n;
             }
+        } else if (pw_startswith(&arg, "prewarm=")) {
+            PwValue s = PW_NULL;
+            if (!pw_substr(&arg, strlen("prewarm="), pw_strlen(&arg), &s)) {
+                return false;
+            }
+            PwValue n = PW_NULL;
+            if (pw_parse_number(&s, &n)) {
+                prewarm = n;
+            }
+        } else if (pw_startswith(&arg, "delay=")) {
+            PwValue s = PW_NULL;
+            if (!pw_substr(&arg, strlen("delay="), pw_strlen(&arg), &s)) {
+                return false;
+            }
+            PwValue n = PW_NULL;
+            if (pw_parse_number(&s, &n)) {
+                delay = n;
+            }
+        } else if (pw_startswith(&arg, "depth=")) {
+            PwValue s = PW_NULL;
+            if (!pw_substr(&arg, strlen("depth="), pw_strlen(&arg), &s)) {
+                return false;
+            }
+            PwValue n = PW_NULL;
+            if (pw_parse_number(&s, &n)) {
+                max_depth = n.signed_value;
+            }
+        } else if (pw_startswith(&arg, "input=")) {
+            if (!pw_substr(&arg, strlen("input="), pw_strlen(&arg), &input_file)) {
+                return false;
+            }
+        } else if (pw_startswith(&arg, "seen=")) {
+            if (!pw_substr(&arg, strlen("seen="), pw_strlen(&arg), &seen_file)) {
+                return false;
+            }
+        } else if (pw_startswith(&arg, "burst=")) {
+            PwValue s = PW_NULL;
+            if (!pw_substr(&arg, strlen("burst="), pw_strlen(&arg), &s)) {
+                return false;
+            }
+            PwValue n = PW_NULL;
+            if (pw_parse_number(&s, &n)) {
+                burst = n;
+            }
+        } else if (pw_startswith(&arg, "per_host=")) {
+            PwValue s = PW_NULL;
+            if (!pw_substr(&arg, strlen("per_host="), pw_strlen(&arg), &s)) {
+                return false;
+            }
+            PwValue n = PW_NULL;
+            if (pw_parse_number(&s, &n)) {
+                per_host = n;
+            }
         }
     }}
-    if (pw_array_length(&urls) == 0) {
-        printf("Usage: fetch [verbose=1|0] [proxy=<proxy>] [parallel=<n>] url1 url2 ...\n");
+    if (pw_array_length(&urls) == 0 && pw_is_null(&input_file)) {
+        printf("Usage: fetch [verbose=1|0] [proxy=<proxy>] [parallel=<n>] [prewarm=<n>] [delay=<ms>] [per_host=<n>] [burst=<n>] [depth=<n>] [seen=<path>] [input=<path>|-] [types=<type/subtype>,...] [max_size=<bytes>] [scan=1] [cafile=<path>] [transport=h3|altsvc|h1] url1 url2 ...\n");
         return true;
     }
+    if (!pw_is_null(&input_file)) {
+        PW_CSTRING_LOCAL(input_file_cstr, &input_file);
+        if (!open_url_input(input_file_cstr)) {
+            return false;
+        }
+    }
 
-    // fetch URLs
-    // prepare first request
-    {
+    // seed URLs go to the frontier that resolves their hosts ahead
+    // and takes them in turn, keeping per-host limits;
+    // when crawling, links found on HTML pages go there too
+    CurlFrontierOptions frontier_options = CURL_FRONTIER_DEFAULT_OPTIONS;
+    frontier_options.politeness_delay = delay.signed_value;
+    frontier_options.max_per_host = per_host.signed_value? per_host.signed_value : parallel.signed_value;
+    frontier_options.max_depth = max_depth;
+    // bursts of requests to the same host share HTTP/2 connection,
+    // session waits for it instead of opening new ones, see main
+    frontier_options.burst = burst.signed_value;
+    frontier_options.scope = CURL_SCOPE_DOMAIN;
+    if (max_depth) {
+        frontier_options.robots_agent = ROBOTS_AGENT;
+    }
+    if (pw_is_null(&seen_file)) {
+        frontier = create_curl_frontier(curl_session, &frontier_options);
+    } else {
+        // URLs fetched by previous runs are skipped, see fini_file_request
+        PW_CSTRING_LOCAL(seen_file_cstr, &seen_file);
+        frontier_options.seen_capacity = SEEN_FILTER_CAPACITY;
+        frontier_options.seen_file = seen_file_cstr;
+        frontier = create_curl_frontier(curl_session, &frontier_options);
+    }
+    if (!frontier) {
+        return false;
+    }
+    unsigned n = pw_array_length(&urls);
+    for (unsigned i = 0; i < n; i++) {{
         PwValue url = PW_NULL;
-        if (!pw_array_pop(&urls, &url)) {
+        if (!pw_array_item(&urls, i, &url)) {
+            return false;
+        }
+        if (!curl_frontier_add_seed(frontier, &url)) {
             return false;
         }
-        if (!create_request(&url)) {
+    }}
+
+    // open connections before the first request
+    if (prewarm.signed_value > 0) {
+        if (!curl_session_prewarm(curl_session, &urls, prewarm.signed_value)) {
             return false;
         }
     }
@@ -237,6 +712,9 @@ static bool pw_main(int argc, char* argv[])
     // perform fetching
 
     while(!pending_sigint) {
+        if (!refill_frontier()) {
+            return false;
+        }
         int running_transfers;
         if (!curl_perform(curl_session, &running_transfers)) {
             // failure
@@ -246,20 +724,68 @@ static bool pw_main(int argc, char* argv[])
         unsigned i = running_transfers;
         // add more requests
         for(; i < parallel.signed_value; i++) {{
-            if (pw_array_length(&urls) == 0) {
-                break;
-            }
             PwValue url = PW_NULL;
-            if (!pw_array_pop(&urls, &url)) {
+            unsigned depth;
+            if (!curl_frontier_next(frontier, &url, &depth)) {
                 return false;
             }
-            if (!create_request(&url)) {
+            if (pw_is_null(&url)) {
+                break;
+            }
+            if (!create_request(&url, depth)) {
                 return false;
             }
         }}
         if (i == 0) {
             // no running transfers and no more URLs were added
-            break;
+            uint64_t wait_time = curl_frontier_wait_time(frontier);
+            if (wait_time == UINT64_MAX) {
+                break;
+            }
+            // hosts are waiting for politeness delay
+            usleep(wait_time);
+        }
+    }
+    if (verbose.bool_value) {
+        CurlDnsStats dns;
+        curl_session_dns_stats(curl_session, &dns);
+        printf("DNS: %llu lookups, %llu failed, avg %llu us, max %llu us, %llu hits, %llu misses\n",
+               (unsigned long long) dns.lookups, (unsigned long long) dns.failures,
+               (unsigned long long) (dns.lookups? dns.lookup_time_usec / dns.lookups : 0),
+               (unsigned long long) dns.max_lookup_time_usec,
+               (unsigned long long) dns.hits, (unsigned long long) dns.misses);
+
+        CurlConnectionStats conn;
+        curl_session_connection_stats(curl_session, &conn);
+        printf("Connections: %llu transfers, %llu new connections, %llu reused, %llu prewarmed\n",
+               (unsigned long long) conn.transfers, (unsigned long long) conn.new_connections,
+               (unsigned long long) conn.reused, (unsigned long long) conn.prewarmed);
+        printf("Protocols: %llu HTTP/1.x, %llu HTTP/2, %llu HTTP/3\n",
+               (unsigned long long) conn.http1, (unsigned long long) conn.http2,
+               (unsigned long long) conn.http3);
+        printf("Reuse ratio %.2f, %.1f streams per HTTP/2 or HTTP/3 connection\n",
+               conn.transfers? (double) conn.reused / conn.transfers : 0.0,
+               conn.multiplexed_connections? (double) (conn.http2 + conn.http3) / conn.multiplexed_connections : 0.0);
+
+        CurlRedirectStats rs;
+        curl_session_redirect_stats(curl_session, &rs);
+        printf("Redirects: %llu cached, %llu hits, %llu misses, %llu hops saved\n",
+               (unsigned long long) rs.entries, (unsigned long long) rs.hits,
+               (unsigned long long) rs.misses, (unsigned long long) rs.hops_saved);
+
+        CurlFrontierStats fs;
+        curl_frontier_stats(frontier, &fs);
+        printf("Frontier: %llu hosts, %llu dispatched, %llu completed, %llu queued, %llu duplicates, %llu bursts\n",
+               (unsigned long long) fs.hosts, (unsigned long long) fs.dispatched,
+               (unsigned long long) fs.completed, (unsigned long long) fs.queued,
+               (unsigned long long) fs.duplicates, (unsigned long long) fs.bursts);
+        printf("Seen: %llu URLs, false positive rate %.4f%%, %llu fetched before\n",
+               (unsigned long long) fs.seen, fs.seen_fp_rate * 100, (unsigned long long) fs.done_before);
+        if (max_depth) {
+            printf("Robots: %llu URLs disallowed\n", (unsigned long long) fs.disallowed);
+        }
+        if (response_filter.media_types || response_filter.max_content_length) {
+            printf("Filter: %llu responses skipped\n", (unsigned long long) num_filtered);
         }
     }
     return true;
@@ -302,14 +828,53 @@ int main(int argc, char* argv[])
 
     // main routine
 
-    curl_session = create_curl_session();
+    CurlSessionOptions session_options = CURL_SESSION_DEFAULT_OPTIONS;
+    char state_file[4096];
+    char* home = getenv("HOME");
+    if (home && strlen(home) + strlen(STATE_FILE_NAME) < sizeof(state_file)) {
+        strcpy(state_file, home);
+        strcat(state_file, STATE_FILE_NAME);
+        session_options.state_file = state_file;
+    }
+    session_options.redirect_cache_size = REDIRECT_CACHE_SIZE;
+    // session options are needed before pw_main parses the rest of arguments
+    for (int i = 1; i < argc; i++) {
+        if (strncmp(argv[i], "cafile=", strlen("cafile=")) == 0) {
+            session_options.ca_file = argv[i] + strlen("cafile=");
+        } else if (strcmp(argv[i], "transport=h3") == 0) {
+            session_options.transport = CURL_TRANSPORT_HTTP3;
+        } else if (strcmp(argv[i], "transport=altsvc") == 0) {
+            session_options.transport = CURL_TRANSPORT_ALTSVC;
+        } else if (strcmp(argv[i], "transport=h1") == 0) {
+            session_options.transport = CURL_TRANSPORT_HTTP1_1;
+        } else if (strncmp(argv[i], "burst=", strlen("burst=")) == 0) {
+            session_options.pipewait = true;
+        } else if (strcmp(argv[i], "scan=1") == 0) {
+            // many HEAD requests to the same host go over one HTTP/2 connection
+            scan_mode = true;
+            session_options.pipewait = true;
+        } else if (strncmp(argv[i], "types=", strlen("types=")) == 0) {
+            parse_media_types(argv[i] + strlen("types="));
+            session_options.filter = &response_filter;
+        } else if (strncmp(argv[i], "max_size=", strlen("max_size=")) == 0) {
+            response_filter.max_content_length = strtoll(argv[i] + strlen("max_size="), nullptr, 10);
+            session_options.filter = &response_filter;
+        }
+    }
+    curl_session = create_curl_session(&session_options);
 
     if (!pw_main(argc, argv)) {
         pw_print_status(stdout, &current_task->status);
     }
+    close_url_input();
 
     delete_curl_session(curl_session);
 
+    // requests destroyed with session report to the frontier, delete it after
+    if (frontier) {
+        delete_curl_frontier(frontier);
+    }
+
     // global finalization
 
     pw_destroy(&proxy);  // can be allocated string
@@ -0,0 +1,276 @@
+/*
+ * Split block Bloom filter for fingerprints.
+ *
+ * Each key maps to one 256-bit block, i.e. to one cache line half,
+ * and sets one bit in each of eight 32-bit words of the block.
+ * Bit positions come from multiplying the key by eight odd constants,
+ * which is a single vector multiply with AVX2. Lookups touch one
+ * cache line and need no more hashing than the fingerprint already has.
+ *
+ * The filter is a single memory region: header followed by blocks.
+ * It is either anonymous memory, or a file mapped with MAP_SHARED,
+ * so the filter survives restarts without explicit loading and saving.
+ * Pages are zeroed lazily by the kernel in both cases.
+ */
+
+#include <errno.h>
+#include <fcntl.h>
+#include <stdio.h>
+#include <string.h>
+#include <sys/mman.h>
+#include <sys/stat.h>
+#include <unistd.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define HAVE_X86_SIMD
+#endif
+
+#define BLOOM_MAGIC  "PWBLOOM1"
+
+typedef struct {
+    char magic[8];
+    uint64_t num_blocks;
+    uint64_t count;
+    uint64_t reserved[5];  // pad to 64 bytes to keep blocks aligned
+} BloomHeader;
+
+static const uint32_t salts[8] = {
+    0x47b6137bU, 0x44974d91U, 0x8824ad5bU, 0xa2b7289dU,
+    0x705495c7U, 0x2df1424bU, 0x9efc4947U, 0x5c6bfb31U
+};
+
+static inline uint32_t* get_block(CurlBloom* bloom, CurlFingerprint* fp)
+{
+    // multiply-shift maps hi to [0, num_blocks) without division
+    uint64_t i = (uint64_t) (((unsigned __int128) fp->hi * bloom->num_blocks) >> 64);
+    return bloom->blocks + i * 8;
+}
+
+static bool add_scalar(uint32_t* block, uint32_t key)
+{
+    bool present = true;
+    for (unsigned i = 0; i < 8; i++) {
+        uint32_t mask = 1U << ((key * salts[i]) >> 27);
+        if (!(block[i] & mask)) {
+            present = false;
+            block[i] |= mask;
+        }
+    }
+    return !present;
+}
+
+static bool contains_scalar(uint32_t* block, uint32_t key)
+{
+    for (unsigned i = 0; i < 8; i++) {
+        uint32_t mask = 1U << ((key * salts[i]) >> 27);
+        if (!(block[i] & mask)) {
+            return false;
+        }
+    }
+    return true;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("avx2")))
+static inline __m256i make_mask_avx2(uint32_t key)
+{
+    __m256i products = _mm256_mullo_epi32(_mm256_set1_epi32(key), _mm256_loadu_si256((__m256i*) salts));
+    return _mm256_sllv_epi32(_mm256_set1_epi32(1), _mm256_srli_epi32(products, 27));
+}
+
+__attribute__((target("avx2")))
+static bool add_avx2(uint32_t* block, uint32_t key)
+{
+    __m256i mask = make_mask_avx2(key);
+    __m256i bits = _mm256_load_si256((__m256i*) block);
+    if (_mm256_testc_si256(bits, mask)) {
+        return false;
+    }
+    _mm256_store_si256((__m256i*) block, _mm256_or_si256(bits, mask));
+    return true;
+}
+
+__attribute__((target("avx2")))
+static bool contains_avx2(uint32_t* block, uint32_t key)
+{
+    return _mm256_testc_si256(_mm256_load_si256((__m256i*) block), make_mask_avx2(key));
+}
+
+#endif
+
+static bool (*add_to_block)(uint32_t* block, uint32_t key) = add_scalar;
+static bool (*block_contains)(uint32_t* block, uint32_t key) = contains_scalar;
+
+[[ gnu::constructor ]]
+static void init()
+{
+#   ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            add_to_block = add_avx2;
+            block_contains = contains_avx2;
+        }
+#   endif
+}
+
+static uint64_t num_blocks_for(uint64_t capacity, double fp_rate)
+/*
+ * Eight bits per key in one block need more memory than classic
+ * Bloom filter for the same rate. These bits per key give measured rates
+ * 1.3%, 0.4%, 0.08%, 0.015%, and 0.004% at full capacity.
+ */
+{
+    unsigned bits_per_key;
+    if (fp_rate >= 0.02) {
+        bits_per_key = 10;
+    } else if (fp_rate >= 0.005) {
+        bits_per_key = 13;
+    } else if (fp_rate >= 0.001) {
+        bits_per_key = 18;
+    } else if (fp_rate >= 0.0002) {
+        bits_per_key = 24;
+    } else {
+        bits_per_key = 32;
+    }
+    if (capacity == 0) {
+        capacity = 1;
+    }
+    return (capacity * bits_per_key + 255) / 256;
+}
+
+static void set_region(CurlBloom* bloom, void* map, size_t map_size)
+{
+    BloomHeader* header = map;
+    bloom->map = map;
+    bloom->map_size = map_size;
+    bloom->num_blocks = header->num_blocks;
+    bloom->blocks = (uint32_t*) (header + 1);
+}
+
+[[nodiscard]] bool curl_bloom_create(CurlBloom* bloom, uint64_t capacity, double fp_rate)
+{
+    memset(bloom, 0, sizeof(CurlBloom));
+
+    uint64_t num_blocks = num_blocks_for(capacity, fp_rate);
+    size_t map_size = sizeof(BloomHeader) + num_blocks * 32;
+    void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_PRIVATE | MAP_ANONYMOUS, -1, 0);
+    if (map == MAP_FAILED) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    BloomHeader* header = map;
+    memcpy(header->magic, BLOOM_MAGIC, sizeof(header->magic));
+    header->num_blocks = num_blocks;
+    set_region(bloom, map, map_size);
+    return true;
+}
+
+[[nodiscard]] bool curl_bloom_open(CurlBloom* bloom, char* path, uint64_t capacity, double fp_rate)
+{
+    memset(bloom, 0, sizeof(CurlBloom));
+
+    int fd = open(path, O_RDWR | O_CREAT, 0644);
+    if (fd == -1) {
+        pw_set_status(PwStatus(PW_ERROR), "Cannot open %s: %s", path, strerror(errno));
+        return false;
+    }
+    bool ret = false;
+    struct stat st;
+    if (fstat(fd, &st) == -1) {
+        pw_set_status(PwStatus(PW_ERROR), "Cannot stat %s: %s", path, strerror(errno));
+        goto out;
+    }
+    BloomHeader header;
+    bool existing = false;
+    if ((size_t) st.st_size >= sizeof(BloomHeader)
+        && pread(fd, &header, sizeof(header), 0) == sizeof(header)
+        && memcmp(header.magic, BLOOM_MAGIC, sizeof(header.magic)) == 0
+        && (size_t) st.st_size == sizeof(BloomHeader) + header.num_blocks * 32) {
+
+        existing = true;
+    } else if (st.st_size != 0) {
+        fprintf(stderr, "WARNING: %s is not a valid filter, recreating\n", path);
+    }
+    if (!existing) {
+        memset(&header, 0, sizeof(header));
+        memcpy(header.magic, BLOOM_MAGIC, sizeof(header.magic));
+        header.num_blocks = num_blocks_for(capacity, fp_rate);
+        // truncate to zero first to discard old bits
+        if (ftruncate(fd, 0) == -1 || ftruncate(fd, sizeof(BloomHeader) + header.num_blocks * 32) == -1
+            || pwrite(fd, &header, sizeof(header), 0) != sizeof(header)) {
+            pw_set_status(PwStatus(PW_ERROR), "Cannot initialize %s: %s", path, strerror(errno));
+            goto out;
+        }
+    }
+    size_t map_size = sizeof(BloomHeader) + header.num_blocks * 32;
+    void* map = mmap(nullptr, map_size, PROT_READ | PROT_WRITE, MAP_SHARED, fd, 0);
+    if (map == MAP_FAILED) {
+        pw_set_status(PwStatus(PW_ERROR), "Cannot map %s: %s", path, strerror(errno));
+        goto out;
+    }
+    set_region(bloom, map, map_size);
+    bloom->file_backed = true;
+    ret = true;
+
+out:
+    close(fd);
+    return ret;
+}
+
+void curl_bloom_sync(CurlBloom* bloom)
+{
+    if (bloom->file_backed && msync(bloom->map, bloom->map_size, MS_ASYNC) == -1) {
+        fprintf(stderr, "WARNING: %s: %s\n", __func__, strerror(errno));
+    }
+}
+
+void curl_bloom_close(CurlBloom* bloom)
+{
+    if (bloom->map) {
+        munmap(bloom->map, bloom->map_size);
+        bloom->map = nullptr;
+    }
+}
+
+bool curl_bloom_add(CurlBloom* bloom, CurlFingerprint* fp)
+{
+    if (add_to_block(get_block(bloom, fp), (uint32_t) fp->lo)) {
+        ((BloomHeader*) bloom->map)->count++;
+        return true;
+    }
+    return false;
+}
+
+bool curl_bloom_contains(CurlBloom* bloom, CurlFingerprint* fp)
+{
+    return block_contains(get_block(bloom, fp), (uint32_t) fp->lo);
+}
+
+uint64_t curl_bloom_count(CurlBloom* bloom)
+{
+    return ((BloomHeader*) bloom->map)->count;
+}
+
+double curl_bloom_measure_fp_rate(CurlBloom* bloom, unsigned num_probes)
+{
+    // random fingerprints, practically never inserted
+    uint64_t state = 0x9e3779b97f4a7c15ULL ^ curl_now_usec();
+    unsigned positives = 0;
+    for (unsigned i = 0; i < num_probes; i++) {
+        CurlFingerprint fp;
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        fp.lo = state;
+        state ^= state << 13; state ^= state >> 7; state ^= state << 17;
+        fp.hi = state;
+        if (curl_bloom_contains(bloom, &fp)) {
+            positives++;
+        }
+    }
+    return num_probes? (double) positives / num_probes : 0.0;
+}
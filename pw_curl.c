@@ -1,8 +1,9 @@
 #include <stdlib.h>
+#include <string.h>
 
 #include <pw.h>
 
-#include "pw_curl.h"
+#include "pw_curl_internal.h"
 
 static char* default_http_headers[] = {
     "User-Agent: pw-curl (https://tilde.club/~petbrain/)",
@@ -23,17 +24,26 @@ static void fini_curl_request(PwValuePtr self)
     pw_destroy(&req->url);
     pw_destroy(&req->proxy);
     pw_destroy(&req->real_url);
+    pw_destroy(&req->cached_url);
     pw_destroy(&req->media_type);
     pw_destroy(&req->media_subtype);
     pw_destroy(&req->media_type_params);
     pw_destroy(&req->disposition_type);
     pw_destroy(&req->disposition_params);
+    pw_destroy(&req->validators.etag);
+    pw_destroy(&req->links);
     pw_destroy(&req->content);
+    curl_text_fini(&req->text_decoder);
 
     if (req->headers) {
         curl_slist_free_all(req->headers);
         req->headers = nullptr;
     }
+    if (req->resolve) {
+        curl_slist_free_all(req->resolve);
+        req->resolve = nullptr;
+    }
+    curl_header_index_fini(&req->header_index);
 
     if (req->easy_handle) {
         curl_easy_cleanup(req->easy_handle);
@@ -41,6 +51,37 @@ static void fini_curl_request(PwValuePtr self)
     }
 }
 
+static size_t request_header_data(char* data, size_t always_1, size_t size, PwValuePtr self)
+{
+    CurlRequestData* req = pw_curl_request_data_ptr(self);
+
+    bool status_line = size >= 5 && memcmp(data, "HTTP/", 5) == 0;
+    if (req->headers_complete && !status_line) {
+        // trailers after the body, response headers are already indexed and filtered
+        return size;
+    }
+    unsigned num_hops = req->header_index.num_hops;
+    if (!curl_header_index_add_line(&req->header_index, data, size)) {
+        return 0;
+    }
+    if (req->header_index.num_hops != num_hops) {
+        // new response, forget headers parsed for the previous one
+        req->parsed_headers = 0;
+        req->headers_complete = false;
+    }
+    if (size <= 2 && (data[0] == '\r' || data[0] == '\n') && !req->header_index.skip) {
+        // end of headers of final response, body follows unless libcurl starts next hop
+        req->headers_complete = true;
+        if (req->filter) {
+            req->filtered = curl_request_filter_response(req, req->filter);
+            if (req->filtered) {
+                return 0;
+            }
+        }
+    }
+    return size;
+}
+
 [[nodiscard]] static bool init_curl_request(PwValuePtr self, void* ctor_args)
 /*
  * Basic PW interface method
@@ -53,10 +94,6 @@ static void fini_curl_request(PwValuePtr self)
     req->proxy   = PwString("");
     req->media_type    = PwString("");
     req->media_subtype = PwString("");
-
-    if (!pw_create_map(&req->media_type_params)) {
-        return false;
-    }
     //req->content_encoding_is_utf8 = false;
     req->status  = 0;
     pw_clone2(&req->url, &req->real_url);
@@ -77,7 +114,6 @@ static void fini_curl_request(PwValuePtr self)
     // other essentials
     // XXX make configurable
     curl_easy_setopt(req->easy_handle, CURLOPT_ACCEPT_ENCODING, "gzip, deflate, br, zstd");
-    curl_easy_setopt(req->easy_handle, CURLOPT_CAINFO, "/etc/ssl/certs/ca-certificates.crt");
 
     curl_easy_setopt(req->easy_handle, CURLOPT_TIMEOUT, 1200L);
     curl_easy_setopt(req->easy_handle, CURLOPT_CONNECTTIMEOUT, 60L);
@@ -100,6 +136,11 @@ static void fini_curl_request(PwValuePtr self)
     curl_easy_setopt(req->easy_handle, CURLOPT_WRITEFUNCTION, iface->write_data);
     curl_easy_setopt(req->easy_handle, CURLOPT_WRITEDATA, self_ptr);
 
+    // index headers as they arrive
+    curl_easy_setopt(req->easy_handle, CURLOPT_HEADERFUNCTION, request_header_data);
+    curl_easy_setopt(req->easy_handle, CURLOPT_HEADERDATA, self_ptr);
+    curl_easy_setopt(req->easy_handle, CURLOPT_SUPPRESS_CONNECT_HEADERS, 1L);
+
     // python leftovers to do someday:
     //
     // if method == 'POST':
@@ -114,9 +155,11 @@ static size_t request_write_data(void* data, size_t always_1, size_t size, PwVal
 {
     CurlRequestData* req = pw_curl_request_data_ptr(self);
 
+    if (!size) {
+        return 0;
+    }
+    char* start = data;
     if (pw_is_null(&req->content)) {
-        curl_request_parse_headers(req);
-
         curl_off_t content_length;
         CURLcode res = curl_easy_getinfo(req->easy_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &content_length);
         if (res != CURLE_OK || content_length < 0) {
@@ -125,9 +168,16 @@ static size_t request_write_data(void* data, size_t always_1, size_t size, PwVal
         if (!pw_create_empty_string(content_length, 1, &req->content)) {
             return 0;
         }
+        if (req->text_mode) {
+            // skip byte order mark
+            start += curl_text_start(req, data, size);
+        }
     }
-    if (!size) {
-        return 0;
+    if (req->text_mode) {
+        if (!curl_text_decode(&req->text_decoder, start, ((char*) data) + size - start, false, &req->content)) {
+            return 0;
+        }
+        return size;
     }
     if (!pw_string_append(&req->content, (char*) data, ((char*) data) + size)) {
         return 0;
@@ -136,11 +186,17 @@ static size_t request_write_data(void* data, size_t always_1, size_t size, PwVal
 }
 
 static void request_complete(PwValuePtr self)
+/*
+ * Headers are parsed on demand, the only thing to do is
+ * to flush incomplete sequence in text mode.
+ */
 {
     CurlRequestData* req = pw_curl_request_data_ptr(self);
 
-    if (pw_is_null(&req->content)) {
-        curl_request_parse_headers(req);
+    if (req->text_mode && !pw_is_null(&req->content)) {
+        if (!curl_text_decode(&req->text_decoder, nullptr, 0, true, &req->content)) {
+            fprintf(stderr, "WARNING: failed to decode content\n");
+        }
     }
 }
 
@@ -213,6 +269,24 @@ void curl_request_verbose(PwValuePtr request, bool verbose)
     curl_easy_setopt(req->easy_handle, CURLOPT_VERBOSE, (long) verbose);
 }
 
+void curl_request_set_transport(PwValuePtr request, CurlTransport transport)
+{
+    CurlRequestData* req = pw_curl_request_data_ptr(request);
+    req->transport = transport;
+}
+
+void curl_request_set_filter(PwValuePtr request, CurlResponseFilter* filter)
+{
+    CurlRequestData* req = pw_curl_request_data_ptr(request);
+    req->filter = filter;
+}
+
+void curl_request_set_text_mode(PwValuePtr request, bool text_mode)
+{
+    CurlRequestData* req = pw_curl_request_data_ptr(request);
+    req->text_mode = text_mode;
+}
+
 void curl_update_status(PwValuePtr request)
 {
     CurlRequestData* req = pw_curl_request_data_ptr(request);
@@ -259,44 +333,337 @@ static void init()
  * CURL sessions and runner
  */
 
-void* create_curl_session()
+void* create_curl_session(CurlSessionOptions* options)
 {
-    CURLM* multi_handle = curl_multi_init();
+    static CurlSessionOptions default_options = CURL_SESSION_DEFAULT_OPTIONS;
+
+    CurlSession* session = default_allocator.allocate(sizeof(CurlSession), true);
+    if (!session) {
+        return nullptr;
+    }
+    session->options = options? *options : default_options;
+
+    session->multi_handle = curl_multi_init();
+    if (!session->multi_handle) {
+        default_allocator.release((void**) &session, sizeof(CurlSession));
+        return nullptr;
+    }
 
 #   ifdef CURLPIPE_MULTIPLEX
         // enables http/2
-        curl_multi_setopt(multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
+        curl_multi_setopt(session->multi_handle, CURLMOPT_PIPELINING, CURLPIPE_MULTIPLEX);
 #   endif
 
-    return (void*) multi_handle;
+    if (session->options.max_cached_connections) {
+        curl_multi_setopt(session->multi_handle, CURLMOPT_MAXCONNECTS, session->options.max_cached_connections);
+    }
+    if (session->options.dns_cache_ttl) {
+        session->dns = curl_dns_create(session->options.dns_cache_ttl);
+    }
+    if (session->options.redirect_cache_size) {
+        session->redirects = curl_redirects_create(session->options.redirect_cache_size,
+                                                   session->options.cache_temporary_redirects,
+                                                   session->options.state_file);
+    }
+#   if LIBCURL_VERSION_NUM >= 0x074200
+        session->http3_available = (curl_version_info(CURLVERSION_NOW)->features & CURL_VERSION_HTTP3) != 0;
+#   endif
+    curl_ca_init(session);
+    if (!curl_state_load(session)) {
+        fprintf(stderr, "WARNING: failed to initialize session state\n");
+    }
+    if (!session->altsvc && session->options.transport == CURL_TRANSPORT_ALTSVC) {
+        // upgrades need a cache shared by requests even if it is not persisted
+        session->altsvc = curl_altsvc_create(nullptr);
+    }
+    return (void*) session;
+}
+
+static void destroy_attached_requests(CurlSession* session)
+/*
+ * Destroy requests still attached to the multi handle, so their fini methods run.
+ */
+{
+#   if LIBCURL_VERSION_NUM >= 0x080400
+        CURL** handles = curl_multi_get_handles(session->multi_handle);
+        if (!handles) {
+            return;
+        }
+        for (CURL** h = handles; *h; h++) {
+            PwValuePtr request = nullptr;
+            curl_easy_getinfo(*h, CURLINFO_PRIVATE, (char**) &request);
+            curl_multi_remove_handle(session->multi_handle, *h);
+            if (request) {
+                curl_easy_setopt(*h, CURLOPT_PRIVATE, nullptr);
+                pw_destroy(request);
+                default_allocator.release((void**) &request, sizeof(_PwValue));
+            }
+        }
+        curl_free(handles);
+#   endif
 }
 
 void delete_curl_session(void* session)
 {
-    CURLM* multi_handle = (CURLM*) session;
+    CurlSession* s = (CurlSession*) session;
+
+    destroy_attached_requests(s);
 
-    CURLMcode err = curl_multi_cleanup(multi_handle);
+    CURLMcode err = curl_multi_cleanup(s->multi_handle);
     if (err) {
         fprintf(stderr, "ERROR %s: %s\n", __func__, curl_multi_strerror(err));
     }
+    if (s->dns) {
+        curl_dns_delete(s->dns);
+    }
+    if (s->redirects) {
+        curl_redirects_delete(s->redirects);
+    }
+    curl_state_save(s);
+    default_allocator.release((void**) &s, sizeof(CurlSession));
+}
+
+static void apply_transport(CurlSession* session, CurlRequestData* req)
+{
+    CurlTransport transport = req->transport? req->transport : session->options.transport;
+
+    switch (transport) {
+        case CURL_TRANSPORT_HTTP3:
+#           if LIBCURL_VERSION_NUM >= 0x074200
+                if (session->http3_available) {
+                    curl_easy_setopt(req->easy_handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_3);
+                    break;
+                }
+#           endif
+            if (!session->http3_warned) {
+                fprintf(stderr, "WARNING: libcurl is built without HTTP/3, using HTTP/2\n");
+                session->http3_warned = true;
+            }
+            curl_easy_setopt(req->easy_handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+            break;
+
+        case CURL_TRANSPORT_ALTSVC:
+            curl_easy_setopt(req->easy_handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+            if (session->altsvc) {
+                curl_altsvc_apply(session->altsvc, req);
+            } else {
+                // in-memory cache of the handle
+                curl_easy_setopt(req->easy_handle, CURLOPT_ALTSVC_CTRL,
+                                 (long) (CURLALTSVC_H1 | CURLALTSVC_H2 | CURLALTSVC_H3));
+                curl_easy_setopt(req->easy_handle, CURLOPT_ALTSVC, "");
+            }
+            break;
+
+        case CURL_TRANSPORT_HTTP1_1:
+            curl_easy_setopt(req->easy_handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_1_1);
+            break;
+
+        default:
+            break;
+    }
 }
 
 bool add_curl_request(void* session, PwValuePtr request)
 {
-    CURLM* multi_handle = (CURLM*) session;
+    CurlSession* s = (CurlSession*) session;
     CurlRequestData* req = pw_curl_request_data_ptr(request);
 
-    CURLMcode err = curl_multi_add_handle(multi_handle, req->easy_handle);
+    if (s->redirects && !req->prewarm) {
+        PW_CSTRING_LOCAL(url_cstr, &req->url);
+        curl_redirects_apply(s->redirects, req, url_cstr);
+    }
+    if (s->dns) {
+        PW_CSTRING_LOCAL(url_cstr, pw_is_string(&req->cached_url)? &req->cached_url : &req->url);
+        curl_dns_inject(s->dns, req, url_cstr);
+
+        // let libcurl expire injected entries along with its own
+        curl_easy_setopt(req->easy_handle, CURLOPT_DNS_CACHE_TIMEOUT, (long) s->options.dns_cache_ttl);
+    }
+    curl_state_apply(s, req);
+    curl_ca_apply(s, req);
+    apply_transport(s, req);
+    if (s->options.pipewait) {
+        curl_easy_setopt(req->easy_handle, CURLOPT_PIPEWAIT, 1L);
+    }
+    if (!req->filter && !req->prewarm) {
+        req->filter = s->options.filter;
+    }
+
+    CURLMcode err = curl_multi_add_handle(s->multi_handle, req->easy_handle);
     if (err) {
         fprintf(stderr, "ERROR: %s\n", curl_multi_strerror(err));
         return false;
+    }
+    if (req->prewarm) {
+        s->num_prewarming++;
+    }
+    return true;
+}
+
+void curl_session_prefetch_dns(void* session, PwValuePtr url)
+{
+    CurlSession* s = (CurlSession*) session;
+    if (s->dns) {
+        PW_CSTRING_LOCAL(url_cstr, url);
+        curl_dns_prefetch(s->dns, url_cstr);
+    }
+}
+
+void curl_session_dns_stats(void* session, CurlDnsStats* stats)
+{
+    CurlSession* s = (CurlSession*) session;
+    curl_dns_get_stats(s->dns, stats);
+}
+
+static char* get_origin(char* url)
+/*
+ * Strip path, query, and fragment from URL.
+ * Return string allocated by libcurl or nullptr on error.
+ */
+{
+    CURLU* handle = curl_url();
+    if (!handle) {
+        return nullptr;
+    }
+    char* origin = nullptr;
+    if (curl_url_set(handle, CURLUPART_URL, url, 0) == CURLUE_OK
+        && curl_url_set(handle, CURLUPART_PATH, "/", 0) == CURLUE_OK
+        && curl_url_set(handle, CURLUPART_QUERY, nullptr, 0) == CURLUE_OK
+        && curl_url_set(handle, CURLUPART_FRAGMENT, nullptr, 0) == CURLUE_OK) {
+
+        curl_url_get(handle, CURLUPART_URL, &origin, 0);
+    }
+    curl_url_cleanup(handle);
+    return origin;
+}
+
+bool curl_session_prewarm(void* session, PwValuePtr urls, unsigned num_connections)
+{
+    CurlSession* s = (CurlSession*) session;
+
+    // origins already warmed by this call
+    CurlHashTable origins;
+    if (!curl_hash_init(&origins, pw_array_length(urls))) {
+        return false;
+    }
+    bool result = false;
+    unsigned n = pw_array_length(urls);
+    for (unsigned i = 0; i < n; i++) {{
+        PwValue url = PW_NULL;
+        if (!pw_array_item(urls, i, &url)) {
+            goto out;
+        }
+        PW_CSTRING_LOCAL(url_cstr, &url);
+        char* origin_cstr = get_origin(url_cstr);
+        if (!origin_cstr) {
+            continue;
+        }
+        unsigned origin_length = strlen(origin_cstr);
+        if (curl_hash_get(&origins, origin_cstr, origin_length)) {
+            curl_free(origin_cstr);
+            continue;
+        }
+        PwValue origin = PW_NULL;
+        bool ok = curl_hash_put(&origins, origin_cstr, origin_length, s)
+                  && pw_create_string(origin_cstr, &origin);
+        curl_free(origin_cstr);
+        if (!ok) {
+            goto out;
+        }
+        for (unsigned j = 0; j < num_connections; j++) {{
+            PwValue request = PW_NULL;
+            if (!pw_create(PwTypeId_CurlRequest, &request)) {
+                goto out;
+            }
+            CurlRequestData* req = pw_curl_request_data_ptr(&request);
+            req->prewarm = true;
+
+            curl_request_set_url(&request, &origin);
+            curl_easy_setopt(req->easy_handle, CURLOPT_NOBODY, 1L);
+            curl_easy_setopt(req->easy_handle, CURLOPT_FOLLOWLOCATION, 0L);
+            curl_easy_setopt(req->easy_handle, CURLOPT_HTTP_VERSION, (long) CURL_HTTP_VERSION_2TLS);
+            if (j) {
+                // do not multiplex over the first one, open new connection
+                curl_easy_setopt(req->easy_handle, CURLOPT_FRESH_CONNECT, 1L);
+            }
+            if (!add_curl_request(session, &request)) {
+                goto out;
+            }
+        }}
+    }}
+    result = true;
+
+out:
+    curl_hash_fini(&origins, nullptr);
+    return result;
+}
+
+void curl_session_redirect_stats(void* session, CurlRedirectStats* stats)
+{
+    CurlSession* s = (CurlSession*) session;
+    curl_redirects_get_stats(s->redirects, stats);
+}
+
+void curl_session_connection_stats(void* session, CurlConnectionStats* stats)
+{
+    CurlSession* s = (CurlSession*) session;
+    *stats = s->connection_stats;
+}
+
+static void update_connection_metrics(CurlSession* session, CurlRequestData* req)
+{
+    curl_easy_getinfo(req->easy_handle, CURLINFO_NUM_CONNECTS, &req->num_connects);
+    curl_easy_getinfo(req->easy_handle, CURLINFO_CONNECT_TIME_T, &req->connect_time);
+    curl_easy_getinfo(req->easy_handle, CURLINFO_APPCONNECT_TIME_T, &req->appconnect_time);
+    curl_easy_getinfo(req->easy_handle, CURLINFO_TOTAL_TIME_T, &req->total_time);
+    curl_easy_getinfo(req->easy_handle, CURLINFO_HTTP_VERSION, &req->http_version);
+    req->connection_reused = (req->num_connects == 0);
+
+    CurlConnectionStats* stats = &session->connection_stats;
+    long connections = req->num_connects;
+    if (req->prewarm) {
+        // multiplexed or failed pre-warms do not open connections
+        if (connections <= 0 || req->connect_time <= 0) {
+            return;
+        }
+        // warm connections are counted as connections of the transfers that reuse them
+        stats->prewarmed += connections;
     } else {
-        return true;
+        stats->transfers++;
+        if (req->connection_reused) {
+            stats->reused++;
+        }
+    }
+    stats->new_connections += connections;
+
+    // transfers by version are counted for caller's requests only
+    unsigned transfer = req->prewarm? 0 : 1;
+    switch (req->http_version) {
+        case CURL_HTTP_VERSION_1_0:
+        case CURL_HTTP_VERSION_1_1: stats->http1 += transfer; break;
+        case CURL_HTTP_VERSION_2_0:
+            stats->http2 += transfer;
+            stats->multiplexed_connections += connections;
+            break;
+#       if LIBCURL_VERSION_NUM >= 0x074200
+            case CURL_HTTP_VERSION_3:
+                stats->http3 += transfer;
+                stats->multiplexed_connections += connections;
+                break;
+#       endif
+        default: break;
     }
 }
 
-static void check_transfers(CURLM* multi_handle)
+static unsigned check_transfers(CurlSession* session)
+/*
+ * Complete finished transfers.
+ * Return the number of handles added back to run again.
+ */
 {
+    CURLM* multi_handle = session->multi_handle;
+    unsigned requeued = 0;
+
     for(;;) {
         // check transfers
         int msgs_left;
@@ -318,7 +685,44 @@ static void check_transfers(CURLM* multi_handle)
 
         CurlRequestData* req = pw_curl_request_data_ptr(request);
 
-        if(m->data.result == CURLE_OK) {
+        CURLcode result = m->data.result;
+        if (result == CURLE_WRITE_ERROR && req->scan_aborted) {
+            // scan mode does not need the body, headers are complete
+            result = CURLE_OK;
+        }
+        if(result == CURLE_OK) {
+            // get response status
+            curl_update_status(request);
+
+            if (req->scan_mode && curl_scan_fallback(req)) {
+                // HEAD was refused, run the same handle again with ranged GET
+                curl_multi_remove_handle(multi_handle, req->easy_handle);
+                curl_easy_setopt(req->easy_handle, CURLOPT_PRIVATE, request);
+                CURLMcode merr = curl_multi_add_handle(multi_handle, req->easy_handle);
+                if (merr == CURLM_OK) {
+                    requeued++;
+                    continue;
+                }
+                fprintf(stderr, "ERROR: %s\n", curl_multi_strerror(merr));
+                curl_easy_setopt(req->easy_handle, CURLOPT_PRIVATE, nullptr);
+                result = CURLE_SEND_ERROR;
+            }
+        }
+
+        // the transfer is final, account for it once
+        if (req->prewarm) {
+            session->num_prewarming--;
+        }
+        update_connection_metrics(session, req);
+
+        if (session->redirects && !req->prewarm) {
+            curl_redirects_record(session->redirects, req);
+        }
+        if (session->altsvc) {
+            curl_altsvc_record(session->altsvc, req);
+        }
+
+        if(result == CURLE_OK) {
             // get real URL
             char* url = nullptr;
             curl_easy_getinfo(req->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
@@ -329,9 +733,6 @@ static void check_transfers(CURLM* multi_handle)
                     pw_panic("OOM\n");
                 }
             }
-            // get response status
-            curl_update_status(request);
-
             // complete request
             pw_interface(request->type_id, Curl)->complete(request);
         }
@@ -339,13 +740,18 @@ static void check_transfers(CURLM* multi_handle)
         pw_destroy(request);
         default_allocator.release((void**) &request, sizeof(_PwValue));
     }
+    return requeued;
 }
 
 bool curl_perform(void* session, int* running_transfers)
 {
-    CURLM* multi_handle = (CURLM*) session;
+    CurlSession* s = (CurlSession*) session;
+    CURLM* multi_handle = s->multi_handle;
     CURLMcode err;
 
+    curl_dns_poll(s->dns);
+    curl_altsvc_flush(s->altsvc);
+
     err = curl_multi_perform(multi_handle, running_transfers);
     if (err) {
         fprintf(stderr, "FATAL %s:%s:%d: %s\n", __FILE__, __func__, __LINE__, curl_multi_strerror(err));
@@ -353,8 +759,8 @@ bool curl_perform(void* session, int* running_transfers)
     }
     if (!*running_transfers) {
         // handles for completed requests do not appear here,
-        // check them before exiting:
-        check_transfers(multi_handle);
+        // check them before exiting; re-queued handles keep the loop going:
+        *running_transfers = check_transfers(s);
         return true;
     }
 
@@ -365,6 +771,11 @@ bool curl_perform(void* session, int* running_transfers)
         return false;
     }
 
-    check_transfers(multi_handle);
+    check_transfers(s);
+
+    // pre-warm requests do not take caller's transfer slots;
+    // the ones completed above are already excluded from the count
+    int prewarming = (int) s->num_prewarming;
+    *running_transfers = (*running_transfers > prewarming)? *running_transfers - prewarming : 0;
     return true;
 }
@@ -22,6 +22,170 @@ typedef struct {
 } PwInterface_Curl;
 
 
+typedef enum {
+    CURL_TRANSPORT_DEFAULT = 0,  // for requests: use session preference; for sessions: libcurl default
+    CURL_TRANSPORT_HTTP3,        // try HTTP/3 first, fall back to HTTP/2 or HTTP/1.1
+    CURL_TRANSPORT_ALTSVC,       // start with HTTP/2, switch to HTTP/3 when advertised by Alt-Svc
+    CURL_TRANSPORT_HTTP1_1       // force HTTP/1.1
+} CurlTransport;
+
+// interned header tokens, see pw_curl_atom.c
+
+#define CURL_MAX_ATOM_LENGTH  64
+
+typedef struct {
+    char* name;       // lowercased, nul-terminated, never freed
+    unsigned length;
+    uint64_t hash;
+} CurlAtom;
+
+CurlAtom* curl_atom(char* name, unsigned length);
+/*
+ * Return atom for case-insensitive name, adding it to the table if necessary.
+ * Return nullptr if name is too long or the table is full.
+ * Same names always give same pointers.
+ */
+
+CurlAtom* curl_atom_find(char* name, unsigned length);
+/*
+ * Return existing atom for exactly matching name, or nullptr.
+ * Does not add new atoms.
+ */
+
+extern CurlAtom curl_atom_text;
+extern CurlAtom curl_atom_html;
+extern CurlAtom curl_atom_application;
+extern CurlAtom curl_atom_octet_stream;
+extern CurlAtom curl_atom_charset;
+extern CurlAtom curl_atom_utf_8;
+extern CurlAtom curl_atom_attachment;
+extern CurlAtom curl_atom_inline;
+extern CurlAtom curl_atom_filename;
+
+// typed results of extended header parsers
+
+typedef struct {
+    /*
+     * Cache-Control directives, RFC 9111, 5.2
+     * Unknown directives are ignored.
+     */
+    bool present;
+    bool no_cache;
+    bool no_store;
+    bool no_transform;
+    bool must_revalidate;
+    bool proxy_revalidate;
+    bool is_public;
+    bool is_private;
+    bool immutable;
+    long max_age;                 // seconds, -1 if absent
+    long s_maxage;                // seconds, -1 if absent
+    long stale_while_revalidate;  // seconds, -1 if absent
+    long stale_if_error;          // seconds, -1 if absent
+} CurlCacheControl;
+
+typedef struct {
+    /*
+     * Content-Range of 206 and 416 responses, RFC 9110, 14.4
+     * Only byte ranges are recognized.
+     */
+    bool present;
+    bool unsatisfied;             // bytes */complete-length, first and last are -1
+    curl_off_t first;
+    curl_off_t last;              // inclusive
+    curl_off_t complete_length;   // -1 if unknown
+} CurlContentRange;
+
+typedef struct {
+    /*
+     * Validators for conditional requests
+     */
+    _PwValue etag;                // entity-tag as received, with quotes and W/ prefix, null if absent
+    bool etag_weak;
+    time_t last_modified;         // -1 if absent or malformed
+} CurlValidators;
+
+enum {
+    // bits of CurlRequestData.parsed_headers
+    CURL_PARSED_CONTENT_TYPE        = 1 << 0,
+    CURL_PARSED_CONTENT_DISPOSITION = 1 << 1,
+    CURL_PARSED_CACHE_CONTROL       = 1 << 2,
+    CURL_PARSED_LINK                = 1 << 3,
+    CURL_PARSED_CONTENT_RANGE       = 1 << 4,
+    CURL_PARSED_RETRY_AFTER         = 1 << 5,
+    CURL_PARSED_VALIDATORS          = 1 << 6,
+    CURL_PARSED_AGE                 = 1 << 7
+};
+
+// text mode, see pw_curl_text.c
+
+typedef enum {
+    CURL_CHARSET_UTF8 = 0,
+    CURL_CHARSET_WINDOWS_1252,   // also us-ascii and iso-8859-1, as browsers do
+    CURL_CHARSET_UTF16LE,
+    CURL_CHARSET_UTF16BE,
+    CURL_CHARSET_ICONV           // any other charset known to iconv
+} CurlCharset;
+
+#define CURL_TEXT_MAX_PENDING  8
+
+typedef struct {
+    CurlCharset charset;         // detected when the first chunk arrives
+    void* iconv;                 // iconv_t for CURL_CHARSET_ICONV
+    unsigned num_pending;        // incomplete sequence at the end of previous chunk
+    unsigned char pending[CURL_TEXT_MAX_PENDING];
+} CurlTextDecoder;
+
+#define CURL_MAX_HOPS  16  // max number of responses with status recorded in header index
+
+// response filters, see curl_request_set_filter
+
+typedef struct {
+    char** media_types;              // nullptr-terminated list of "type/subtype" or "type/*", nullptr allows any
+    curl_off_t max_content_length;   // bytes, 0 means no limit
+    unsigned min_status;             // 0 means no limit
+    unsigned max_status;             // 0 means no limit
+} CurlResponseFilter;
+
+typedef enum {
+    CURL_FILTER_PASSED = 0,
+    CURL_FILTERED_STATUS,
+    CURL_FILTERED_MEDIA_TYPE,
+    CURL_FILTERED_CONTENT_LENGTH
+} CurlFilterResult;
+
+typedef struct {
+    unsigned hop;           // response number, redirects increment it
+    unsigned name;          // offset of nul-terminated name in the buffer
+    unsigned value;         // offset of nul-terminated value in the buffer
+    unsigned name_length;
+    unsigned value_length;
+    unsigned prev;          // index + 1 of previous header with the same name, 0 if none
+    uint32_t hash;          // case-insensitive hash of name
+} CurlHeader;
+
+typedef struct {
+    /*
+     * Response headers of all hops, filled by header callback as they arrive.
+     * Informational (1xx) responses are skipped.
+     */
+    char* buffer;           // copies of names and values
+    unsigned buffer_size;
+    unsigned buffer_capacity;
+
+    CurlHeader* headers;
+    unsigned num_headers;
+    unsigned headers_capacity;
+
+    unsigned* slots;        // hash table: index + 1 of the last header with some name, 0 for empty slot
+    unsigned num_slots;     // power of two
+    unsigned num_names;
+
+    unsigned num_hops;
+    unsigned status[CURL_MAX_HOPS];  // status code of each hop
+    bool skip;              // skipping informational response
+} CurlHeaderIndex;
+
 typedef struct {
     /*
      * This structure extends _PwStructData.
@@ -34,30 +198,171 @@ typedef struct {
     _PwValue proxy;
     _PwValue real_url;
 
-    // Parsed headers, call curl_request_parse_headers for that.
-    // Can be nullptr!
+    // Parsed headers, filled on first access by curl_request_media_type
+    // and friends. Do not read them directly, they are null until parsed.
     _PwValue media_type;
     _PwValue media_subtype;
     _PwValue media_type_params;  // map
     _PwValue disposition_type;
     _PwValue disposition_params; // values can be strings of maps containing charset, language, and value
 
+    // Atoms of parsed types, for comparison by pointer.
+    // Nullptr if the header is missing or the token was not interned.
+    CurlAtom* media_type_atom;
+    CurlAtom* media_subtype_atom;
+    CurlAtom* disposition_type_atom;
+
+    // Extended headers of the final response, see accessors below.
+    CurlCacheControl cache_control;
+    CurlContentRange content_range;
+    CurlValidators validators;
+    _PwValue links;               // array of maps, see curl_request_links
+    long retry_after;             // seconds, -1 if absent
+    long age;                     // seconds, -1 if absent
+
+    unsigned parsed_headers;      // CURL_PARSED_* bits, reset when next response starts
+
     // The content received by default handlers.
-    // Always binary, regardless of content-type charset
+    // Binary, regardless of content-type charset, unless text mode is set.
     _PwValue content;
 
+    bool text_mode;               // see curl_request_set_text_mode
+    CurlTextDecoder text_decoder;
+
     struct curl_slist* headers;
+    struct curl_slist* resolve;   // DNS cache entries injected by the session
+
+    CurlHeaderIndex header_index;
+    bool headers_complete;        // end of non-1xx response headers seen, following lines are trailers
+
+    _PwValue cached_url;          // URL from redirect cache the request was sent to, null if none
+
+    CurlResponseFilter* filter;   // see curl_request_set_filter
+    CurlFilterResult filtered;    // why the transfer was aborted by the filter
+
+    // see curl_request_set_scan_mode
+    bool scan_mode;
+    bool scan_ranged;             // HEAD was refused, ranged GET was made
+    bool scan_aborted;            // body was longer than expected
+    size_t scan_discarded;        // body bytes received and thrown away
 
     unsigned int status;
 
+    // connection metrics, updated when transfer is done
+    long num_connects;            // new connections made for the transfer, 0 means reused
+    curl_off_t connect_time;      // usec, see CURLINFO_CONNECT_TIME_T
+    curl_off_t appconnect_time;   // usec, TLS handshake completion, see CURLINFO_APPCONNECT_TIME_T
+    curl_off_t total_time;        // usec
+    bool connection_reused;
+    bool prewarm;                 // request was made by curl_session_prewarm
+
+    CurlTransport transport;      // see curl_request_set_transport
+    long http_version;            // CURL_HTTP_VERSION_* used by the transfer, see CURLINFO_HTTP_VERSION
+
 } CurlRequestData;
 
 #define pw_curl_request_data_ptr(value)  ((CurlRequestData*) ((value)->struct_data))
 
 // sessions
-void* create_curl_session();
+
+typedef struct {
+    unsigned dns_cache_ttl;  // seconds, 0 disables DNS pre-resolution
+    long max_cached_connections;  // CURLMOPT_MAXCONNECTS, 0 leaves libcurl default
+    char* state_file;        // prefix for TLS session, HSTS, and Alt-Svc cache files, nullptr disables
+    char* ca_file;           // CA bundle, nullptr means CURL_DEFAULT_CA_FILE
+    long ca_cache_timeout;   // seconds to keep parsed CA store, 0 disables CA cache
+    CurlTransport transport; // default transport for requests
+    bool pipewait;           // wait for a connection to multiplex on rather than open a new one,
+                             // see CURLOPT_PIPEWAIT
+    unsigned redirect_cache_size;    // max cached redirects, 0 disables redirect cache
+    bool cache_temporary_redirects;  // also cache 302 and 307 responses that have max-age
+    CurlResponseFilter* filter;      // for requests without their own filter, nullptr disables
+
+} CurlSessionOptions;
+
+#define CURL_DEFAULT_CA_FILE  "/etc/ssl/certs/ca-certificates.crt"
+
+#define CURL_SESSION_DEFAULT_OPTIONS  { \
+        .dns_cache_ttl = 60, \
+        .ca_cache_timeout = 86400 \
+    }
+
+void* create_curl_session(CurlSessionOptions* options);
+/*
+ * Create session with given options, nullptr means CURL_SESSION_DEFAULT_OPTIONS.
+ *
+ * If state_file is set, the state saved by delete_curl_session is loaded.
+ *
+ * Redirect cache remembers 301 and 308 responses and sends further requests
+ * for the same URLs straight to the final target. Requests keep their url,
+ * real_url is the final one as usual.
+ */
+
 bool add_curl_request(void* session, PwValuePtr request);
 void delete_curl_session(void* session);
+/*
+ * Requests still in progress are destroyed along with the session
+ * if libcurl is 8.4 or newer, otherwise they are leaked.
+ */
+
+typedef struct {
+    uint64_t lookups;               // completed lookups
+    uint64_t failures;
+    uint64_t lookup_time_usec;      // total time of completed lookups
+    uint64_t max_lookup_time_usec;
+    uint64_t hits;                  // requests served from DNS cache
+    uint64_t misses;
+} CurlDnsStats;
+
+void curl_session_prefetch_dns(void* session, PwValuePtr url);
+/*
+ * Start resolving URL's host in background so that a request
+ * added later gets addresses without waiting for DNS.
+ */
+
+void curl_session_dns_stats(void* session, CurlDnsStats* stats);
+
+bool curl_session_prewarm(void* session, PwValuePtr urls, unsigned num_connections);
+/*
+ * Open num_connections connections to the origin of each URL in the `urls` array
+ * and leave them in the connection pool of the session.
+ * Connections are established with HEAD requests that negotiate ALPN,
+ * so the following requests to the same origins reuse them.
+ *
+ * Prewarm transfers run in curl_perform like any other requests
+ * but they are not counted in running_transfers, so they do not
+ * take slots of the caller's parallel requests.
+ * Make sure max_cached_connections session option is large enough
+ * to keep all warm connections.
+ */
+
+typedef struct {
+    uint64_t transfers;        // completed transfers, prewarm ones are not counted
+    uint64_t new_connections;  // connections opened by these transfers and by prewarm
+    uint64_t reused;           // transfers that reused existing connection
+    uint64_t prewarmed;        // connections opened by curl_session_prewarm
+    uint64_t http1;            // transfers by HTTP version
+    uint64_t http2;
+    uint64_t http3;
+    uint64_t multiplexed_connections;  // new HTTP/2 and HTTP/3 connections, including pre-warmed ones
+} CurlConnectionStats;
+
+void curl_session_connection_stats(void* session, CurlConnectionStats* stats);
+/*
+ * Reuse ratio is reused / transfers, and streams per multiplexed
+ * connection is (http2 + http3) / multiplexed_connections.
+ */
+
+typedef struct {
+    uint64_t entries;          // cached redirects
+    uint64_t hits;             // requests sent straight to cached target
+    uint64_t misses;
+    uint64_t hops_saved;       // redirects skipped by hits
+    uint64_t recorded;         // redirects added or updated
+    uint64_t expired;          // temporary redirects dropped after max-age
+} CurlRedirectStats;
+
+void curl_session_redirect_stats(void* session, CurlRedirectStats* stats);
 
 // request
 void curl_request_set_url(PwValuePtr request, PwValuePtr url);
@@ -66,6 +371,57 @@ void curl_request_set_cookie(PwValuePtr request, PwValuePtr cookie);
 void curl_request_set_resume(PwValuePtr request, size_t pos);
 bool curl_request_set_headers(PwValuePtr request, char* http_headers[], unsigned num_headers);
 void curl_request_verbose(PwValuePtr request, bool verbose);
+void curl_request_set_transport(PwValuePtr request, CurlTransport transport);
+/*
+ * Override session transport preference for the request.
+ *
+ * Alt-Svc upgrades use the session Alt-Svc cache, persisted in state_file
+ * if it is set. Without state_file the session has the cache only if
+ * its own transport is CURL_TRANSPORT_ALTSVC, otherwise the request
+ * sees only advertisements it receives itself.
+ */
+
+void curl_request_set_filter(PwValuePtr request, CurlResponseFilter* filter);
+/*
+ * Abort the transfer as soon as headers of the final response arrive,
+ * if they do not pass the filter, so the body is not downloaded.
+ * Followed redirects are not checked. Responses without Content-Type
+ * or Content-Length pass the corresponding checks.
+ *
+ * Aborted transfer fails with CURLE_WRITE_ERROR, complete method
+ * is not called, and the filtered field tells why.
+ *
+ * The filter is not copied and must outlive the request.
+ */
+
+void curl_request_set_scan_mode(PwValuePtr request, bool scan_mode);
+/*
+ * In scan mode the request receives headers only, see pw_curl_scan.c.
+ * Content is never allocated and write_data method is not called.
+ * Get the result with curl_request_scan_result in complete method.
+ */
+
+typedef struct {
+    unsigned status;
+    char* real_url;               // owned by the request
+    curl_off_t content_length;    // -1 if unknown, complete length for ranged GET
+    char* media_type;             // type/subtype from Content-Type as is, not nul-terminated, nullptr if missing
+    unsigned media_type_length;
+    curl_off_t connect_time;      // usec
+    curl_off_t appconnect_time;
+    curl_off_t starttransfer_time;
+    curl_off_t total_time;
+    bool ranged;                  // status is of ranged GET, 206 means the resource is there
+} CurlScanResult;
+
+void curl_request_scan_result(CurlRequestData* req, CurlScanResult* result);
+
+void curl_request_set_text_mode(PwValuePtr request, bool text_mode);
+/*
+ * In text mode default handlers decode the content to Unicode string
+ * as it arrives, instead of keeping raw bytes.
+ * See pw_curl_text.c for how the charset is chosen.
+ */
 
 void curl_update_status(PwValuePtr request);
 
@@ -76,8 +432,442 @@ bool curl_perform(void* session, int* running_transfers);
 [[nodiscard]] bool urljoin_cstr(char* base_url, char* other_url, PwValuePtr result);
 [[nodiscard]] bool urljoin(PwValuePtr base_url, PwValuePtr other_url, PwValuePtr result);
 
+// URL resolver, see pw_url.c
+
+typedef struct {
+    CURLU* base_handle;
+    char* base;              // normalized base URL
+    unsigned base_length;
+    // offsets in normalized base, valid if hierarchical is set
+    unsigned path_start;
+    unsigned dir_end;        // after the last slash of path
+    unsigned path_end;       // start of query or fragment
+    unsigned query_end;      // start of fragment
+    bool hierarchical;
+    // stats
+    uint64_t num_fast;
+    uint64_t num_fallback;
+} CurlUrlResolver;
+
+[[nodiscard]] bool curl_url_resolver_init(CurlUrlResolver* resolver, char* base_url);
+void curl_url_resolver_fini(CurlUrlResolver* resolver);
+
+[[nodiscard]] bool curl_url_resolve(CurlUrlResolver* resolver, char* ref, unsigned length, PwValuePtr result);
+/*
+ * Resolve reference against the base. The reference need not be nul-terminated.
+ */
+
+[[nodiscard]] bool curl_url_resolve_batch(CurlUrlResolver* resolver, PwValuePtr refs, PwValuePtr results);
+/*
+ * Resolve array of references and append them to results array,
+ * which is created if null. Malformed references give nulls, so
+ * indices of results match indices of references.
+ */
+
+// URL canonicalization, see pw_url.c
+
+enum {
+    // flags for canonicalization, default is full normalization
+    CURL_CANON_KEEP_FRAGMENT    = 1 << 0,
+    CURL_CANON_KEEP_QUERY_ORDER = 1 << 1
+};
+
+unsigned curl_url_canonicalize_cstr(char* url, unsigned length, unsigned flags, char* buffer, unsigned size);
+/*
+ * Write canonical form of absolute URL to the buffer, not nul-terminated.
+ * Return its length, or 0 if URL is relative, malformed, or does not fit.
+ * The result may be up to three times longer than URL.
+ *
+ * Canonical form has:
+ *   - lowercased scheme and host
+ *   - no default port
+ *   - no dot segments, and slash for empty path
+ *   - unreserved chars unescaped, uppercase hex digits in other escapes,
+ *     non-ASCII and unsafe chars escaped
+ *   - query parameters sorted, empty ones and empty query dropped
+ *   - no fragment
+ */
+
+[[nodiscard]] bool curl_url_canonicalize(PwValuePtr url, unsigned flags, PwValuePtr result);
+
+typedef struct {
+    uint64_t lo;  // can be used alone as 64-bit fingerprint
+    uint64_t hi;
+} CurlFingerprint;
+
+CurlFingerprint curl_hash128(void* data, size_t length, uint64_t seed);
+
+bool curl_url_fingerprint(char* url, unsigned length, unsigned flags, CurlFingerprint* result);
+/*
+ * Hash canonical form of URL. Return false if it cannot be canonicalized.
+ */
+
+static inline bool curl_fingerprint_equal(CurlFingerprint* a, CurlFingerprint* b)
+{
+    return a->lo == b->lo && a->hi == b->hi;
+}
+
+// seen-URL filter, see pw_bloom.c
+
+typedef struct {
+    void* map;              // header followed by blocks
+    size_t map_size;
+    uint64_t num_blocks;    // 256-bit blocks
+    uint32_t* blocks;
+    bool file_backed;
+} CurlBloom;
+
+[[nodiscard]] bool curl_bloom_create(CurlBloom* bloom, uint64_t capacity, double fp_rate);
+/*
+ * Create in-memory filter sized for capacity keys at given false positive rate.
+ */
+
+[[nodiscard]] bool curl_bloom_open(CurlBloom* bloom, char* path, uint64_t capacity, double fp_rate);
+/*
+ * Map filter file, creating it if it does not exist or is not valid.
+ * Existing file keeps its size, capacity and fp_rate are used for new files only.
+ * Changes are written back to the file by the kernel.
+ */
+
+void curl_bloom_sync(CurlBloom* bloom);
+void curl_bloom_close(CurlBloom* bloom);
+
+bool curl_bloom_add(CurlBloom* bloom, CurlFingerprint* fp);
+/*
+ * Add fingerprint, return false if it was (probably) added before.
+ */
+
+bool curl_bloom_contains(CurlBloom* bloom, CurlFingerprint* fp);
+
+uint64_t curl_bloom_count(CurlBloom* bloom);
+/*
+ * Number of keys added, including those added before the file was reopened.
+ */
+
+double curl_bloom_measure_fp_rate(CurlBloom* bloom, unsigned num_probes);
+/*
+ * Look up random keys that were never added and return the fraction found.
+ */
+
+// HTML link extractor, see pw_html_links.c
+
+#define CURL_LINK_MAX_LENGTH  4096
+
+typedef struct {
+    CurlUrlResolver resolver;  // bound to document URL or <base href>
+    bool base_seen;
+
+    // tokenizer state
+    unsigned state;
+    unsigned tag;              // current tag
+    unsigned raw_tag;          // element with raw text content, such as script
+    unsigned attr;             // current attribute if it contains links
+    bool is_end_tag;
+    char quote;
+    unsigned match;            // progress of matching comment or raw text end
+    char name[16];             // lowercased tag or attribute name
+    unsigned name_length;
+    char value[CURL_LINK_MAX_LENGTH];
+    unsigned value_length;
+    bool value_overflow;
+
+    _PwValue refs;             // references of current chunk waiting for resolution
+
+    // stats
+    uint64_t num_links;
+    uint64_t num_skipped;      // empty, malformed, too long, and non-HTTP references
+
+} CurlLinkExtractor;
+
+[[nodiscard]] bool curl_links_init(CurlLinkExtractor* ext, char* base_url);
+void curl_links_fini(CurlLinkExtractor* ext);
+
+[[nodiscard]] bool curl_links_feed(CurlLinkExtractor* ext, char* data, size_t size, PwValuePtr links);
+/*
+ * Scan chunk of HTML and append absolute URLs from href, src, and srcset attributes
+ * to links array. Links split between chunks are appended with the chunk where they end.
+ */
+
+// URL queue, see pw_url_queue.c
+
+typedef struct CurlUrlQueueChunk CurlUrlQueueChunk;
+
+typedef struct {
+    CurlUrlQueueChunk* head;  // chunk being read
+    CurlUrlQueueChunk* tail;  // chunk being written
+    unsigned read_pos;        // offset of the first record in head chunk
+
+    char* last_pushed;        // URL the next record is coded against
+    unsigned last_pushed_length;
+    unsigned last_pushed_capacity;
+
+    char* decoded;            // URL returned by peek and pop
+    unsigned decoded_capacity;
+
+    uint64_t length;          // number of URLs
+    uint64_t memory;          // bytes allocated
+} CurlUrlQueue;
+
+void curl_url_queue_init(CurlUrlQueue* queue);
+void curl_url_queue_fini(CurlUrlQueue* queue);
+
+[[nodiscard]] bool curl_url_queue_push(CurlUrlQueue* queue, char* url, unsigned length, unsigned tag);
+/*
+ * Append URL with a tag, such as crawl depth.
+ */
+
+char* curl_url_queue_peek(CurlUrlQueue* queue, unsigned* length, unsigned* tag);
+char* curl_url_queue_pop(CurlUrlQueue* queue, unsigned* length, unsigned* tag);
+/*
+ * Return the first URL, nul-terminated, or nullptr if the queue is empty
+ * or on error, with status set. Pop also removes it from the queue.
+ * Returned URL is owned by the queue and is valid until the next call.
+ */
+
+// robots.txt, see pw_robots.c
+
+#define CURL_ROBOTS_DEFAULT_TTL  86400  // seconds
+
+typedef struct CurlRobotsRules CurlRobotsRules;
+
+CurlRobotsRules* curl_robots_parse(char* text, unsigned length, char* agent);
+/*
+ * Compile rules of the group that matches agent product token, such as "pw-curl",
+ * or of the * group if none matches.
+ * Return nullptr on error, with status set.
+ */
+
+void curl_robots_rules_delete(CurlRobotsRules* rules);
+
+bool curl_robots_rules_allowed(CurlRobotsRules* rules, char* path, unsigned length);
+/*
+ * Check path, including query, of canonical URL.
+ */
+
+unsigned curl_robots_rules_crawl_delay(CurlRobotsRules* rules);
+/*
+ * Return Crawl-delay in milliseconds, 0 if not specified.
+ */
+
+typedef enum {
+    CURL_ROBOTS_ALLOWED = 0,
+    CURL_ROBOTS_DISALLOWED,
+    CURL_ROBOTS_PENDING,     // robots.txt is being fetched
+    CURL_ROBOTS_UNREACHABLE  // robots.txt failed, retry the host later
+} CurlRobotsVerdict;
+
+typedef struct {
+    uint64_t hosts;
+    uint64_t requests;       // robots.txt fetches started
+    uint64_t fetched;        // 2xx responses
+    uint64_t unavailable;    // 4xx responses, everything allowed
+    uint64_t unreachable;    // 5xx, 429, and network errors, the host is retried later
+    uint64_t allowed;        // checked paths
+    uint64_t disallowed;
+} CurlRobotsStats;
+
+void* create_curl_robots(void* session, char* agent, unsigned ttl);
+/*
+ * Create robots.txt cache which fetches files via session.
+ * Rules are kept for ttl seconds, 0 means CURL_ROBOTS_DEFAULT_TTL.
+ * Return nullptr on error, with status set.
+ */
+
+void delete_curl_robots(void* robots);
+/*
+ * Must be called after deleting the session, requests in flight refer to the cache.
+ */
+
+void curl_robots_set_callback(void* robots, void (*ready)(void* arg, char* origin, unsigned origin_length), void* arg);
+/*
+ * Set function to call when robots.txt of origin is fetched or failed.
+ */
+
+CurlRobotsVerdict curl_robots_check(void* robots, char* origin, unsigned origin_length,
+                                    char* path, unsigned path_length);
+/*
+ * Check path for origin, such as "https://example.com".
+ * Start fetching robots.txt if it's not cached or expired.
+ * Expired rules are used until the new ones arrive.
+ */
+
+unsigned curl_robots_crawl_delay(void* robots, char* origin, unsigned origin_length);
+/*
+ * Return Crawl-delay of origin in milliseconds, 0 if not specified or unknown yet.
+ */
+
+uint64_t curl_robots_retry_time(void* robots, char* origin, unsigned origin_length);
+/*
+ * Return time, see curl_now_usec, when robots.txt of unreachable origin
+ * will be fetched again, 0 if unknown.
+ */
+
+void curl_robots_stats(void* robots, CurlRobotsStats* stats);
+
+// crawl frontier, see pw_frontier.c
+
+typedef enum {
+    CURL_SCOPE_ANY = 0,  // follow links to any host
+    CURL_SCOPE_HOST,     // stay on hosts of seed URLs
+    CURL_SCOPE_DOMAIN    // stay on domains of seed URLs, including subdomains
+} CurlScope;
+
+typedef struct {
+    unsigned politeness_delay;     // milliseconds between requests to the same host
+    unsigned max_per_host;         // requests in flight per host, 0 means 1
+    unsigned max_depth;            // seed URLs have depth 0
+    CurlScope scope;
+    unsigned canon_flags;          // CURL_CANON_* flags for deduplication
+    unsigned dns_prefetch_window;  // new hosts to resolve ahead of requests, 0 disables
+    unsigned burst;                // URLs taken from a host in a row, up to HTTP/2 stream limit;
+                                   // max_per_host must allow them, 0 or 1 disables bursts
+
+    // Seen URLs are kept in exact set unless seen_capacity is set.
+    // Otherwise they are kept in Bloom filter which needs about 2 bytes per URL
+    // at 0.1% false positive rate, and false positives are dropped as duplicates.
+    uint64_t seen_capacity;        // expected number of URLs
+    double seen_fp_rate;           // 0 means 0.001
+    char* seen_file;               // file-backed filter of fetched URLs which further runs skip,
+                                   // requires seen_capacity, nullptr disables
+
+    // robots.txt is fetched via session and obeyed if agent is set;
+    // its Crawl-delay raises politeness_delay for the host
+    char* robots_agent;            // product token, such as "pw-curl"
+    unsigned robots_ttl;           // seconds, 0 means CURL_ROBOTS_DEFAULT_TTL
+
+} CurlFrontierOptions;
+
+#define CURL_FRONTIER_DEFAULT_OPTIONS  { \
+        .politeness_delay = 1000, \
+        .max_per_host = 1, \
+        .max_depth = (unsigned) -1, \
+        .dns_prefetch_window = 64 \
+    }
+
+typedef struct {
+    uint64_t queued;        // URLs waiting in host queues
+    uint64_t dispatched;    // URLs taken by curl_frontier_next
+    uint64_t completed;     // URLs reported by curl_frontier_done
+    uint64_t duplicates;    // rejected URLs
+    uint64_t out_of_scope;
+    uint64_t too_deep;
+    uint64_t malformed;
+    uint64_t disallowed;    // dropped by robots.txt
+    uint64_t bursts;        // started in burst mode
+    uint64_t hosts;
+    uint64_t seen;          // distinct URLs queued by this run
+    uint64_t done_before;   // rejected URLs fetched by this or previous runs, see seen_file
+    double seen_fp_rate;    // measured false positive rate of seen filter, 0 for exact set
+} CurlFrontierStats;
+
+void* create_curl_frontier(void* session, CurlFrontierOptions* options);
+/*
+ * Create frontier with given options, nullptr means CURL_FRONTIER_DEFAULT_OPTIONS.
+ * Session is used for DNS prefetch and robots.txt, it can be nullptr
+ * if robots_agent is not set.
+ * Return nullptr on error, with status set.
+ */
+
+void delete_curl_frontier(void* frontier);
+
+[[nodiscard]] bool curl_frontier_add_seed(void* frontier, PwValuePtr url);
+/*
+ * Add URL with depth 0. Its host defines the scope.
+ */
+
+[[nodiscard]] bool curl_frontier_add(void* frontier, PwValuePtr url, unsigned depth);
+[[nodiscard]] bool curl_frontier_add_cstr(void* frontier, char* url, unsigned length, unsigned depth);
+/*
+ * Queue absolute URL unless it was seen before, is out of scope, or too deep.
+ * Rejected URLs are only counted in stats, false is returned on errors.
+ */
+
+[[nodiscard]] bool curl_frontier_next(void* frontier, PwValuePtr url, unsigned* depth);
+/*
+ * Take URL from the host which is ready for the next request.
+ * Set url to null if no host is ready now.
+ * Every URL taken must be reported by curl_frontier_done.
+ */
+
+void curl_frontier_done(void* frontier, PwValuePtr url, bool fetched);
+/*
+ * Report completion of request, successful or not.
+ * This releases the slot of the host and starts politeness delay.
+ * URLs reported as fetched are added to seen_file filter.
+ */
+
+uint64_t curl_frontier_wait_time(void* frontier);
+/*
+ * Return microseconds until some host is ready, 0 if it's ready now
+ * or waits for robots.txt, or UINT64_MAX if no URL can be taken
+ * until requests in flight complete.
+ */
+
+void curl_frontier_stats(void* frontier, CurlFrontierStats* stats);
+
+uint64_t curl_frontier_queued(void* frontier);
+/*
+ * Return number of URLs waiting in host queues.
+ * Unlike curl_frontier_stats this is cheap enough to call in the main loop.
+ */
+
 void curl_request_parse_content_type(CurlRequestData* req);
 void curl_request_parse_content_disposition(CurlRequestData* req);
 void curl_request_parse_headers(CurlRequestData* req);
+/*
+ * Parse headers unconditionally. Accessors below call these on demand,
+ * so there's no need to call them explicitly.
+ */
+
+PwValuePtr curl_request_media_type(CurlRequestData* req);
+PwValuePtr curl_request_media_subtype(CurlRequestData* req);
+PwValuePtr curl_request_media_type_params(CurlRequestData* req);
+PwValuePtr curl_request_disposition_type(CurlRequestData* req);
+PwValuePtr curl_request_disposition_params(CurlRequestData* req);
+CurlAtom* curl_request_media_type_atom(CurlRequestData* req);
+CurlAtom* curl_request_media_subtype_atom(CurlRequestData* req);
+CurlAtom* curl_request_disposition_type_atom(CurlRequestData* req);
+/*
+ * Lazy accessors for Content-Type and Content-Disposition.
+ * The header is parsed on first access and the result is kept until
+ * the next response of redirect chain arrives.
+ *
+ * Returned values are owned by the request. Media type and subtype are
+ * empty strings and params are null if the header is missing or malformed.
+ *
+ * Types and parameter names are lowercased. Interned tokens and well-known
+ * parameter values refer to atom names and are not allocated per request.
+ */
+
+char* curl_request_get_header(CurlRequestData* req, char* name, int hop);
+/*
+ * Return value of the last header with given name, case-insensitive.
+ * If hop is negative, the last header from any response is returned,
+ * otherwise the search is limited to the given response.
+ *
+ * Returned value is owned by the request and remains valid
+ * until the next header is received.
+ */
+
+CurlCacheControl* curl_request_cache_control(CurlRequestData* req);
+CurlContentRange* curl_request_content_range(CurlRequestData* req);
+CurlValidators* curl_request_validators(CurlRequestData* req);
+long curl_request_retry_after(CurlRequestData* req);
+long curl_request_age(CurlRequestData* req);
+/*
+ * Lazy accessors for extended headers of the final response.
+ * Multiple Cache-Control lines are combined.
+ *
+ * Retry-After is converted to seconds, HTTP-date is counted from
+ * the Date header of the response or from current time if Date is missing.
+ */
+
+PwValuePtr curl_request_links(CurlRequestData* req);
+/*
+ * Return array of maps parsed from Link headers, RFC 8288, or null if none.
+ * Each map contains "url" with the target as is (use urljoin with real_url
+ * to resolve it) and link parameters with lowercased names,
+ * such as "rel", "as", and "type".
+ */
 
 [[nodiscard]] bool curl_request_get_filename(CurlRequestData* req, PwValuePtr result);
@@ -0,0 +1,389 @@
+/*
+ * Session-level Alt-Svc cache, RFC 7838.
+ *
+ * libcurl keeps Alt-Svc cache per easy handle and cannot share it,
+ * and a handle that owns the cache file rewrites it on cleanup.
+ * So the session collects advertisements from completed responses
+ * and it is the only writer of the file. Requests load the file
+ * with CURLALTSVC_READONLYFILE and upgrade to advertised services.
+ *
+ * The file is in libcurl format, one alternative per line:
+ *
+ *   src-alpn src-host src-port dst-alpn dst-host dst-port "YYYYMMDD HH:MM:SS" persist priority
+ *
+ * It is loaded when the session is created and saved when it is deleted.
+ * New advertisements are also written out at most once per FLUSH_INTERVAL,
+ * so that requests started later in the same run can use them.
+ * Without state_file the cache lives in a temporary file removed on exit.
+ * Only h1, h2, and h3 alternatives from HTTPS origins are kept,
+ * the rest is ignored by libcurl anyway.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+#include <strings.h>
+#include <unistd.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+#define MAX_ALTERNATIVES  4       // per origin, extra ones are dropped
+#define MAX_ORIGINS       100000
+#define MAX_HOST_LENGTH   255
+#define FLUSH_INTERVAL    1000000  // usec
+
+typedef struct {
+    char alpn[3];                 // "h1", "h2", or "h3"
+    unsigned port;
+    int64_t expires;              // wall clock time
+    bool persist;
+    char host[MAX_HOST_LENGTH + 1];
+} AltSvcEntry;
+
+typedef struct {
+    unsigned count;
+    AltSvcEntry entries[MAX_ALTERNATIVES];
+} AltSvcOrigin;
+
+struct CurlAltSvcCache {
+    CurlHashTable origins;        // "alpn host port" -> AltSvcOrigin*
+    char* file;
+    bool temporary;               // file is removed when the cache is deleted
+    bool dirty;                   // file is behind the cache
+    uint64_t flush_time;          // usec, see curl_now_usec
+};
+
+static void release_origin(void* value)
+{
+    default_allocator.release(&value, sizeof(AltSvcOrigin));
+}
+
+static bool alpn_id(char* protocol, unsigned length, char alpn[3])
+{
+    if (length != 2 || protocol[0] != 'h' || !('1' <= protocol[1] && protocol[1] <= '3')) {
+        return false;
+    }
+    alpn[0] = 'h';
+    alpn[1] = protocol[1];
+    alpn[2] = 0;
+    return true;
+}
+
+static unsigned make_key(char* key, unsigned key_size, char* alpn, char* host, unsigned host_length, unsigned port)
+/*
+ * Return key length, 0 if it does not fit.
+ */
+{
+    int n = snprintf(key, key_size, "%s %.*s %u", alpn, (int) host_length, host, port);
+    if (n <= 0 || n >= (int) key_size) {
+        return 0;
+    }
+    // host names are case-insensitive
+    for (char* p = key + 3; p < key + 3 + host_length; p++) {
+        if ('A' <= *p && *p <= 'Z') {
+            *p += 'a' - 'A';
+        }
+    }
+    return n;
+}
+
+static AltSvcOrigin* get_origin(CurlAltSvcCache* cache, char* key, unsigned key_length)
+/*
+ * Return entries of the origin, create empty ones if necessary.
+ */
+{
+    AltSvcOrigin* origin = curl_hash_get(&cache->origins, key, key_length);
+    if (origin) {
+        return origin;
+    }
+    if (cache->origins.count >= MAX_ORIGINS) {
+        return nullptr;
+    }
+    origin = default_allocator.allocate(sizeof(AltSvcOrigin), true);
+    if (!origin) {
+        return nullptr;
+    }
+    if (!curl_hash_put(&cache->origins, key, key_length, origin)) {
+        release_origin(origin);
+        return nullptr;
+    }
+    return origin;
+}
+
+static void load_altsvc(CurlAltSvcCache* cache)
+{
+    FILE* f = fopen(cache->file, "r");
+    if (!f) {
+        return;
+    }
+    time_t now = time(nullptr);
+    char* line = nullptr;
+    size_t line_size = 0;
+    while (getline(&line, &line_size, f) > 0) {
+        char src_alpn[4], dst_alpn[4];
+        char src_host[MAX_HOST_LENGTH + 3], dst_host[MAX_HOST_LENGTH + 3];
+        unsigned src_port, dst_port, persist;
+        struct tm tm = {};
+        if (sscanf(line, "%3s %257s %u %3s %257s %u \"%4d%2d%2d %d:%d:%d\" %u",
+                   src_alpn, src_host, &src_port, dst_alpn, dst_host, &dst_port,
+                   &tm.tm_year, &tm.tm_mon, &tm.tm_mday, &tm.tm_hour, &tm.tm_min, &tm.tm_sec,
+                   &persist) != 13) {
+            continue;
+        }
+        tm.tm_year -= 1900;
+        tm.tm_mon -= 1;
+        int64_t expires = timegm(&tm);
+        if (expires <= now) {
+            continue;
+        }
+        char* src = src_host;
+        unsigned src_length = strlen(src);
+        char* dst = dst_host;
+        unsigned dst_length = strlen(dst);
+        if (*src == '[' && src[src_length - 1] == ']') {
+            src++;
+            src_length -= 2;
+        }
+        if (*dst == '[' && dst[dst_length - 1] == ']') {
+            dst++;
+            dst_length -= 2;
+        }
+        char key[MAX_HOST_LENGTH + 16];
+        char src_id[3], dst_id[3];
+        if (!alpn_id(src_alpn, strlen(src_alpn), src_id) || !alpn_id(dst_alpn, strlen(dst_alpn), dst_id)
+            || dst_length > MAX_HOST_LENGTH) {
+            continue;
+        }
+        unsigned key_length = make_key(key, sizeof(key), src_id, src, src_length, src_port);
+        if (!key_length) {
+            continue;
+        }
+        AltSvcOrigin* origin = get_origin(cache, key, key_length);
+        if (!origin) {
+            break;
+        }
+        if (origin->count == MAX_ALTERNATIVES) {
+            continue;
+        }
+        AltSvcEntry* entry = &origin->entries[origin->count++];
+        memcpy(entry->alpn, dst_id, 3);
+        memcpy(entry->host, dst, dst_length);
+        entry->host[dst_length] = 0;
+        entry->port = dst_port;
+        entry->expires = expires;
+        entry->persist = persist;
+    }
+    free(line);  // allocated by getline
+    fclose(f);
+}
+
+static void write_host(FILE* f, char* host)
+{
+    fprintf(f, strchr(host, ':')? "[%s]" : "%s", host);
+}
+
+static bool save_altsvc(CurlAltSvcCache* cache)
+/*
+ * Write the file next to the old one and replace it,
+ * so that requests never load a partially written file.
+ */
+{
+    unsigned length = strlen(cache->file);
+    char tmp_file[length + sizeof(".tmp")];
+    strcpy(tmp_file, cache->file);
+    strcat(tmp_file, ".tmp");
+
+    FILE* f = fopen(tmp_file, "w");
+    if (!f) {
+        fprintf(stderr, "WARNING: cannot save Alt-Svc cache to %s\n", cache->file);
+        return false;
+    }
+    fprintf(f, "# Alt-Svc cache, written by pw-curl in libcurl format\n");
+    time_t now = time(nullptr);
+    for (unsigned i = 0; i < cache->origins.capacity; i++) {
+        CurlHashEntry* slot = &cache->origins.entries[i];
+        if (slot->hash == 0) {
+            continue;
+        }
+        AltSvcOrigin* origin = slot->value;
+
+        char src_alpn[3];
+        char src_host[MAX_HOST_LENGTH + 1];
+        unsigned src_port;
+        if (sscanf(slot->key, "%2s %255s %u", src_alpn, src_host, &src_port) != 3) {
+            continue;
+        }
+
+        for (unsigned j = 0; j < origin->count; j++) {
+            AltSvcEntry* entry = &origin->entries[j];
+            if (entry->expires <= now) {
+                continue;
+            }
+            time_t expires = entry->expires;
+            struct tm tm;
+            gmtime_r(&expires, &tm);
+
+            fprintf(f, "%s ", src_alpn);
+            write_host(f, src_host);
+            fprintf(f, " %u %s ", src_port, entry->alpn);
+            write_host(f, entry->host);
+            fprintf(f, " %u \"%d%02d%02d %02d:%02d:%02d\" %u 0\n", entry->port,
+                    tm.tm_year + 1900, tm.tm_mon + 1, tm.tm_mday, tm.tm_hour, tm.tm_min, tm.tm_sec,
+                    entry->persist? 1 : 0);
+        }
+    }
+    if (fclose(f) != 0 || rename(tmp_file, cache->file) != 0) {
+        fprintf(stderr, "WARNING: cannot save Alt-Svc cache to %s\n", cache->file);
+        remove(tmp_file);
+        return false;
+    }
+    return true;
+}
+
+CurlAltSvcCache* curl_altsvc_create(char* file)
+{
+    char tmp_file[] = "/tmp/pw-curl-altsvc-XXXXXX";
+    if (!file) {
+        int fd = mkstemp(tmp_file);
+        if (fd < 0) {
+            fprintf(stderr, "WARNING: cannot create temporary Alt-Svc cache file\n");
+            return nullptr;
+        }
+        close(fd);
+        file = tmp_file;
+    }
+    CurlAltSvcCache* cache = default_allocator.allocate(sizeof(CurlAltSvcCache), true);
+    if (!cache) {
+        return nullptr;
+    }
+    cache->temporary = (file == tmp_file);
+    cache->file = default_allocator.allocate(strlen(file) + 1, false);
+    if (!cache->file) {
+        default_allocator.release((void**) &cache, sizeof(CurlAltSvcCache));
+        return nullptr;
+    }
+    strcpy(cache->file, file);
+    if (!curl_hash_init(&cache->origins, 256)) {
+        default_allocator.release((void**) &cache->file, strlen(file) + 1);
+        default_allocator.release((void**) &cache, sizeof(CurlAltSvcCache));
+        return nullptr;
+    }
+    load_altsvc(cache);
+    return cache;
+}
+
+void curl_altsvc_delete(CurlAltSvcCache* cache)
+{
+    if (cache->temporary) {
+        remove(cache->file);
+    } else {
+        save_altsvc(cache);
+    }
+    curl_hash_fini(&cache->origins, release_origin);
+    default_allocator.release((void**) &cache->file, strlen(cache->file) + 1);
+    default_allocator.release((void**) &cache, sizeof(CurlAltSvcCache));
+}
+
+void curl_altsvc_flush(CurlAltSvcCache* cache)
+{
+    if (!cache || !cache->dirty) {
+        return;
+    }
+    uint64_t now = curl_now_usec();
+    if (now < cache->flush_time + FLUSH_INTERVAL) {
+        return;
+    }
+    cache->flush_time = now;
+    if (save_altsvc(cache)) {
+        cache->dirty = false;
+    }
+}
+
+void curl_altsvc_apply(CurlAltSvcCache* cache, CurlRequestData* req)
+{
+    curl_easy_setopt(req->easy_handle, CURLOPT_ALTSVC_CTRL,
+                     (long) (CURLALTSVC_H1 | CURLALTSVC_H2 | CURLALTSVC_H3 | CURLALTSVC_READONLYFILE));
+    curl_easy_setopt(req->easy_handle, CURLOPT_ALTSVC, cache->file);
+}
+
+void curl_altsvc_record(CurlAltSvcCache* cache, CurlRequestData* req)
+{
+    if (req->header_index.num_hops == 0) {
+        return;
+    }
+    char src_alpn[3];
+    switch (req->http_version) {
+        case CURL_HTTP_VERSION_1_0:
+        case CURL_HTTP_VERSION_1_1: strcpy(src_alpn, "h1"); break;
+        case CURL_HTTP_VERSION_2_0: strcpy(src_alpn, "h2"); break;
+#       if LIBCURL_VERSION_NUM >= 0x074200
+            case CURL_HTTP_VERSION_3: strcpy(src_alpn, "h3"); break;
+#       endif
+        default: return;
+    }
+    CurlAltSvc services[MAX_ALTERNATIVES];
+    int n = curl_request_alt_svc(req, services, MAX_ALTERNATIVES);
+    if (n == 0) {
+        return;
+    }
+    char* url = nullptr;
+    curl_easy_getinfo(req->easy_handle, CURLINFO_EFFECTIVE_URL, &url);
+    if (!url || strncasecmp(url, "https://", 8) != 0) {
+        // RFC 7838, 2.1: alternatives of http origins are not trusted
+        return;
+    }
+    char* host;
+    unsigned host_length, port;
+    if (!curl_url_host_port(url, strlen(url), &host, &host_length, &port)) {
+        return;
+    }
+    if (*host == '[') {
+        host++;
+        host_length -= 2;
+    }
+    if (host_length > MAX_HOST_LENGTH) {
+        return;
+    }
+    char key[MAX_HOST_LENGTH + 16];
+    unsigned key_length = make_key(key, sizeof(key), src_alpn, host, host_length, port);
+    if (!key_length) {
+        return;
+    }
+    if (n < 0) {
+        AltSvcOrigin* origin = curl_hash_remove(&cache->origins, key, key_length);
+        if (origin) {
+            release_origin(origin);
+            cache->dirty = true;
+        }
+        return;
+    }
+    AltSvcOrigin* origin = get_origin(cache, key, key_length);
+    if (!origin) {
+        return;
+    }
+    // new advertisement replaces the previous one
+    origin->count = 0;
+    cache->dirty = true;
+    time_t now = time(nullptr);
+    for (int i = 0; i < n; i++) {
+        CurlAltSvc* service = &services[i];
+        AltSvcEntry* entry = &origin->entries[origin->count];
+        if (!alpn_id(service->protocol, service->protocol_length, entry->alpn)
+            || service->host_length > MAX_HOST_LENGTH) {
+            continue;
+        }
+        if (service->host) {
+            memcpy(entry->host, service->host, service->host_length);
+            entry->host[service->host_length] = 0;
+        } else {
+            memcpy(entry->host, host, host_length);
+            entry->host[host_length] = 0;
+        }
+        entry->port = service->port;
+        entry->expires = now + service->max_age;
+        entry->persist = service->persist;
+        origin->count++;
+    }
+}
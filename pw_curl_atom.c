@@ -0,0 +1,177 @@
+/*
+ * Process-wide table of interned header tokens.
+ *
+ * Media types, parameter names, and common parameter values recur
+ * in every response. Parsers map them to atoms so that parsed fields
+ * refer to immutable names instead of freshly made strings,
+ * and comparisons become pointer equality.
+ *
+ * Lookups are lock-free: slots are published with release stores
+ * and never change once set. Insertions are serialized by mutex.
+ * Atoms live until process exit.
+ *
+ * The table has fixed capacity and accepts short tokens only,
+ * so that hostile headers cannot make it grow without bound.
+ * When the table is full, new tokens are simply not interned
+ * and parsers fall back to regular strings.
+ */
+
+#include <pthread.h>
+#include <stdatomic.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+#define ATOM_TABLE_CAPACITY  4096  // power of two
+#define MAX_ATOMS            (ATOM_TABLE_CAPACITY / 2)
+
+#define CURL_ATOM_INIT(str)  { .name = (str), .length = sizeof(str) - 1 }
+
+CurlAtom curl_atom_text         = CURL_ATOM_INIT("text");
+CurlAtom curl_atom_html         = CURL_ATOM_INIT("html");
+CurlAtom curl_atom_application  = CURL_ATOM_INIT("application");
+CurlAtom curl_atom_octet_stream = CURL_ATOM_INIT("octet-stream");
+CurlAtom curl_atom_charset      = CURL_ATOM_INIT("charset");
+CurlAtom curl_atom_utf_8        = CURL_ATOM_INIT("utf-8");
+CurlAtom curl_atom_attachment   = CURL_ATOM_INIT("attachment");
+CurlAtom curl_atom_inline       = CURL_ATOM_INIT("inline");
+CurlAtom curl_atom_filename     = CURL_ATOM_INIT("filename");
+
+static CurlAtom well_known_atoms[] = {
+    CURL_ATOM_INIT("plain"),
+    CURL_ATOM_INIT("css"),
+    CURL_ATOM_INIT("javascript"),
+    CURL_ATOM_INIT("json"),
+    CURL_ATOM_INIT("xml"),
+    CURL_ATOM_INIT("xhtml+xml"),
+    CURL_ATOM_INIT("pdf"),
+    CURL_ATOM_INIT("zip"),
+    CURL_ATOM_INIT("gzip"),
+    CURL_ATOM_INIT("image"),
+    CURL_ATOM_INIT("png"),
+    CURL_ATOM_INIT("jpeg"),
+    CURL_ATOM_INIT("gif"),
+    CURL_ATOM_INIT("webp"),
+    CURL_ATOM_INIT("svg+xml"),
+    CURL_ATOM_INIT("audio"),
+    CURL_ATOM_INIT("video"),
+    CURL_ATOM_INIT("multipart"),
+    CURL_ATOM_INIT("form-data"),
+    CURL_ATOM_INIT("mixed"),
+    CURL_ATOM_INIT("boundary"),
+    CURL_ATOM_INIT("name"),
+    CURL_ATOM_INIT("us-ascii"),
+    CURL_ATOM_INIT("iso-8859-1"),
+    CURL_ATOM_INIT("windows-1252")
+};
+
+static _Atomic(CurlAtom*) atom_table[ATOM_TABLE_CAPACITY];
+static unsigned num_atoms = 0;
+static pthread_mutex_t atom_table_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static inline char lower_char(char c)
+{
+    return ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+}
+
+static CurlAtom* find_atom(char* name, unsigned length, uint64_t hash)
+/*
+ * Probe the table without locking.
+ */
+{
+    for (unsigned i = hash & (ATOM_TABLE_CAPACITY - 1);; i = (i + 1) & (ATOM_TABLE_CAPACITY - 1)) {
+        CurlAtom* atom = atomic_load_explicit(&atom_table[i], memory_order_acquire);
+        if (!atom) {
+            return nullptr;
+        }
+        if (atom->hash == hash && atom->length == length && memcmp(atom->name, name, length) == 0) {
+            return atom;
+        }
+    }
+}
+
+static void insert_atom(CurlAtom* atom)
+/*
+ * Must be called with the lock held, atom must not be in the table.
+ */
+{
+    for (unsigned i = atom->hash & (ATOM_TABLE_CAPACITY - 1);; i = (i + 1) & (ATOM_TABLE_CAPACITY - 1)) {
+        if (!atomic_load_explicit(&atom_table[i], memory_order_relaxed)) {
+            atomic_store_explicit(&atom_table[i], atom, memory_order_release);
+            num_atoms++;
+            return;
+        }
+    }
+}
+
+CurlAtom* curl_atom(char* name, unsigned length)
+{
+    if (length == 0 || length > CURL_MAX_ATOM_LENGTH) {
+        return nullptr;
+    }
+    char lowercased[CURL_MAX_ATOM_LENGTH];
+    for (unsigned i = 0; i < length; i++) {
+        lowercased[i] = lower_char(name[i]);
+    }
+    uint64_t hash = curl_hash_string(lowercased, length);
+
+    CurlAtom* atom = find_atom(lowercased, length, hash);
+    if (atom) {
+        return atom;
+    }
+
+    pthread_mutex_lock(&atom_table_lock);
+
+    // check again, some other thread could add it
+    atom = find_atom(lowercased, length, hash);
+    if (!atom && num_atoms < MAX_ATOMS) {
+        // allocate atom and its name in one block
+        atom = default_allocator.allocate(sizeof(CurlAtom) + length + 1, false);
+        if (atom) {
+            atom->name = (char*) (atom + 1);
+            memcpy(atom->name, lowercased, length);
+            atom->name[length] = 0;
+            atom->length = length;
+            atom->hash = hash;
+            insert_atom(atom);
+        }
+    }
+    pthread_mutex_unlock(&atom_table_lock);
+    return atom;
+}
+
+CurlAtom* curl_atom_find(char* name, unsigned length)
+{
+    if (length == 0 || length > CURL_MAX_ATOM_LENGTH) {
+        return nullptr;
+    }
+    return find_atom(name, length, curl_hash_string(name, length));
+}
+
+[[ gnu::constructor ]]
+static void init_atoms()
+{
+    static CurlAtom* named_atoms[] = {
+        &curl_atom_text,
+        &curl_atom_html,
+        &curl_atom_application,
+        &curl_atom_octet_stream,
+        &curl_atom_charset,
+        &curl_atom_utf_8,
+        &curl_atom_attachment,
+        &curl_atom_inline,
+        &curl_atom_filename
+    };
+    for (unsigned i = 0; i < PW_LENGTH(named_atoms); i++) {
+        CurlAtom* atom = named_atoms[i];
+        atom->hash = curl_hash_string(atom->name, atom->length);
+        insert_atom(atom);
+    }
+    for (unsigned i = 0; i < PW_LENGTH(well_known_atoms); i++) {
+        CurlAtom* atom = &well_known_atoms[i];
+        atom->hash = curl_hash_string(atom->name, atom->length);
+        insert_atom(atom);
+    }
+}
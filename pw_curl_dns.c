@@ -0,0 +1,313 @@
+/*
+ * Session-level DNS cache.
+ *
+ * Host names are resolved ahead of time with getaddrinfo_a
+ * and fed to easy handles through CURLOPT_RESOLVE,
+ * so libcurl does not block on resolution for known hosts.
+ *
+ * getaddrinfo does not report record TTLs, so cached entries
+ * expire after the TTL configured for the session.
+ *
+ * Requires glibc; link with -lanl for glibc older than 2.34.
+ */
+
+#ifndef _GNU_SOURCE
+#   define _GNU_SOURCE
+#endif
+
+#include <arpa/inet.h>
+#include <ctype.h>
+#include <netdb.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+// limit the number of lookups in flight, libcurl will resolve the rest by itself
+#define MAX_PENDING_LOOKUPS  1024
+
+// max number of addresses injected per host
+#define MAX_ADDRESSES  8
+
+typedef struct {
+    char* resolve_entry;  // "+host:port:addr1,addr2" for CURLOPT_RESOLVE, nullptr if lookup failed
+    uint64_t expires;     // monotonic time, usec
+    uint64_t started;     // lookup start time
+    struct gaicb request;
+    char* host;           // for request.ar_name
+    char* port;           // for request.ar_service
+    bool in_progress;
+} CurlDnsEntry;
+
+struct CurlDnsCache {
+    CurlHashTable entries;  // "host:port" -> CurlDnsEntry*
+    uint64_t ttl;           // usec
+    CurlDnsEntry* pending[MAX_PENDING_LOOKUPS];
+    unsigned num_pending;
+    CurlDnsStats stats;
+};
+
+static char* strdup_alloc(char* s, unsigned length)
+{
+    char* result = default_allocator.allocate(length + 1, false);
+    if (result) {
+        memcpy(result, s, length);
+        result[length] = 0;
+    }
+    return result;
+}
+
+static void release_cstr(char** s)
+{
+    if (*s) {
+        default_allocator.release((void**) s, strlen(*s) + 1);
+    }
+}
+
+static void release_entry(void* value)
+{
+    CurlDnsEntry* entry = value;
+    if (entry->request.ar_result) {
+        freeaddrinfo(entry->request.ar_result);
+    }
+    release_cstr(&entry->resolve_entry);
+    release_cstr(&entry->host);
+    release_cstr(&entry->port);
+    default_allocator.release((void**) &entry, sizeof(CurlDnsEntry));
+}
+
+CurlDnsCache* curl_dns_create(unsigned ttl)
+{
+    CurlDnsCache* dns = default_allocator.allocate(sizeof(CurlDnsCache), true);
+    if (!dns) {
+        return nullptr;
+    }
+    if (!curl_hash_init(&dns->entries, 256)) {
+        default_allocator.release((void**) &dns, sizeof(CurlDnsCache));
+        return nullptr;
+    }
+    dns->ttl = ((uint64_t) ttl) * 1000000;
+    return dns;
+}
+
+void curl_dns_delete(CurlDnsCache* dns)
+{
+    // lookups in progress refer to entries, wait for them before releasing
+    for (unsigned i = 0; i < dns->num_pending; i++) {
+        struct gaicb* request = &dns->pending[i]->request;
+        if (gai_cancel(request) == EAI_NOTCANCELED) {
+            struct gaicb* list[1] = { request };
+            while (gai_error(request) == EAI_INPROGRESS) {
+                gai_suspend((const struct gaicb* const*) list, 1, nullptr);
+            }
+        }
+    }
+    curl_hash_fini(&dns->entries, release_entry);
+    default_allocator.release((void**) &dns, sizeof(CurlDnsCache));
+}
+
+static unsigned get_key(char* url, char* key, unsigned key_size, unsigned* host_length)
+/*
+ * Write "host:port" to key, host lowercased.
+ * Return key length, 0 for malformed URLs and for IP address literals
+ * that do not need resolving.
+ */
+{
+    char* host;
+    unsigned port;
+    if (!curl_url_host_port(url, strlen(url), &host, host_length, &port)) {
+        return 0;
+    }
+    if (host[0] == '[' || *host_length + 7 > key_size) {
+        return 0;  // IPv6 literal or too long
+    }
+    for (unsigned i = 0; i < *host_length; i++) {
+        key[i] = tolower((unsigned char) host[i]);
+    }
+    key[*host_length] = 0;
+    struct in_addr addr;
+    if (inet_pton(AF_INET, key, &addr) == 1) {
+        return 0;
+    }
+    return *host_length + sprintf(key + *host_length, ":%u", port);
+}
+
+static void start_lookup(CurlDnsCache* dns, CurlDnsEntry* entry)
+{
+    if (dns->num_pending >= MAX_PENDING_LOOKUPS) {
+        return;
+    }
+    static struct addrinfo hints = {
+        .ai_family   = AF_UNSPEC,
+        .ai_socktype = SOCK_STREAM
+    };
+    entry->request = (struct gaicb) {
+        .ar_name    = entry->host,
+        .ar_service = entry->port,
+        .ar_request = &hints
+    };
+    struct gaicb* list[1] = { &entry->request };
+    if (getaddrinfo_a(GAI_NOWAIT, list, 1, nullptr) != 0) {
+        return;
+    }
+    entry->started = curl_now_usec();
+    entry->in_progress = true;
+    dns->pending[dns->num_pending++] = entry;
+}
+
+static void prefetch_key(CurlDnsCache* dns, char* key, unsigned key_length, unsigned host_length)
+/*
+ * Start resolving "host:port" unless it is already cached or being resolved.
+ */
+{
+    CurlDnsEntry* entry = curl_hash_get(&dns->entries, key, key_length);
+    if (entry) {
+        if (entry->in_progress || entry->expires > curl_now_usec()) {
+            return;
+        }
+        // expired, resolve again
+        if (entry->request.ar_result) {
+            freeaddrinfo(entry->request.ar_result);
+            entry->request.ar_result = nullptr;
+        }
+        start_lookup(dns, entry);
+        return;
+    }
+    entry = default_allocator.allocate(sizeof(CurlDnsEntry), true);
+    if (!entry) {
+        return;
+    }
+    entry->host = strdup_alloc(key, host_length);
+    entry->port = strdup_alloc(key + host_length + 1, key_length - host_length - 1);
+    if (!entry->host || !entry->port || !curl_hash_put(&dns->entries, key, key_length, entry)) {
+        release_entry(entry);
+        return;
+    }
+    start_lookup(dns, entry);
+}
+
+void curl_dns_prefetch(CurlDnsCache* dns, char* url)
+/*
+ * Start resolving URL's host unless it is already cached or being resolved.
+ */
+{
+    if (!dns) {
+        return;
+    }
+    char key[300];
+    unsigned host_length;
+    unsigned key_length = get_key(url, key, sizeof(key), &host_length);
+    if (key_length) {
+        prefetch_key(dns, key, key_length, host_length);
+    }
+}
+
+static void complete_lookup(CurlDnsCache* dns, CurlDnsEntry* entry, int err)
+{
+    uint64_t now = curl_now_usec();
+    uint64_t elapsed = now - entry->started;
+
+    entry->in_progress = false;
+    entry->expires = now + dns->ttl;
+    release_cstr(&entry->resolve_entry);
+
+    dns->stats.lookups++;
+    dns->stats.lookup_time_usec += elapsed;
+    if (elapsed > dns->stats.max_lookup_time_usec) {
+        dns->stats.max_lookup_time_usec = elapsed;
+    }
+    if (err) {
+        dns->stats.failures++;
+        return;
+    }
+
+    // format resolve entry
+    char buf[MAX_ADDRESSES * (INET6_ADDRSTRLEN + 3) + 300];
+    int n = snprintf(buf, sizeof(buf), "+%s:%s:", entry->host, entry->port);
+    char* p = buf + n;
+    unsigned num_addresses = 0;
+    for (struct addrinfo* ai = entry->request.ar_result; ai && num_addresses < MAX_ADDRESSES; ai = ai->ai_next) {
+        char addr[INET6_ADDRSTRLEN];
+        if (ai->ai_family == AF_INET) {
+            inet_ntop(AF_INET, &((struct sockaddr_in*) ai->ai_addr)->sin_addr, addr, sizeof(addr));
+        } else if (ai->ai_family == AF_INET6) {
+            inet_ntop(AF_INET6, &((struct sockaddr_in6*) ai->ai_addr)->sin6_addr, addr, sizeof(addr));
+        } else {
+            continue;
+        }
+        if (num_addresses) {
+            *p++ = ',';
+        }
+        p += sprintf(p, (ai->ai_family == AF_INET6)? "[%s]" : "%s", addr);
+        num_addresses++;
+    }
+    freeaddrinfo(entry->request.ar_result);
+    entry->request.ar_result = nullptr;
+
+    if (num_addresses) {
+        entry->resolve_entry = strdup_alloc(buf, p - buf);
+    } else {
+        dns->stats.failures++;
+    }
+}
+
+void curl_dns_poll(CurlDnsCache* dns)
+/*
+ * Collect completed lookups.
+ */
+{
+    if (!dns) {
+        return;
+    }
+    for (unsigned i = 0; i < dns->num_pending;) {
+        CurlDnsEntry* entry = dns->pending[i];
+        int err = gai_error(&entry->request);
+        if (err == EAI_INPROGRESS) {
+            i++;
+            continue;
+        }
+        complete_lookup(dns, entry, err);
+        dns->pending[i] = dns->pending[--dns->num_pending];
+    }
+}
+
+void curl_dns_inject(CurlDnsCache* dns, CurlRequestData* req, char* url)
+/*
+ * Set CURLOPT_RESOLVE for the request if the host is in the cache,
+ * otherwise start resolving it for subsequent requests.
+ */
+{
+    if (!dns) {
+        return;
+    }
+    char key[300];
+    unsigned host_length;
+    unsigned key_length = get_key(url, key, sizeof(key), &host_length);
+    if (!key_length) {
+        return;
+    }
+    CurlDnsEntry* entry = curl_hash_get(&dns->entries, key, key_length);
+    if (!entry || entry->in_progress || !entry->resolve_entry || entry->expires <= curl_now_usec()) {
+        dns->stats.misses++;
+        prefetch_key(dns, key, key_length, host_length);
+        return;
+    }
+    struct curl_slist* resolve = curl_slist_append(req->resolve, entry->resolve_entry);
+    if (!resolve) {
+        return;
+    }
+    req->resolve = resolve;
+    curl_easy_setopt(req->easy_handle, CURLOPT_RESOLVE, req->resolve);
+    dns->stats.hits++;
+}
+
+void curl_dns_get_stats(CurlDnsCache* dns, CurlDnsStats* stats)
+{
+    if (dns) {
+        *stats = dns->stats;
+    } else {
+        *stats = (CurlDnsStats) {};
+    }
+}
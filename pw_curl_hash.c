@@ -0,0 +1,158 @@
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+uint64_t curl_hash_string(char* key, unsigned key_length)
+/*
+ * FNV-1a, never returns zero which denotes empty slot.
+ */
+{
+    uint64_t h = 0xcbf29ce484222325ULL;
+    for (unsigned i = 0; i < key_length; i++) {
+        h ^= (unsigned char) key[i];
+        h *= 0x100000001b3ULL;
+    }
+    return h? h : 1;
+}
+
+[[nodiscard]] bool curl_hash_init(CurlHashTable* table, unsigned capacity)
+{
+    unsigned n = 16;
+    while (n < capacity) {
+        n <<= 1;
+    }
+    table->entries = default_allocator.allocate(n * sizeof(CurlHashEntry), true);
+    if (!table->entries) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    table->capacity = n;
+    table->count = 0;
+    return true;
+}
+
+void curl_hash_fini(CurlHashTable* table, void (*release_value)(void* value))
+{
+    if (!table->entries) {
+        return;
+    }
+    for (unsigned i = 0; i < table->capacity; i++) {
+        CurlHashEntry* entry = &table->entries[i];
+        if (entry->hash) {
+            default_allocator.release((void**) &entry->key, entry->key_length + 1);
+            if (release_value) {
+                release_value(entry->value);
+            }
+        }
+    }
+    default_allocator.release((void**) &table->entries, table->capacity * sizeof(CurlHashEntry));
+    table->capacity = 0;
+    table->count = 0;
+}
+
+static CurlHashEntry* lookup(CurlHashTable* table, uint64_t hash, char* key, unsigned key_length)
+/*
+ * Return matching entry or empty slot where the key should be inserted.
+ */
+{
+    unsigned mask = table->capacity - 1;
+    for (unsigned i = hash & mask;; i = (i + 1) & mask) {
+        CurlHashEntry* entry = &table->entries[i];
+        if (entry->hash == 0) {
+            return entry;
+        }
+        if (entry->hash == hash && entry->key_length == key_length
+            && memcmp(entry->key, key, key_length) == 0) {
+            return entry;
+        }
+    }
+}
+
+[[nodiscard]] static bool grow(CurlHashTable* table)
+{
+    CurlHashTable new_table;
+    if (!curl_hash_init(&new_table, table->capacity * 2)) {
+        return false;
+    }
+    unsigned mask = new_table.capacity - 1;
+    for (unsigned i = 0; i < table->capacity; i++) {
+        CurlHashEntry* entry = &table->entries[i];
+        if (entry->hash) {
+            unsigned j = entry->hash & mask;
+            while (new_table.entries[j].hash) {
+                j = (j + 1) & mask;
+            }
+            new_table.entries[j] = *entry;
+        }
+    }
+    new_table.count = table->count;
+    default_allocator.release((void**) &table->entries, table->capacity * sizeof(CurlHashEntry));
+    *table = new_table;
+    return true;
+}
+
+void* curl_hash_get(CurlHashTable* table, char* key, unsigned key_length)
+{
+    CurlHashEntry* entry = lookup(table, curl_hash_string(key, key_length), key, key_length);
+    return entry->hash? entry->value : nullptr;
+}
+
+[[nodiscard]] bool curl_hash_put(CurlHashTable* table, char* key, unsigned key_length, void* value)
+{
+    if ((table->count + 1) * 4 > table->capacity * 3) {
+        if (!grow(table)) {
+            return false;
+        }
+    }
+    uint64_t hash = curl_hash_string(key, key_length);
+    CurlHashEntry* entry = lookup(table, hash, key, key_length);
+    if (entry->hash) {
+        entry->value = value;
+        return true;
+    }
+    char* key_copy = default_allocator.allocate(key_length + 1, false);
+    if (!key_copy) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    memcpy(key_copy, key, key_length);
+    key_copy[key_length] = 0;
+
+    entry->hash = hash;
+    entry->key = key_copy;
+    entry->key_length = key_length;
+    entry->value = value;
+    table->count++;
+    return true;
+}
+
+void* curl_hash_remove(CurlHashTable* table, char* key, unsigned key_length)
+{
+    CurlHashEntry* entry = lookup(table, curl_hash_string(key, key_length), key, key_length);
+    if (entry->hash == 0) {
+        return nullptr;
+    }
+    void* value = entry->value;
+    default_allocator.release((void**) &entry->key, entry->key_length + 1);
+    table->count--;
+
+    // backward shift deletion keeps probe sequences intact without tombstones
+    unsigned mask = table->capacity - 1;
+    unsigned hole = entry - table->entries;
+    for (unsigned i = (hole + 1) & mask;; i = (i + 1) & mask) {
+        CurlHashEntry* next = &table->entries[i];
+        if (next->hash == 0) {
+            break;
+        }
+        unsigned home = next->hash & mask;
+        // move next into the hole if its home slot is not within (hole, i]
+        if (((i - home) & mask) >= ((i - hole) & mask)) {
+            table->entries[hole] = *next;
+            hole = i;
+        }
+    }
+    table->entries[hole] = (CurlHashEntry) {};
+    return value;
+}
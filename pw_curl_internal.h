@@ -0,0 +1,248 @@
+#pragma once
+
+/*
+ * Definitions shared by pw-curl translation units.
+ * Not a part of public API.
+ */
+
+#include <stdint.h>
+#include <time.h>
+
+#include "pw_curl.h"
+
+/****************************************************************
+ * Simple open addressing hash table with string keys.
+ * Keys are copied, values are owned by the caller.
+ */
+
+typedef struct {
+    uint64_t hash;        // zero means empty slot
+    char*    key;         // nul-terminated copy of the key
+    unsigned key_length;
+    void*    value;
+} CurlHashEntry;
+
+typedef struct {
+    CurlHashEntry* entries;
+    unsigned capacity;    // power of two
+    unsigned count;
+} CurlHashTable;
+
+uint64_t curl_hash_string(char* key, unsigned key_length);
+
+[[nodiscard]] bool curl_hash_init(CurlHashTable* table, unsigned capacity);
+void curl_hash_fini(CurlHashTable* table, void (*release_value)(void* value));
+
+void* curl_hash_get(CurlHashTable* table, char* key, unsigned key_length);
+/*
+ * Return value or nullptr if key not found.
+ */
+
+[[nodiscard]] bool curl_hash_put(CurlHashTable* table, char* key, unsigned key_length, void* value);
+/*
+ * Insert or replace value. The previous value, if any, is not released.
+ */
+
+void* curl_hash_remove(CurlHashTable* table, char* key, unsigned key_length);
+/*
+ * Remove entry and return its value or nullptr if key not found.
+ */
+
+/****************************************************************
+ * URL helpers, see pw_url.c
+ */
+
+bool curl_url_host_port(char* url, unsigned length, char** host, unsigned* host_length, unsigned* port);
+/*
+ * Find host and port of absolute URL without parsing it in full.
+ * Host points into URL as is, IPv6 literals keep brackets.
+ * Port defaults to the one of the scheme.
+ * Return false for malformed URLs and unknown schemes without port.
+ */
+
+/****************************************************************
+ * DNS subsystem, see pw_curl_dns.c
+ */
+
+typedef struct CurlDnsCache CurlDnsCache;
+
+CurlDnsCache* curl_dns_create(unsigned ttl);
+void curl_dns_delete(CurlDnsCache* dns);
+
+void curl_dns_prefetch(CurlDnsCache* dns, char* url);
+void curl_dns_poll(CurlDnsCache* dns);
+void curl_dns_inject(CurlDnsCache* dns, CurlRequestData* req, char* url);
+void curl_dns_get_stats(CurlDnsCache* dns, CurlDnsStats* stats);
+
+/****************************************************************
+ * Redirect cache, see pw_curl_redirects.c
+ */
+
+typedef struct CurlRedirectCache CurlRedirectCache;
+
+CurlRedirectCache* curl_redirects_create(unsigned max_entries, bool cache_temporary, char* state_file);
+void curl_redirects_delete(CurlRedirectCache* cache);
+
+void curl_redirects_apply(CurlRedirectCache* cache, CurlRequestData* req, char* url);
+/*
+ * Send request straight to the final target of cached redirects from URL.
+ */
+
+void curl_redirects_record(CurlRedirectCache* cache, CurlRequestData* req);
+/*
+ * Add cacheable redirects followed by the completed request.
+ */
+
+void curl_redirects_get_stats(CurlRedirectCache* cache, CurlRedirectStats* stats);
+
+/****************************************************************
+ * Alt-Svc cache, see pw_curl_altsvc.c
+ */
+
+typedef struct CurlAltSvcCache CurlAltSvcCache;
+
+CurlAltSvcCache* curl_altsvc_create(char* file);
+/*
+ * Load cache from file, nullptr file means temporary cache for this process.
+ */
+
+void curl_altsvc_delete(CurlAltSvcCache* cache);
+
+void curl_altsvc_flush(CurlAltSvcCache* cache);
+/*
+ * Write new advertisements to the file for requests that start later,
+ * no more often than once per second.
+ */
+
+void curl_altsvc_apply(CurlAltSvcCache* cache, CurlRequestData* req);
+/*
+ * Let the request upgrade to advertised services, the file is loaded read-only.
+ */
+
+void curl_altsvc_record(CurlAltSvcCache* cache, CurlRequestData* req);
+/*
+ * Add services advertised by the final response of completed request.
+ */
+
+/****************************************************************
+ * Header index, see pw_http_util.c
+ */
+
+[[nodiscard]] bool curl_header_index_add_line(CurlHeaderIndex* index, char* line, unsigned length);
+void curl_header_index_fini(CurlHeaderIndex* index);
+CurlHeader* curl_header_index_get(CurlHeaderIndex* index, char* name, int hop);
+
+void curl_request_hop_cache_control(CurlRequestData* req, int hop, CurlCacheControl* cc);
+/*
+ * Parse Cache-Control of the given response, not necessarily the final one.
+ */
+
+CurlFilterResult curl_request_filter_response(CurlRequestData* req, CurlResponseFilter* filter);
+/*
+ * Check the last response when its headers are complete.
+ */
+
+unsigned curl_request_get_charset(CurlRequestData* req, char* charset, unsigned size);
+/*
+ * Copy lowercased charset parameter of Content-Type to the buffer.
+ * Return its length, 0 if there's no charset or it does not fit.
+ */
+
+typedef struct {
+    char* protocol;            // ALPN protocol id as is, not nul-terminated
+    unsigned protocol_length;
+    char* host;                // nullptr for the same host, IPv6 literals without brackets
+    unsigned host_length;
+    unsigned port;
+    long max_age;              // seconds
+    bool persist;
+} CurlAltSvc;
+
+int curl_request_alt_svc(CurlRequestData* req, CurlAltSvc* services, unsigned max_services);
+/*
+ * Parse Alt-Svc of the final response, views point into the header index.
+ * Return the number of alternative services, 0 if there are none,
+ * or -1 if the header clears them.
+ */
+
+/****************************************************************
+ * Scan mode, see pw_curl_scan.c
+ */
+
+bool curl_scan_fallback(CurlRequestData* req);
+/*
+ * Check if HEAD was refused and prepare the request for ranged GET.
+ */
+
+/****************************************************************
+ * Text mode, see pw_curl_text.c
+ */
+
+unsigned curl_text_start(CurlRequestData* req, char* data, size_t size);
+/*
+ * Choose charset for the first chunk of content.
+ * Return length of byte order mark to skip.
+ */
+
+[[nodiscard]] bool curl_text_decode(CurlTextDecoder* decoder, char* data, size_t size, bool final, PwValuePtr result);
+/*
+ * Decode chunk and append it to the result.
+ * Call with final set after the last chunk to flush incomplete sequence.
+ */
+
+void curl_text_fini(CurlTextDecoder* decoder);
+
+[[nodiscard]] bool curl_percent_decode(char* start, char* end, char* charset, PwValuePtr result);
+/*
+ * Decode percent-encoded bytes from start to end, transcode them from charset
+ * and append to the result. Charset name must be lowercased,
+ * nullptr or empty string means UTF-8.
+ * Percent signs not followed by two hex digits are kept as is.
+ */
+
+/****************************************************************
+ * Session
+ */
+
+typedef struct CaBundle CaBundle;
+
+typedef struct {
+    CURLM* multi_handle;
+    CurlSessionOptions options;
+    CurlDnsCache* dns;
+    CurlRedirectCache* redirects;
+    CurlAltSvcCache* altsvc;
+    CurlConnectionStats connection_stats;
+    bool http3_available;  // libcurl is built with HTTP/3 support
+    bool http3_warned;
+    unsigned num_prewarming;  // pre-warm requests in multi handle, not reported as running transfers
+
+    // shared and persistent state, see pw_curl_state.c
+    CURLSH* share_handle;
+    CURL*   state_handle;
+    char*   hsts_file;
+    bool    hsts_loaded;
+
+    CaBundle* ca_bundle;  // nullptr if CURLOPT_CAINFO is used with CA cache
+} CurlSession;
+
+[[nodiscard]] bool curl_state_load(CurlSession* session);
+void curl_state_apply(CurlSession* session, CurlRequestData* req);
+void curl_state_save(CurlSession* session);
+
+void curl_ca_init(CurlSession* session);
+void curl_ca_apply(CurlSession* session, CurlRequestData* req);
+
+/****************************************************************
+ * Misc. helpers
+ */
+
+static inline uint64_t curl_now_usec()
+/*
+ * Monotonic time in microseconds.
+ */
+{
+    struct timespec ts;
+    clock_gettime(CLOCK_MONOTONIC, &ts);
+    return ((uint64_t) ts.tv_sec) * 1000000 + ts.tv_nsec / 1000;
+}
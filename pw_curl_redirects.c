@@ -0,0 +1,312 @@
+/*
+ * Session-level redirect cache.
+ *
+ * Permanent redirects (301, 308) are recorded when a request completes,
+ * and further requests for the same URL are sent straight to the final
+ * target of the chain, so the hops are not paid again.
+ *
+ * Optionally, temporary redirects (302, 307) are cached too, if the response
+ * explicitly allows that with max-age, RFC 9111, 4.2.1. They expire accordingly.
+ *
+ * URLs are keyed by 128-bit fingerprints of their canonical form,
+ * entries keep the target as it was resolved from Location header.
+ *
+ * If state_file session option is set, the cache is saved to
+ * <state_file>.redirects when the session is deleted and loaded
+ * when it is created. The file is text, one redirect per line:
+ * source fingerprint in hex, expiration time (0 for permanent), target.
+ */
+
+#include <inttypes.h>
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+// longer cached chains are most likely loops
+#define MAX_CHAIN  10
+
+// fragments are not sent, query order may matter for the server
+#define CANON_FLAGS  CURL_CANON_KEEP_QUERY_ORDER
+
+typedef struct {
+    CurlFingerprint target_fp;
+    int64_t expires;      // wall clock time, 0 for permanent redirects
+    unsigned length;
+    char target[];        // nul-terminated
+} RedirectEntry;
+
+struct CurlRedirectCache {
+    CurlHashTable entries;  // source fingerprint -> RedirectEntry*
+    unsigned max_entries;
+    bool cache_temporary;
+    char* file;             // nullptr if not persistent
+    CurlRedirectStats stats;
+};
+
+static void release_entry(void* value)
+{
+    RedirectEntry* entry = value;
+    default_allocator.release((void**) &entry, sizeof(RedirectEntry) + entry->length + 1);
+}
+
+static bool put_entry(CurlRedirectCache* cache, CurlFingerprint* source,
+                      char* target, unsigned length, int64_t expires)
+/*
+ * Add or replace redirect. Return false if it was not added.
+ */
+{
+    RedirectEntry* old = curl_hash_get(&cache->entries, (char*) source, sizeof(CurlFingerprint));
+    if (!old && cache->entries.count >= cache->max_entries) {
+        return false;
+    }
+    RedirectEntry* entry = default_allocator.allocate(sizeof(RedirectEntry) + length + 1, false);
+    if (!entry) {
+        return false;
+    }
+    if (!curl_url_fingerprint(target, length, CANON_FLAGS, &entry->target_fp)) {
+        default_allocator.release((void**) &entry, sizeof(RedirectEntry) + length + 1);
+        return false;
+    }
+    entry->expires = expires;
+    entry->length = length;
+    memcpy(entry->target, target, length);
+    entry->target[length] = 0;
+
+    if (!curl_hash_put(&cache->entries, (char*) source, sizeof(CurlFingerprint), entry)) {
+        release_entry(entry);
+        return false;
+    }
+    if (old) {
+        release_entry(old);
+    }
+    return true;
+}
+
+static RedirectEntry* get_entry(CurlRedirectCache* cache, CurlFingerprint* source, time_t now)
+/*
+ * Return redirect for the source, drop it if expired.
+ */
+{
+    RedirectEntry* entry = curl_hash_get(&cache->entries, (char*) source, sizeof(CurlFingerprint));
+    if (entry && entry->expires && entry->expires <= now) {
+        curl_hash_remove(&cache->entries, (char*) source, sizeof(CurlFingerprint));
+        release_entry(entry);
+        cache->stats.expired++;
+        return nullptr;
+    }
+    return entry;
+}
+
+static void load_redirects(CurlRedirectCache* cache)
+{
+    FILE* f = fopen(cache->file, "r");
+    if (!f) {
+        return;
+    }
+    time_t now = time(nullptr);
+    char* line = nullptr;
+    size_t line_size = 0;
+    ssize_t length;
+    while ((length = getline(&line, &line_size, f)) > 0) {
+        if (line[length - 1] == '\n') {
+            line[--length] = 0;
+        }
+        CurlFingerprint source;
+        int64_t expires;
+        int target_start = 0;
+        if (sscanf(line, "%16" SCNx64 "%16" SCNx64 " %" SCNd64 " %n",
+                   &source.lo, &source.hi, &expires, &target_start) != 3 || target_start == 0) {
+            continue;
+        }
+        if (expires && expires <= now) {
+            continue;
+        }
+        if (!put_entry(cache, &source, line + target_start, length - target_start, expires)) {
+            break;
+        }
+    }
+    free(line);  // allocated by getline
+    fclose(f);
+}
+
+static void save_redirects(CurlRedirectCache* cache)
+{
+    FILE* f = fopen(cache->file, "w");
+    if (!f) {
+        fprintf(stderr, "WARNING: cannot save redirects to %s\n", cache->file);
+        return;
+    }
+    time_t now = time(nullptr);
+    for (unsigned i = 0; i < cache->entries.capacity; i++) {
+        CurlHashEntry* slot = &cache->entries.entries[i];
+        if (slot->hash == 0) {
+            continue;
+        }
+        RedirectEntry* entry = slot->value;
+        if (entry->expires && entry->expires <= now) {
+            continue;
+        }
+        CurlFingerprint source;
+        memcpy(&source, slot->key, sizeof(CurlFingerprint));
+        fprintf(f, "%016" PRIx64 "%016" PRIx64 " %" PRId64 " %s\n",
+                source.lo, source.hi, entry->expires, entry->target);
+    }
+    if (fclose(f) != 0) {
+        fprintf(stderr, "WARNING: cannot save redirects to %s\n", cache->file);
+    }
+}
+
+CurlRedirectCache* curl_redirects_create(unsigned max_entries, bool cache_temporary, char* state_file)
+{
+    CurlRedirectCache* cache = default_allocator.allocate(sizeof(CurlRedirectCache), true);
+    if (!cache) {
+        return nullptr;
+    }
+    if (!curl_hash_init(&cache->entries, 1024)) {
+        default_allocator.release((void**) &cache, sizeof(CurlRedirectCache));
+        return nullptr;
+    }
+    cache->max_entries = max_entries;
+    cache->cache_temporary = cache_temporary;
+
+    if (state_file) {
+        static char suffix[] = ".redirects";
+        unsigned length = strlen(state_file) + sizeof(suffix);
+        cache->file = default_allocator.allocate(length, false);
+        if (cache->file) {
+            strcpy(cache->file, state_file);
+            strcat(cache->file, suffix);
+            load_redirects(cache);
+        }
+    }
+    return cache;
+}
+
+void curl_redirects_delete(CurlRedirectCache* cache)
+{
+    if (cache->file) {
+        save_redirects(cache);
+        default_allocator.release((void**) &cache->file, strlen(cache->file) + 1);
+    }
+    curl_hash_fini(&cache->entries, release_entry);
+    default_allocator.release((void**) &cache, sizeof(CurlRedirectCache));
+}
+
+void curl_redirects_apply(CurlRedirectCache* cache, CurlRequestData* req, char* url)
+{
+    CurlFingerprint start;
+    if (!curl_url_fingerprint(url, strlen(url), CANON_FLAGS, &start)) {
+        return;
+    }
+    time_t now = time(nullptr);
+    RedirectEntry* target = nullptr;
+    CurlFingerprint fp = start;
+    unsigned hops = 0;
+    for (;;) {
+        RedirectEntry* entry = get_entry(cache, &fp, now);
+        if (!entry) {
+            break;
+        }
+        if (hops == MAX_CHAIN || curl_fingerprint_equal(&entry->target_fp, &start)) {
+            // redirect loop, let libcurl run into it and report the error
+            target = nullptr;
+            break;
+        }
+        target = entry;
+        fp = entry->target_fp;
+        hops++;
+    }
+    if (!target) {
+        cache->stats.misses++;
+        return;
+    }
+    pw_destroy(&req->cached_url);
+    if (!pw_create_string(target->target, &req->cached_url)) {
+        return;
+    }
+    curl_easy_setopt(req->easy_handle, CURLOPT_URL, (char*) target->target);
+    cache->stats.hits++;
+    cache->stats.hops_saved += hops;
+}
+
+static int64_t redirect_expires(CurlRedirectCache* cache, CurlRequestData* req, unsigned hop, time_t now)
+/*
+ * Return expiration time for redirect received in the given hop,
+ * 0 if it is permanent, or -1 if it should not be cached.
+ */
+{
+    switch (req->header_index.status[hop]) {
+        case 301:
+        case 308:
+            return 0;
+
+        case 302:
+        case 307: {
+            if (!cache->cache_temporary) {
+                return -1;
+            }
+            CurlCacheControl cc;
+            curl_request_hop_cache_control(req, hop, &cc);
+            if (cc.no_store || cc.no_cache || cc.max_age <= 0) {
+                return -1;
+            }
+            return now + cc.max_age;
+        }
+        default:
+            return -1;
+    }
+}
+
+void curl_redirects_record(CurlRedirectCache* cache, CurlRequestData* req)
+{
+    unsigned num_hops = req->header_index.num_hops;
+    if (num_hops > CURL_MAX_HOPS) {
+        // status of further hops is unknown
+        num_hops = CURL_MAX_HOPS;
+    }
+    if (num_hops < 2) {
+        return;
+    }
+    PwValue url = PW_NULL;
+    pw_clone2(pw_is_string(&req->cached_url)? &req->cached_url : &req->url, &url);
+
+    time_t now = time(nullptr);
+
+    // only redirects that were followed are known to be complete
+    for (unsigned hop = 0; hop < num_hops - 1; hop++) {{
+        char* location = curl_request_get_header(req, "Location", hop);
+        if (!location) {
+            break;
+        }
+        PW_CSTRING_LOCAL(url_cstr, &url);
+        PwValue target = PW_NULL;
+        if (!urljoin_cstr(url_cstr, location, &target)) {
+            break;
+        }
+        int64_t expires = redirect_expires(cache, req, hop, now);
+        if (expires >= 0) {
+            CurlFingerprint source;
+            PW_CSTRING_LOCAL(target_cstr, &target);
+            if (curl_url_fingerprint(url_cstr, strlen(url_cstr), CANON_FLAGS, &source)
+                && put_entry(cache, &source, target_cstr, strlen(target_cstr), expires)) {
+                cache->stats.recorded++;
+            }
+        }
+        pw_destroy(&url);
+        pw_move(&target, &url);
+    }}
+}
+
+void curl_redirects_get_stats(CurlRedirectCache* cache, CurlRedirectStats* stats)
+{
+    if (cache) {
+        *stats = cache->stats;
+        stats->entries = cache->entries.count;
+    } else {
+        *stats = (CurlRedirectStats) {};
+    }
+}
@@ -0,0 +1,106 @@
+/*
+ * Metadata scan mode.
+ *
+ * Requests are made with HEAD, so only status and headers are received.
+ * Servers that refuse HEAD with 405 or 501 get the same URL again
+ * as GET with Range: bytes=0-0, which costs one byte of body.
+ *
+ * Bodies are never stored. If a server ignores the range,
+ * a few kilobytes are discarded and the transfer is aborted,
+ * which is not treated as an error.
+ *
+ * For high request rates use HTTP/2 with pipewait session option,
+ * so that many HEAD requests share one connection per host.
+ */
+
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+// bytes discarded before aborting the transfer that ignored the range,
+// small bodies are read to keep HTTP/1.1 connection reusable
+#define MAX_DISCARD  16384
+
+static size_t scan_write_data(void* data, size_t always_1, size_t size, PwValuePtr self)
+{
+    CurlRequestData* req = pw_curl_request_data_ptr(self);
+
+    req->scan_discarded += size;
+    if (req->scan_discarded <= MAX_DISCARD) {
+        return size;
+    }
+    // headers are all we need
+    req->scan_aborted = true;
+    return 0;
+}
+
+void curl_request_set_scan_mode(PwValuePtr request, bool scan_mode)
+{
+    CurlRequestData* req = pw_curl_request_data_ptr(request);
+    req->scan_mode = scan_mode;
+    if (scan_mode) {
+        curl_easy_setopt(req->easy_handle, CURLOPT_NOBODY, 1L);
+        curl_easy_setopt(req->easy_handle, CURLOPT_WRITEFUNCTION, scan_write_data);
+    } else {
+        PwInterface_Curl* iface = pw_interface(request->type_id, Curl);
+        curl_easy_setopt(req->easy_handle, CURLOPT_HTTPGET, 1L);
+        curl_easy_setopt(req->easy_handle, CURLOPT_WRITEFUNCTION, iface->write_data);
+    }
+}
+
+bool curl_scan_fallback(CurlRequestData* req)
+{
+    if (req->scan_ranged || (req->status != 405 && req->status != 501)) {
+        return false;
+    }
+    req->scan_ranged = true;
+
+    // forget HEAD response
+    curl_header_index_fini(&req->header_index);
+    req->parsed_headers = 0;
+    req->headers_complete = false;
+    req->filtered = CURL_FILTER_PASSED;
+    req->status = 0;
+
+    curl_easy_setopt(req->easy_handle, CURLOPT_HTTPGET, 1L);
+    curl_easy_setopt(req->easy_handle, CURLOPT_RANGE, "0-0");
+    return true;
+}
+
+void curl_request_scan_result(CurlRequestData* req, CurlScanResult* result)
+{
+    *result = (CurlScanResult) {
+        .status = req->status,
+        .content_length = -1,
+        .connect_time = req->connect_time,
+        .appconnect_time = req->appconnect_time,
+        .total_time = req->total_time,
+        .ranged = req->scan_ranged
+    };
+    curl_easy_getinfo(req->easy_handle, CURLINFO_EFFECTIVE_URL, &result->real_url);
+    curl_easy_getinfo(req->easy_handle, CURLINFO_STARTTRANSFER_TIME_T, &result->starttransfer_time);
+
+    if (req->status == 206) {
+        CurlContentRange* range = curl_request_content_range(req);
+        if (range->present) {
+            result->content_length = range->complete_length;
+        }
+    } else {
+        curl_off_t length;
+        if (curl_easy_getinfo(req->easy_handle, CURLINFO_CONTENT_LENGTH_DOWNLOAD_T, &length) == CURLE_OK
+            && length >= 0) {
+            result->content_length = length;
+        }
+    }
+
+    char* content_type = curl_request_get_header(req, "Content-Type", ((int) req->header_index.num_hops) - 1);
+    if (content_type) {
+        unsigned length = strcspn(content_type, " \t;");
+        if (length) {
+            result->media_type = content_type;
+            result->media_type_length = length;
+        }
+    }
+}
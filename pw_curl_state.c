@@ -0,0 +1,373 @@
+/*
+ * Shared session state.
+ *
+ * CA bundle is loaded once per process and the parsed store
+ * is cached by libcurl where the TLS backend supports that.
+ *
+ * State persisted across process restarts:
+ *
+ *   <state_file>.tls        TLS session tickets, requires libcurl 8.12
+ *   <state_file>.hsts       HSTS cache
+ *   <state_file>.altsvc     Alt-Svc cache, see pw_curl_altsvc.c
+ *   <state_file>.redirects  redirect cache, see pw_curl_redirects.c
+ *
+ * TLS sessions and HSTS cache are kept in a share handle
+ * and saved when the session is deleted.
+ *
+ * libcurl does not share Alt-Svc cache between easy handles,
+ * so the session keeps its own and is the only writer of the file;
+ * requests load it read-only.
+ */
+
+#include <pthread.h>
+#include <stdio.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+static char* make_path(char* prefix, char* suffix)
+{
+    unsigned length = strlen(prefix) + strlen(suffix);
+    char* path = default_allocator.allocate(length + 1, false);
+    if (path) {
+        strcpy(path, prefix);
+        strcat(path, suffix);
+    }
+    return path;
+}
+
+static void release_path(char** path)
+{
+    if (*path) {
+        default_allocator.release((void**) path, strlen(*path) + 1);
+    }
+}
+
+#if LIBCURL_VERSION_NUM >= 0x080c00
+
+static bool write_blob(FILE* f, const void* data, size_t length)
+{
+    uint32_t n = length;
+    return fwrite(&n, sizeof(n), 1, f) == 1 && (length == 0 || fwrite(data, length, 1, f) == 1);
+}
+
+static unsigned char* read_blob(FILE* f, size_t* length)
+/*
+ * Read blob written by write_blob, append nul terminator for convenience.
+ * Return allocated buffer of length + 1 bytes, nullptr on EOF or error.
+ */
+{
+    uint32_t n;
+    if (fread(&n, sizeof(n), 1, f) != 1 || n > (1 << 20)) {
+        return nullptr;
+    }
+    unsigned char* data = default_allocator.allocate(n + 1, false);
+    if (!data) {
+        return nullptr;
+    }
+    if (n && fread(data, n, 1, f) != 1) {
+        default_allocator.release((void**) &data, n + 1);
+        return nullptr;
+    }
+    data[n] = 0;
+    *length = n;
+    return data;
+}
+
+static CURLcode export_tls_session(CURL* handle, void* userptr,
+                                   const char* session_key,
+                                   const unsigned char* shmac, size_t shmac_len,
+                                   const unsigned char* sdata, size_t sdata_len,
+                                   curl_off_t valid_until, int ietf_tls_id,
+                                   const char* alpn, size_t earlydata_max)
+{
+    FILE* f = userptr;
+    int64_t expires = valid_until;
+
+    if (!write_blob(f, session_key, session_key? strlen(session_key) : 0)
+        || !write_blob(f, shmac, shmac_len)
+        || !write_blob(f, sdata, sdata_len)
+        || fwrite(&expires, sizeof(expires), 1, f) != 1) {
+        return CURLE_WRITE_ERROR;
+    }
+    return CURLE_OK;
+}
+
+static void save_tls_sessions(CurlSession* session)
+{
+    char* path = make_path(session->options.state_file, ".tls");
+    if (!path) {
+        return;
+    }
+    FILE* f = fopen(path, "wb");
+    if (f) {
+        CURLcode err = curl_easy_ssls_export(session->state_handle, export_tls_session, f);
+        if (err) {
+            fprintf(stderr, "WARNING: cannot save TLS sessions to %s: %s\n", path, curl_easy_strerror(err));
+        }
+        fclose(f);
+    }
+    release_path(&path);
+}
+
+static void load_tls_sessions(CurlSession* session)
+{
+    char* path = make_path(session->options.state_file, ".tls");
+    if (!path) {
+        return;
+    }
+    FILE* f = fopen(path, "rb");
+    release_path(&path);
+    if (!f) {
+        return;
+    }
+    time_t now = time(nullptr);
+    for (;;) {
+        size_t key_len, shmac_len, sdata_len;
+        int64_t expires;
+        unsigned char* key   = read_blob(f, &key_len);
+        unsigned char* shmac = key?   read_blob(f, &shmac_len) : nullptr;
+        unsigned char* sdata = shmac? read_blob(f, &sdata_len) : nullptr;
+        bool ok = sdata && fread(&expires, sizeof(expires), 1, f) == 1;
+        if (ok && expires > now) {
+            curl_easy_ssls_import(session->state_handle,
+                                  key_len? (char*) key : nullptr,
+                                  shmac_len? shmac : nullptr, shmac_len,
+                                  sdata, sdata_len);
+        }
+        if (key)   { default_allocator.release((void**) &key,   key_len + 1); }
+        if (shmac) { default_allocator.release((void**) &shmac, shmac_len + 1); }
+        if (sdata) { default_allocator.release((void**) &sdata, sdata_len + 1); }
+        if (!ok) {
+            break;
+        }
+    }
+    fclose(f);
+}
+
+#else
+
+static void save_tls_sessions(CurlSession* session) {}
+static void load_tls_sessions(CurlSession* session) {}
+
+#endif
+
+bool curl_state_load(CurlSession* session)
+/*
+ * Create share handle and load saved state.
+ */
+{
+    session->share_handle = curl_share_init();
+    if (!session->share_handle) {
+        return false;
+    }
+    curl_share_setopt(session->share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_SSL_SESSION);
+#   if LIBCURL_VERSION_NUM >= 0x075800
+        curl_share_setopt(session->share_handle, CURLSHOPT_SHARE, CURL_LOCK_DATA_HSTS);
+#   endif
+
+    if (!session->options.state_file) {
+        return true;
+    }
+    session->hsts_file = make_path(session->options.state_file, ".hsts");
+    if (!session->hsts_file) {
+        return false;
+    }
+    char* altsvc_file = make_path(session->options.state_file, ".altsvc");
+    if (!altsvc_file) {
+        return false;
+    }
+    session->altsvc = curl_altsvc_create(altsvc_file);
+    release_path(&altsvc_file);
+
+    // this handle never performs transfers, it holds shared state
+    // for importing and exporting and saves HSTS cache when cleaned up
+    session->state_handle = curl_easy_init();
+    if (!session->state_handle) {
+        return false;
+    }
+    curl_easy_setopt(session->state_handle, CURLOPT_SHARE, session->share_handle);
+    curl_easy_setopt(session->state_handle, CURLOPT_HSTS_CTRL, (long) CURLHSTS_ENABLE);
+    curl_easy_setopt(session->state_handle, CURLOPT_HSTS, session->hsts_file);
+
+    load_tls_sessions(session);
+    return true;
+}
+
+void curl_state_apply(CurlSession* session, CurlRequestData* req)
+/*
+ * Attach request to the shared state.
+ */
+{
+    if (!session->share_handle) {
+        return;
+    }
+    curl_easy_setopt(req->easy_handle, CURLOPT_SHARE, session->share_handle);
+
+    if (!session->options.state_file) {
+        return;
+    }
+    curl_easy_setopt(req->easy_handle, CURLOPT_HSTS_CTRL, (long) CURLHSTS_ENABLE);
+    if (!session->hsts_loaded) {
+        // HSTS file is read when the transfer starts,
+        // it's enough to do that once for the shared cache
+        curl_easy_setopt(req->easy_handle, CURLOPT_HSTS, session->hsts_file);
+        session->hsts_loaded = true;
+    }
+}
+
+void curl_state_save(CurlSession* session)
+/*
+ * Save state and release share handle.
+ */
+{
+    if (session->altsvc) {
+        curl_altsvc_delete(session->altsvc);
+        session->altsvc = nullptr;
+    }
+    if (session->state_handle) {
+        save_tls_sessions(session);
+
+        // HSTS cache is written on cleanup
+        curl_easy_cleanup(session->state_handle);
+        session->state_handle = nullptr;
+    }
+    if (session->share_handle) {
+        CURLSHcode err = curl_share_cleanup(session->share_handle);
+        if (err) {
+            fprintf(stderr, "ERROR %s: %s\n", __func__, curl_share_strerror(err));
+        }
+        session->share_handle = nullptr;
+    }
+    release_path(&session->hsts_file);
+}
+
+/****************************************************************
+ * CA bundle
+ */
+
+typedef struct CaBundle {
+    struct CaBundle* next;
+    char* path;
+    struct curl_blob blob;
+} CaBundle;
+
+// loaded bundles are kept till process exit, easy handles refer to them without copying
+static CaBundle* ca_bundles = nullptr;
+static pthread_mutex_t ca_bundles_lock = PTHREAD_MUTEX_INITIALIZER;
+
+static CaBundle* load_ca_bundle(char* path)
+/*
+ * Return bundle loaded from path, read the file on first call.
+ */
+{
+    pthread_mutex_lock(&ca_bundles_lock);
+
+    CaBundle* bundle = ca_bundles;
+    while (bundle && strcmp(bundle->path, path) != 0) {
+        bundle = bundle->next;
+    }
+    if (bundle) {
+        goto out;
+    }
+    FILE* f = fopen(path, "rb");
+    if (!f) {
+        fprintf(stderr, "WARNING: cannot open CA bundle %s\n", path);
+        goto out;
+    }
+    fseek(f, 0, SEEK_END);
+    long size = ftell(f);
+    fseek(f, 0, SEEK_SET);
+
+    bundle = default_allocator.allocate(sizeof(CaBundle), true);
+    if (bundle) {
+        bundle->path = make_path(path, "");
+        bundle->blob.data = (size > 0)? default_allocator.allocate(size, false) : nullptr;
+        bundle->blob.len = size;
+        bundle->blob.flags = CURL_BLOB_NOCOPY;
+        if (!bundle->path || !bundle->blob.data || fread(bundle->blob.data, size, 1, f) != 1) {
+            fprintf(stderr, "WARNING: cannot read CA bundle %s\n", path);
+            release_path(&bundle->path);
+            if (bundle->blob.data) {
+                default_allocator.release(&bundle->blob.data, size);
+            }
+            default_allocator.release((void**) &bundle, sizeof(CaBundle));
+        } else {
+            bundle->next = ca_bundles;
+            ca_bundles = bundle;
+        }
+    }
+    fclose(f);
+
+out:
+    pthread_mutex_unlock(&ca_bundles_lock);
+    return bundle;
+}
+
+[[ gnu::destructor ]]
+static void release_ca_bundles()
+{
+    while (ca_bundles) {
+        CaBundle* bundle = ca_bundles;
+        ca_bundles = bundle->next;
+        default_allocator.release(&bundle->blob.data, bundle->blob.len);
+        release_path(&bundle->path);
+        default_allocator.release((void**) &bundle, sizeof(CaBundle));
+    }
+}
+
+static bool tls_backend_caches_ca()
+/*
+ * Check if TLS backend supports CURLOPT_CA_CACHE_TIMEOUT.
+ */
+{
+#   if LIBCURL_VERSION_NUM >= 0x075700
+        static char* backends[] = { "OpenSSL", "LibreSSL", "BoringSSL", "quictls", "AWS-LC", "wolfSSL", "Schannel" };
+
+        char* ssl_version = (char*) curl_version_info(CURLVERSION_NOW)->ssl_version;
+        if (!ssl_version) {
+            return false;
+        }
+        // multiple backends are listed as "(OpenSSL/3.0) GnuTLS/3.7", the first one is default
+        if (*ssl_version == '(') {
+            ssl_version++;
+        }
+        for (unsigned i = 0; i < PW_LENGTH(backends); i++) {
+            if (strncmp(ssl_version, backends[i], strlen(backends[i])) == 0) {
+                return true;
+            }
+        }
+#   endif
+    return false;
+}
+
+void curl_ca_init(CurlSession* session)
+/*
+ * Choose how to provide CA certificates to easy handles.
+ */
+{
+    if (!session->options.ca_file) {
+        session->options.ca_file = CURL_DEFAULT_CA_FILE;
+    }
+    if (session->options.ca_cache_timeout && tls_backend_caches_ca()) {
+        // libcurl parses the file once and keeps the store for ca_cache_timeout
+        session->ca_bundle = nullptr;
+    } else {
+        // at least avoid reading the file for each handle
+        session->ca_bundle = load_ca_bundle(session->options.ca_file);
+    }
+}
+
+void curl_ca_apply(CurlSession* session, CurlRequestData* req)
+{
+    if (session->ca_bundle) {
+        curl_easy_setopt(req->easy_handle, CURLOPT_CAINFO_BLOB, &session->ca_bundle->blob);
+    } else {
+        curl_easy_setopt(req->easy_handle, CURLOPT_CAINFO, session->options.ca_file);
+#       if LIBCURL_VERSION_NUM >= 0x075700
+            curl_easy_setopt(req->easy_handle, CURLOPT_CA_CACHE_TIMEOUT, session->options.ca_cache_timeout);
+#       endif
+    }
+}
@@ -0,0 +1,785 @@
+/*
+ * Text mode: incremental decoding of response body to Unicode.
+ *
+ * Charset is chosen when the first chunk arrives, in order of precedence:
+ *   - byte order mark
+ *   - charset parameter of Content-Type
+ *   - meta tag in the first chunk of HTML
+ *   - UTF-8
+ *
+ * Each chunk is decoded as it comes. Sequences split across chunks
+ * are kept in the decoder until the rest arrives.
+ * Malformed sequences are replaced with U+FFFD.
+ *
+ * Runs of valid UTF-8 and, for single-byte charsets, ASCII runs
+ * are found with vector instructions and appended in bulk.
+ * The rest is validated and appended char by char.
+ */
+
+#include <errno.h>
+#include <iconv.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+#include "pw_http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define HAVE_X86_SIMD
+#endif
+
+#define REPLACEMENT_CHAR  0xFFFD
+#define MAX_CHARSET_NAME  40
+#define META_SNIFF_LENGTH 1024
+
+static char32_t windows_1252_high[32] = {
+    0x20AC, 0x0081, 0x201A, 0x0192, 0x201E, 0x2026, 0x2020, 0x2021,
+    0x02C6, 0x2030, 0x0160, 0x2039, 0x0152, 0x008D, 0x017D, 0x008F,
+    0x0090, 0x2018, 0x2019, 0x201C, 0x201D, 0x2022, 0x2013, 0x2014,
+    0x02DC, 0x2122, 0x0161, 0x203A, 0x0153, 0x009D, 0x017E, 0x0178
+};
+
+/****************************************************************
+ * ASCII runs
+ */
+
+static unsigned char* skip_ascii_scalar(unsigned char* p, unsigned char* end)
+{
+    while (p < end && *p < 0x80) {
+        p++;
+    }
+    return p;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("sse2")))
+static unsigned char* skip_ascii_sse2(unsigned char* p, unsigned char* end)
+{
+    while (end - p >= 16) {
+        unsigned mask = _mm_movemask_epi8(_mm_loadu_si128((__m128i*) p));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 16;
+    }
+    return skip_ascii_scalar(p, end);
+}
+
+__attribute__((target("avx2")))
+static unsigned char* skip_ascii_avx2(unsigned char* p, unsigned char* end)
+{
+    while (end - p >= 32) {
+        uint32_t mask = _mm256_movemask_epi8(_mm256_loadu_si256((__m256i*) p));
+        if (mask) {
+            return p + __builtin_ctz(mask);
+        }
+        p += 32;
+    }
+    return skip_ascii_sse2(p, end);
+}
+
+#endif
+
+/****************************************************************
+ * UTF-8 runs
+ *
+ * Blocks are validated with three table lookups per byte,
+ * as described by Keiser and Lemire in "Validating UTF-8 in less
+ * than one instruction per byte". Each lookup gives a set of errors
+ * possible for the nibble, the error is real when all three agree:
+ *
+ *   - high nibble of the previous byte
+ *   - low nibble of the previous byte
+ *   - high nibble of the current byte
+ *
+ * Third and fourth bytes of sequences are checked separately
+ * against leading bytes two and three positions back.
+ *
+ * Validation stops at the first block with an error and the run ends
+ * before the sequence that crosses that block boundary,
+ * so the run always consists of complete valid chars.
+ * Scalar code finds the exact place and replaces malformed sequences.
+ */
+
+#ifdef HAVE_X86_SIMD
+
+#define TOO_SHORT   (1 << 0)  // lead byte not followed by continuation
+#define TOO_LONG    (1 << 1)  // continuation after ASCII
+#define OVERLONG_3  (1 << 2)
+#define TOO_LARGE   (1 << 3)  // above U+10FFFF
+#define SURROGATE   (1 << 4)
+#define OVERLONG_2  (1 << 5)
+#define TOO_LARGE_1000  (1 << 6)
+#define OVERLONG_4  (1 << 6)
+#define TWO_CONTS   (1 << 7)  // continuation after continuation
+#define CARRY       (TOO_SHORT | TOO_LONG | TWO_CONTS)
+
+#define BYTE_1_HIGH \
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+    TOO_LONG, TOO_LONG, TOO_LONG, TOO_LONG, \
+    TWO_CONTS, TWO_CONTS, TWO_CONTS, TWO_CONTS, \
+    TOO_SHORT | OVERLONG_2, \
+    TOO_SHORT, \
+    TOO_SHORT | OVERLONG_3 | SURROGATE, \
+    TOO_SHORT | TOO_LARGE | TOO_LARGE_1000 | OVERLONG_4
+
+#define BYTE_1_LOW \
+    CARRY | OVERLONG_3 | OVERLONG_2 | OVERLONG_4, \
+    CARRY | OVERLONG_2, \
+    CARRY, \
+    CARRY, \
+    CARRY | TOO_LARGE, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000 | SURROGATE, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000, \
+    CARRY | TOO_LARGE | TOO_LARGE_1000
+
+#define BYTE_2_HIGH \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE_1000 | OVERLONG_4, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | OVERLONG_3 | TOO_LARGE, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+    TOO_LONG | OVERLONG_2 | TWO_CONTS | SURROGATE | TOO_LARGE, \
+    TOO_SHORT, TOO_SHORT, TOO_SHORT, TOO_SHORT
+
+static unsigned char* run_end(unsigned char* p, unsigned char* q)
+/*
+ * Return the start of the char that crosses q, or q.
+ * Bytes from p to q are valid UTF-8 except, possibly, the incomplete tail.
+ */
+{
+    unsigned char* r = q;
+    for (unsigned i = 0; i < 3 && r > p && (r[-1] & 0xC0) == 0x80; i++) {
+        r--;
+    }
+    if (r > p && r[-1] >= 0xC0) {
+        return r - 1;
+    }
+    return q;
+}
+
+__attribute__((target("ssse3")))
+static unsigned char* skip_utf8_ssse3(unsigned char* p, unsigned char* end)
+{
+    __m128i byte_1_high = _mm_setr_epi8(BYTE_1_HIGH);
+    __m128i byte_1_low  = _mm_setr_epi8(BYTE_1_LOW);
+    __m128i byte_2_high = _mm_setr_epi8(BYTE_2_HIGH);
+    __m128i low_nibble  = _mm_set1_epi8(0x0F);
+    __m128i max_tail = _mm_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                     -1, -1, -1, -1, -1, 0xEF, 0xDF, 0xBF);
+    __m128i prev_input = _mm_setzero_si128();
+    __m128i prev_incomplete = _mm_setzero_si128();
+
+    unsigned char* q = p;
+    while (end - q >= 16) {
+        __m128i input = _mm_loadu_si128((__m128i*) q);
+        __m128i error;
+        if (_mm_movemask_epi8(input) == 0) {
+            // ASCII block, valid unless previous one ended with incomplete sequence
+            error = prev_incomplete;
+            prev_incomplete = _mm_setzero_si128();
+        } else {
+            __m128i prev1 = _mm_alignr_epi8(input, prev_input, 15);
+            __m128i special = _mm_and_si128(
+                _mm_and_si128(
+                    _mm_shuffle_epi8(byte_1_high, _mm_and_si128(_mm_srli_epi16(prev1, 4), low_nibble)),
+                    _mm_shuffle_epi8(byte_1_low, _mm_and_si128(prev1, low_nibble))
+                ),
+                _mm_shuffle_epi8(byte_2_high, _mm_and_si128(_mm_srli_epi16(input, 4), low_nibble))
+            );
+            __m128i prev2 = _mm_alignr_epi8(input, prev_input, 14);
+            __m128i prev3 = _mm_alignr_epi8(input, prev_input, 13);
+            __m128i must_be_cont = _mm_and_si128(
+                _mm_or_si128(_mm_subs_epu8(prev2, _mm_set1_epi8(0xE0 - 0x80)),
+                             _mm_subs_epu8(prev3, _mm_set1_epi8(0xF0 - 0x80))),
+                _mm_set1_epi8((char) 0x80)
+            );
+            error = _mm_xor_si128(must_be_cont, special);
+            prev_incomplete = _mm_subs_epu8(input, max_tail);
+        }
+        if (_mm_movemask_epi8(_mm_cmpeq_epi8(error, _mm_setzero_si128())) != 0xFFFF) {
+            return run_end(p, q);
+        }
+        prev_input = input;
+        q += 16;
+    }
+    unsigned char* r = run_end(p, q);
+    if (r != q) {
+        return r;
+    }
+    return skip_ascii_scalar(q, end);
+}
+
+__attribute__((target("avx2")))
+static unsigned char* skip_utf8_avx2(unsigned char* p, unsigned char* end)
+{
+    __m256i byte_1_high = _mm256_setr_epi8(BYTE_1_HIGH, BYTE_1_HIGH);
+    __m256i byte_1_low  = _mm256_setr_epi8(BYTE_1_LOW, BYTE_1_LOW);
+    __m256i byte_2_high = _mm256_setr_epi8(BYTE_2_HIGH, BYTE_2_HIGH);
+    __m256i low_nibble  = _mm256_set1_epi8(0x0F);
+    __m256i max_tail = _mm256_setr_epi8(-1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, -1, -1, -1,
+                                        -1, -1, -1, -1, -1, 0xEF, 0xDF, 0xBF);
+    __m256i prev_input = _mm256_setzero_si256();
+    __m256i prev_incomplete = _mm256_setzero_si256();
+
+    unsigned char* q = p;
+    while (end - q >= 32) {
+        __m256i input = _mm256_loadu_si256((__m256i*) q);
+        __m256i error;
+        if (_mm256_movemask_epi8(input) == 0) {
+            error = prev_incomplete;
+            prev_incomplete = _mm256_setzero_si256();
+        } else {
+            // upper half of previous block and lower half of this one
+            __m256i shifted = _mm256_permute2x128_si256(prev_input, input, 0x21);
+            __m256i prev1 = _mm256_alignr_epi8(input, shifted, 15);
+            __m256i special = _mm256_and_si256(
+                _mm256_and_si256(
+                    _mm256_shuffle_epi8(byte_1_high, _mm256_and_si256(_mm256_srli_epi16(prev1, 4), low_nibble)),
+                    _mm256_shuffle_epi8(byte_1_low, _mm256_and_si256(prev1, low_nibble))
+                ),
+                _mm256_shuffle_epi8(byte_2_high, _mm256_and_si256(_mm256_srli_epi16(input, 4), low_nibble))
+            );
+            __m256i prev2 = _mm256_alignr_epi8(input, shifted, 14);
+            __m256i prev3 = _mm256_alignr_epi8(input, shifted, 13);
+            __m256i must_be_cont = _mm256_and_si256(
+                _mm256_or_si256(_mm256_subs_epu8(prev2, _mm256_set1_epi8(0xE0 - 0x80)),
+                                _mm256_subs_epu8(prev3, _mm256_set1_epi8(0xF0 - 0x80))),
+                _mm256_set1_epi8((char) 0x80)
+            );
+            error = _mm256_xor_si256(must_be_cont, special);
+            prev_incomplete = _mm256_subs_epu8(input, max_tail);
+        }
+        if (!_mm256_testz_si256(error, error)) {
+            return run_end(p, q);
+        }
+        prev_input = input;
+        q += 32;
+    }
+    unsigned char* r = run_end(p, q);
+    if (r != q) {
+        return r;
+    }
+    return skip_utf8_ssse3(q, end);
+}
+
+#endif
+
+static unsigned char* (*skip_ascii)(unsigned char* p, unsigned char* end) = skip_ascii_scalar;
+
+// without vector instructions only ASCII runs are appended in bulk
+static unsigned char* (*skip_utf8)(unsigned char* p, unsigned char* end) = skip_ascii_scalar;
+
+[[ gnu::constructor ]]
+static void init()
+{
+#   ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            skip_ascii = skip_ascii_avx2;
+            skip_utf8 = skip_utf8_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            skip_ascii = skip_ascii_sse2;
+            skip_utf8 = skip_utf8_ssse3;
+        } else if (__builtin_cpu_supports("sse2")) {
+            skip_ascii = skip_ascii_sse2;
+        }
+#   endif
+}
+
+/****************************************************************
+ * Decoders
+ *
+ * Each decoder processes bytes from p to end and returns pointer
+ * to the incomplete sequence at the end, if any, or end.
+ * If final is set, incomplete sequence is replaced and end is returned.
+ * Return nullptr on error.
+ */
+
+static unsigned decode_utf8_char(unsigned char* p, unsigned char* end, char32_t* result)
+/*
+ * Decode one char, return number of bytes consumed or 0 if the sequence is incomplete.
+ * Malformed sequence is replaced by U+FFFD and its maximal valid prefix is consumed,
+ * as the Unicode standard recommends.
+ */
+{
+    unsigned char b = *p;
+    if (b < 0x80) {
+        *result = b;
+        return 1;
+    }
+    unsigned length;
+    char32_t c;
+    if (0xC2 <= b && b <= 0xDF) {
+        length = 2;
+        c = b & 0x1F;
+    } else if (0xE0 <= b && b <= 0xEF) {
+        length = 3;
+        c = b & 0x0F;
+    } else if (0xF0 <= b && b <= 0xF4) {
+        length = 4;
+        c = b & 0x07;
+    } else {
+        *result = REPLACEMENT_CHAR;
+        return 1;
+    }
+    for (unsigned i = 1; i < length; i++) {
+        if (p + i >= end) {
+            return 0;
+        }
+        // reject overlongs, surrogates, and code points above U+10FFFF
+        unsigned char lower = 0x80;
+        unsigned char upper = 0xBF;
+        if (i == 1) {
+            switch (b) {
+                case 0xE0: lower = 0xA0; break;
+                case 0xED: upper = 0x9F; break;
+                case 0xF0: lower = 0x90; break;
+                case 0xF4: upper = 0x8F; break;
+            }
+        }
+        unsigned char cont = p[i];
+        if (cont < lower || cont > upper) {
+            *result = REPLACEMENT_CHAR;
+            return i;
+        }
+        c = (c << 6) | (cont & 0x3F);
+    }
+    *result = c;
+    return length;
+}
+
+static unsigned char* decode_utf8(unsigned char* p, unsigned char* end, bool final, PwValuePtr result)
+{
+    while (p < end) {
+        unsigned char* valid_end = skip_utf8(p, end);
+        if (valid_end != p) {
+            if (!pw_string_append(result, (char*) p, (char*) valid_end)) {
+                return nullptr;
+            }
+            p = valid_end;
+            continue;
+        }
+        char32_t c;
+        unsigned n = decode_utf8_char(p, end, &c);
+        if (n == 0) {
+            if (!final) {
+                return p;
+            }
+            c = REPLACEMENT_CHAR;
+            n = end - p;
+        }
+        if (!pw_string_append(result, c)) {
+            return nullptr;
+        }
+        p += n;
+    }
+    return end;
+}
+
+static unsigned char* decode_windows_1252(unsigned char* p, unsigned char* end, PwValuePtr result)
+/*
+ * Single-byte charset, there are no incomplete sequences.
+ */
+{
+    while (p < end) {
+        unsigned char* ascii_end = skip_ascii(p, end);
+        if (ascii_end != p) {
+            if (!pw_string_append(result, (char*) p, (char*) ascii_end)) {
+                return nullptr;
+            }
+            p = ascii_end;
+            continue;
+        }
+        char32_t c = *p++;
+        if (c < 0xA0) {
+            c = windows_1252_high[c - 0x80];
+        }
+        if (!pw_string_append(result, c)) {
+            return nullptr;
+        }
+    }
+    return end;
+}
+
+static unsigned char* decode_utf16(unsigned char* p, unsigned char* end, bool big_endian, bool final, PwValuePtr result)
+{
+    while (p < end) {
+        if (end - p < 2) {
+            break;
+        }
+        char32_t c = big_endian? (p[0] << 8) | p[1] : (p[1] << 8) | p[0];
+        unsigned n = 2;
+        if (0xD800 <= c && c <= 0xDBFF) {
+            if (end - p < 4) {
+                break;
+            }
+            char32_t low = big_endian? (p[2] << 8) | p[3] : (p[3] << 8) | p[2];
+            if (0xDC00 <= low && low <= 0xDFFF) {
+                c = 0x10000 + ((c - 0xD800) << 10) + (low - 0xDC00);
+                n = 4;
+            } else {
+                c = REPLACEMENT_CHAR;
+            }
+        } else if (0xDC00 <= c && c <= 0xDFFF) {
+            c = REPLACEMENT_CHAR;
+        }
+        if (!pw_string_append(result, c)) {
+            return nullptr;
+        }
+        p += n;
+    }
+    if (p < end && final) {
+        if (!pw_string_append(result, (char32_t) REPLACEMENT_CHAR)) {
+            return nullptr;
+        }
+        return end;
+    }
+    return p;
+}
+
+static unsigned char* decode_iconv(iconv_t cd, unsigned char* p, unsigned char* end, bool final, PwValuePtr result)
+/*
+ * Convert to UTF-8 with iconv and decode that.
+ */
+{
+    char* in = (char*) p;
+    size_t in_left = end - p;
+    while (in_left) {
+        char buffer[1024];
+        char* out = buffer;
+        size_t out_left = sizeof(buffer);
+        size_t rc = iconv(cd, &in, &in_left, &out, &out_left);
+        int err = (rc == (size_t) -1)? errno : 0;
+
+        unsigned char* converted = (unsigned char*) buffer;
+        if (!decode_utf8(converted, (unsigned char*) out, true, result)) {
+            return nullptr;
+        }
+        if (err == EILSEQ || (err == EINVAL && (final || in_left >= CURL_TEXT_MAX_PENDING / 2))) {
+            if (!pw_string_append(result, (char32_t) REPLACEMENT_CHAR)) {
+                return nullptr;
+            }
+            in++;
+            in_left--;
+        } else if (err == EINVAL) {
+            // incomplete sequence at the end
+            return (unsigned char*) in;
+        } else if (err && err != E2BIG) {
+            return nullptr;
+        }
+    }
+    return end;
+}
+
+static unsigned char* decode_bytes(CurlTextDecoder* decoder, unsigned char* p, unsigned char* end, bool final, PwValuePtr result)
+{
+    switch (decoder->charset) {
+        case CURL_CHARSET_WINDOWS_1252: return decode_windows_1252(p, end, result);
+        case CURL_CHARSET_UTF16LE:      return decode_utf16(p, end, false, final, result);
+        case CURL_CHARSET_UTF16BE:      return decode_utf16(p, end, true, final, result);
+        case CURL_CHARSET_ICONV:        return decode_iconv((iconv_t) decoder->iconv, p, end, final, result);
+        default:                        return decode_utf8(p, end, final, result);
+    }
+}
+
+[[nodiscard]] bool curl_text_decode(CurlTextDecoder* decoder, char* data, size_t size, bool final, PwValuePtr result)
+{
+    unsigned char* p = (unsigned char*) data;
+    unsigned char* end = p + size;
+
+    if (decoder->num_pending) {
+        // complete the sequence left from previous chunk,
+        // decoders never leave more than half of the buffer incomplete
+        unsigned char buffer[CURL_TEXT_MAX_PENDING * 2];
+        unsigned num_pending = decoder->num_pending;
+        size_t take = sizeof(buffer) - num_pending;
+        if (take > size) {
+            take = size;
+        }
+        memcpy(buffer, decoder->pending, num_pending);
+        memcpy(buffer + num_pending, p, take);
+        decoder->num_pending = 0;
+
+        unsigned char* buffer_end = buffer + num_pending + take;
+        unsigned char* rest = decode_bytes(decoder, buffer, buffer_end, final && take == size, result);
+        if (!rest) {
+            return false;
+        }
+        if (rest < buffer + num_pending) {
+            // still incomplete, all new data went to the buffer
+            decoder->num_pending = buffer_end - rest;
+            memcpy(decoder->pending, rest, decoder->num_pending);
+            return true;
+        }
+        // decode the rest from the chunk, incomplete tail of the buffer included
+        p += rest - (buffer + num_pending);
+    }
+    if (p == end) {
+        return true;
+    }
+    unsigned char* rest = decode_bytes(decoder, p, end, final, result);
+    if (!rest) {
+        return false;
+    }
+    decoder->num_pending = end - rest;
+    memcpy(decoder->pending, rest, decoder->num_pending);
+    return true;
+}
+
+/****************************************************************
+ * Charset detection
+ */
+
+static unsigned sniff_bom(unsigned char* p, size_t size, CurlCharset* charset)
+/*
+ * Return length of byte order mark, 0 if there's none.
+ */
+{
+    if (size >= 3 && p[0] == 0xEF && p[1] == 0xBB && p[2] == 0xBF) {
+        *charset = CURL_CHARSET_UTF8;
+        return 3;
+    }
+    if (size >= 2 && p[0] == 0xFF && p[1] == 0xFE) {
+        *charset = CURL_CHARSET_UTF16LE;
+        return 2;
+    }
+    if (size >= 2 && p[0] == 0xFE && p[1] == 0xFF) {
+        *charset = CURL_CHARSET_UTF16BE;
+        return 2;
+    }
+    return 0;
+}
+
+static inline char lower_char(char c)
+{
+    return ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+}
+
+static char* find_nocase(char* p, char* end, char* pattern)
+/*
+ * Find lowercase pattern in p..end.
+ */
+{
+    unsigned length = strlen(pattern);
+    for (; p + length <= end; p++) {
+        unsigned i = 0;
+        while (i < length && lower_char(p[i]) == pattern[i]) {
+            i++;
+        }
+        if (i == length) {
+            return p;
+        }
+    }
+    return nullptr;
+}
+
+static unsigned sniff_meta(char* data, size_t size, char* charset_name)
+/*
+ * Look for charset in meta tags:
+ *
+ *   <meta charset="...">
+ *   <meta http-equiv="Content-Type" content="text/html; charset=...">
+ *
+ * This is a simplified version of prescan algorithm from HTML spec.
+ * Return length of lowercased charset name, 0 if not found.
+ */
+{
+    char* end = data + (size < META_SNIFF_LENGTH? size : META_SNIFF_LENGTH);
+    char* p = data;
+    while ((p = find_nocase(p, end, "<meta")) != nullptr) {
+        p += 5;
+        char* tag_end = memchr(p, '>', end - p);
+        if (!tag_end) {
+            return 0;
+        }
+        char* cs = find_nocase(p, tag_end, "charset");
+        if (cs) {
+            cs += 7;
+            while (cs < tag_end && (*cs == ' ' || *cs == '\t')) {
+                cs++;
+            }
+            if (cs < tag_end && *cs == '=') {
+                cs++;
+                while (cs < tag_end && (*cs == ' ' || *cs == '\t' || *cs == '"' || *cs == '\'')) {
+                    cs++;
+                }
+                unsigned length = 0;
+                while (cs + length < tag_end && length < MAX_CHARSET_NAME - 1
+                       && curl_char_is(cs[length], CURL_CC_CHARSETC) && cs[length] != '%') {
+                    charset_name[length] = lower_char(cs[length]);
+                    length++;
+                }
+                if (length) {
+                    charset_name[length] = 0;
+                    return length;
+                }
+            }
+        }
+        p = tag_end + 1;
+    }
+    return 0;
+}
+
+static void set_charset(CurlTextDecoder* decoder, char* name)
+/*
+ * Name must be lowercased.
+ * Labels of single-byte western charsets map to windows-1252, as in browsers.
+ */
+{
+    static char* utf8_labels[] = { "utf-8", "utf8", "unicode-1-1-utf-8" };
+    static char* windows_1252_labels[] = {
+        "windows-1252", "cp1252", "x-cp1252", "iso-8859-1", "iso8859-1", "iso_8859-1",
+        "latin1", "l1", "us-ascii", "ascii", "ansi_x3.4-1968"
+    };
+    for (unsigned i = 0; i < PW_LENGTH(utf8_labels); i++) {
+        if (strcmp(name, utf8_labels[i]) == 0) {
+            decoder->charset = CURL_CHARSET_UTF8;
+            return;
+        }
+    }
+    for (unsigned i = 0; i < PW_LENGTH(windows_1252_labels); i++) {
+        if (strcmp(name, windows_1252_labels[i]) == 0) {
+            decoder->charset = CURL_CHARSET_WINDOWS_1252;
+            return;
+        }
+    }
+    if (strcmp(name, "utf-16le") == 0 || strcmp(name, "utf-16") == 0) {
+        decoder->charset = CURL_CHARSET_UTF16LE;
+        return;
+    }
+    if (strcmp(name, "utf-16be") == 0) {
+        decoder->charset = CURL_CHARSET_UTF16BE;
+        return;
+    }
+    iconv_t cd = iconv_open("UTF-8", name);
+    if (cd == (iconv_t) -1) {
+        fprintf(stderr, "WARNING: unsupported charset %s, decoding as UTF-8\n", name);
+        decoder->charset = CURL_CHARSET_UTF8;
+        return;
+    }
+    decoder->iconv = cd;
+    decoder->charset = CURL_CHARSET_ICONV;
+}
+
+unsigned curl_text_start(CurlRequestData* req, char* data, size_t size)
+{
+    CurlTextDecoder* decoder = &req->text_decoder;
+
+    curl_text_fini(decoder);
+
+    unsigned bom_length = sniff_bom((unsigned char*) data, size, &decoder->charset);
+    if (bom_length) {
+        return bom_length;
+    }
+    char charset_name[MAX_CHARSET_NAME];
+    if (curl_request_get_charset(req, charset_name, sizeof(charset_name))) {
+        set_charset(decoder, charset_name);
+        return 0;
+    }
+    CurlAtom* subtype = curl_request_media_subtype_atom(req);
+    if (subtype == nullptr || subtype == &curl_atom_html) {
+        if (sniff_meta(data, size, charset_name)) {
+            set_charset(decoder, charset_name);
+            return 0;
+        }
+    }
+    decoder->charset = CURL_CHARSET_UTF8;
+    return 0;
+}
+
+/****************************************************************
+ * Percent-decoding
+ */
+
+[[nodiscard]] static bool flush_decoded(CurlTextDecoder* decoder, unsigned char* buffer, unsigned* length, PwValuePtr result)
+{
+    if (*length == 0) {
+        return true;
+    }
+    if (!curl_text_decode(decoder, (char*) buffer, *length, false, result)) {
+        return false;
+    }
+    *length = 0;
+    return true;
+}
+
+[[nodiscard]] bool curl_percent_decode(char* start, char* end, char* charset, PwValuePtr result)
+{
+    CurlTextDecoder decoder = {};
+    if (charset && *charset) {
+        set_charset(&decoder, charset);
+    }
+    bool ok = false;
+
+    // runs of plain chars are copied to the buffer, long ones are decoded in place
+    unsigned char buffer[256];
+    unsigned length = 0;
+
+    char* p = start;
+    while (p < end) {
+        char* percent = memchr(p, '%', end - p);
+        if (!percent) {
+            percent = end;
+        }
+        unsigned run_length = percent - p;
+        if (run_length) {
+            if (length + run_length <= sizeof(buffer)) {
+                memcpy(buffer + length, p, run_length);
+                length += run_length;
+            } else {
+                if (!flush_decoded(&decoder, buffer, &length, result)) {
+                    goto out;
+                }
+                if (!curl_text_decode(&decoder, p, run_length, false, result)) {
+                    goto out;
+                }
+            }
+            p = percent;
+        }
+        // decode consecutive escapes
+        while (p < end && *p == '%') {
+            if (length == sizeof(buffer)) {
+                if (!flush_decoded(&decoder, buffer, &length, result)) {
+                    goto out;
+                }
+            }
+            int high_nibble = (end - p > 2)? curl_hex_value[(unsigned char) p[1]] : -1;
+            int low_nibble  = (end - p > 2)? curl_hex_value[(unsigned char) p[2]] : -1;
+            if (high_nibble < 0 || low_nibble < 0) {
+                // not an escape, keep percent sign
+                buffer[length++] = '%';
+                p++;
+                break;
+            }
+            buffer[length++] = (high_nibble << 4) | low_nibble;
+            p += 3;
+        }
+    }
+    ok = flush_decoded(&decoder, buffer, &length, result)
+         && curl_text_decode(&decoder, nullptr, 0, true, result);
+out:
+    curl_text_fini(&decoder);
+    return ok;
+}
+
+void curl_text_fini(CurlTextDecoder* decoder)
+{
+    if (decoder->iconv) {
+        iconv_close((iconv_t) decoder->iconv);
+    }
+    *decoder = (CurlTextDecoder) {};
+}
@@ -0,0 +1,802 @@
+/*
+ * Crawl frontier.
+ *
+ * Pending URLs are kept in per-host FIFO queues, front-coded,
+ * see pw_url_queue.c. Hosts that may
+ * receive a request are kept in a min-heap ordered by the time
+ * when politeness delay expires, so taking the next URL is O(log hosts)
+ * regardless of how many URLs are queued.
+ *
+ * A host is in the heap when its queue is not empty and the number
+ * of its requests in flight is below the limit. Politeness delay
+ * is counted from the start of the previous request and from
+ * its completion, whichever is later.
+ *
+ * Hosts are identified by origin taken from the canonical URL.
+ * The same canonical form is hashed for the seen set, so URLs that
+ * differ only in case, escapes, default port, dot segments, query order,
+ * or fragment are queued once. The seen set is either exact set
+ * of fingerprints, or Bloom filter for large crawls, see pw_bloom.c
+ *
+ * The seen set covers this run only. URLs fetched across runs are kept
+ * in a separate file-backed done filter, which is updated when requests
+ * are reported as fetched, so URLs that were queued but not fetched
+ * are tried again by the next run.
+ *
+ * In burst mode a ready host gives several URLs in a row, so their
+ * requests go together onto one HTTP/2 connection. The host stays
+ * on top of the heap until the burst ends, then politeness delay
+ * puts it behind other ready hosts, which interleaves bursts.
+ *
+ * If robots.txt is obeyed, the URL at the head of host queue is checked
+ * when the host is ready. Until robots.txt arrives the host is removed
+ * from the heap, and it's put back by the callback from pw_robots.c
+ */
+
+#include <stdio.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+#define STACK_BUFFER_SIZE  2048
+
+typedef struct FrontierHost FrontierHost;
+
+struct FrontierHost {
+    CurlUrlQueue queue;       // pending URLs, tagged with depth
+
+    unsigned in_flight;
+    uint64_t ready_time;      // usec, see curl_now_usec
+    uint64_t delay;           // usec
+    unsigned heap_index;      // NOT_IN_HEAP if the host is not in the heap
+
+    bool dispatched;          // at least one request was made
+    bool dns_prefetched;
+    bool robots_waiting;      // removed from the heap until robots.txt arrives
+    unsigned burst_left;      // URLs the host may give without delay, 0 if not in burst
+    FrontierHost* next_prefetch;
+};
+
+#define NOT_IN_HEAP  ((unsigned) -1)
+
+typedef struct {
+    /*
+     * Open addressing set of fingerprints, all-zero fingerprint denotes empty slot.
+     */
+    CurlFingerprint* slots;
+    unsigned capacity;  // power of two
+    unsigned count;
+} FingerprintSet;
+
+typedef struct {
+    CurlFrontierOptions options;
+    CurlSession* session;
+
+    CurlHashTable hosts;        // origin -> FrontierHost
+    CurlHashTable scope_hosts;  // host names of seed URLs, values are unused
+
+    FrontierHost** heap;
+    unsigned heap_capacity;
+    unsigned heap_length;
+
+    FingerprintSet seen;
+    CurlBloom seen_filter;      // used instead of seen set if seen_capacity is set
+    bool use_filter;
+    CurlBloom done_filter;      // URLs fetched by this and previous runs, if seen_file is set
+    bool use_done_filter;
+
+    // hosts waiting for DNS prefetch, in order of appearance
+    FrontierHost* prefetch_head;
+    FrontierHost* prefetch_tail;
+    unsigned num_prefetched;    // prefetched hosts that were not dispatched yet
+
+    void* robots;               // robots.txt cache, nullptr if not obeyed
+    unsigned num_robots_waiting;
+
+    CurlFrontierStats stats;
+} CurlFrontier;
+
+/****************************************************************
+ * Seen set
+ */
+
+[[nodiscard]] static bool seen_init(FingerprintSet* set, unsigned capacity)
+{
+    set->slots = default_allocator.allocate(capacity * sizeof(CurlFingerprint), true);
+    if (!set->slots) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    set->capacity = capacity;
+    set->count = 0;
+    return true;
+}
+
+static void seen_fini(FingerprintSet* set)
+{
+    if (set->slots) {
+        default_allocator.release((void**) &set->slots, set->capacity * sizeof(CurlFingerprint));
+    }
+}
+
+static CurlFingerprint* seen_lookup(FingerprintSet* set, CurlFingerprint* fp)
+/*
+ * Return matching slot or empty slot where the fingerprint should be inserted.
+ */
+{
+    unsigned mask = set->capacity - 1;
+    for (unsigned i = fp->hi & mask;; i = (i + 1) & mask) {
+        CurlFingerprint* slot = &set->slots[i];
+        if ((slot->lo == 0 && slot->hi == 0) || curl_fingerprint_equal(slot, fp)) {
+            return slot;
+        }
+    }
+}
+
+[[nodiscard]] static bool seen_add(FingerprintSet* set, CurlFingerprint fp, bool* added)
+/*
+ * Add fingerprint to the set, set `added` to false if it is already there.
+ */
+{
+    if (fp.lo == 0 && fp.hi == 0) {
+        fp.lo = 1;
+    }
+    if (set->count * 2 >= set->capacity) {
+        FingerprintSet new_set;
+        if (!seen_init(&new_set, set->capacity * 2)) {
+            return false;
+        }
+        for (unsigned i = 0; i < set->capacity; i++) {
+            CurlFingerprint* slot = &set->slots[i];
+            if (slot->lo || slot->hi) {
+                *seen_lookup(&new_set, slot) = *slot;
+            }
+        }
+        new_set.count = set->count;
+        seen_fini(set);
+        *set = new_set;
+    }
+    CurlFingerprint* slot = seen_lookup(set, &fp);
+    *added = (slot->lo == 0 && slot->hi == 0);
+    if (*added) {
+        *slot = fp;
+        set->count++;
+    }
+    return true;
+}
+
+/****************************************************************
+ * Ready-time heap
+ */
+
+static void heap_place(CurlFrontier* frontier, FrontierHost* host, unsigned i)
+{
+    frontier->heap[i] = host;
+    host->heap_index = i;
+}
+
+static void heap_sift_up(CurlFrontier* frontier, unsigned i)
+{
+    FrontierHost* host = frontier->heap[i];
+    while (i > 0) {
+        unsigned parent = (i - 1) / 2;
+        if (frontier->heap[parent]->ready_time <= host->ready_time) {
+            break;
+        }
+        heap_place(frontier, frontier->heap[parent], i);
+        i = parent;
+    }
+    heap_place(frontier, host, i);
+}
+
+static void heap_sift_down(CurlFrontier* frontier, unsigned i)
+{
+    FrontierHost* host = frontier->heap[i];
+    for (;;) {
+        unsigned child = 2 * i + 1;
+        if (child >= frontier->heap_length) {
+            break;
+        }
+        if (child + 1 < frontier->heap_length
+            && frontier->heap[child + 1]->ready_time < frontier->heap[child]->ready_time) {
+            child++;
+        }
+        if (host->ready_time <= frontier->heap[child]->ready_time) {
+            break;
+        }
+        heap_place(frontier, frontier->heap[child], i);
+        i = child;
+    }
+    heap_place(frontier, host, i);
+}
+
+[[nodiscard]] static bool heap_push(CurlFrontier* frontier, FrontierHost* host)
+{
+    if (frontier->heap_length == frontier->heap_capacity) {
+        unsigned new_capacity = frontier->heap_capacity? frontier->heap_capacity * 2 : 64;
+        FrontierHost** new_heap = default_allocator.allocate(new_capacity * sizeof(FrontierHost*), false);
+        if (!new_heap) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            return false;
+        }
+        if (frontier->heap) {
+            memcpy(new_heap, frontier->heap, frontier->heap_length * sizeof(FrontierHost*));
+            default_allocator.release((void**) &frontier->heap, frontier->heap_capacity * sizeof(FrontierHost*));
+        }
+        frontier->heap = new_heap;
+        frontier->heap_capacity = new_capacity;
+    }
+    frontier->heap[frontier->heap_length++] = host;
+    heap_sift_up(frontier, frontier->heap_length - 1);
+    return true;
+}
+
+static void heap_pop(CurlFrontier* frontier)
+{
+    FrontierHost* host = frontier->heap[0];
+    host->heap_index = NOT_IN_HEAP;
+    frontier->heap_length--;
+    if (frontier->heap_length) {
+        heap_place(frontier, frontier->heap[frontier->heap_length], 0);
+        heap_sift_down(frontier, 0);
+    }
+}
+
+[[nodiscard]] static bool schedule_host(CurlFrontier* frontier, FrontierHost* host)
+/*
+ * Put host to the heap if it is eligible and is not there yet.
+ */
+{
+    if (host->heap_index != NOT_IN_HEAP || host->robots_waiting) {
+        return true;
+    }
+    if (host->queue.length == 0 || host->in_flight >= frontier->options.max_per_host) {
+        return true;
+    }
+    return heap_push(frontier, host);
+}
+
+/****************************************************************
+ * Hosts
+ */
+
+static void release_host(void* value)
+{
+    FrontierHost* host = value;
+    curl_url_queue_fini(&host->queue);
+    default_allocator.release((void**) &host, sizeof(FrontierHost));
+}
+
+static void prefetch_dns(CurlFrontier* frontier)
+/*
+ * Start resolving hosts that appeared recently, keeping
+ * no more than dns_prefetch_window of them ahead of requests.
+ */
+{
+    if (!frontier->session || !frontier->session->dns) {
+        return;
+    }
+    while (frontier->prefetch_head && frontier->num_prefetched < frontier->options.dns_prefetch_window) {
+        FrontierHost* host = frontier->prefetch_head;
+        frontier->prefetch_head = host->next_prefetch;
+        if (!frontier->prefetch_head) {
+            frontier->prefetch_tail = nullptr;
+        }
+        host->next_prefetch = nullptr;
+        unsigned length, depth;
+        char* url = curl_url_queue_peek(&host->queue, &length, &depth);
+        if (host->dispatched || !url) {
+            continue;
+        }
+        curl_dns_prefetch(frontier->session->dns, url);
+        host->dns_prefetched = true;
+        frontier->num_prefetched++;
+    }
+}
+
+/****************************************************************
+ * URL parts
+ */
+
+typedef struct {
+    char* canonical;
+    unsigned canonical_length;
+    unsigned origin_length;  // scheme and authority
+    char* host;              // host name within canonical URL
+    unsigned host_length;
+} CanonicalUrl;
+
+static bool split_canonical(CanonicalUrl* cu)
+/*
+ * Find origin and host name in canonical URL.
+ * Return false for URLs without authority and for schemes other than HTTP(S).
+ */
+{
+    char* p = cu->canonical;
+    char* end = p + cu->canonical_length;
+    char* authority;
+    if (cu->canonical_length > 7 && memcmp(p, "http://", 7) == 0) {
+        authority = p + 7;
+    } else if (cu->canonical_length > 8 && memcmp(p, "https://", 8) == 0) {
+        authority = p + 8;
+    } else {
+        return false;
+    }
+    // canonical URL always has path
+    char* authority_end = memchr(authority, '/', end - authority);
+    if (!authority_end) {
+        return false;
+    }
+    cu->origin_length = authority_end - p;
+
+    char* host = authority;
+    for (char* s = authority; s < authority_end; s++) {
+        if (*s == '@') {
+            host = s + 1;
+        }
+    }
+    char* host_end = authority_end;
+    if (*host != '[') {
+        char* colon = memchr(host, ':', authority_end - host);
+        if (colon) {
+            host_end = colon;
+        }
+    }
+    cu->host = host;
+    cu->host_length = host_end - host;
+    return cu->host_length != 0;
+}
+
+static bool in_scope(CurlFrontier* frontier, char* host, unsigned host_length)
+{
+    switch (frontier->options.scope) {
+        case CURL_SCOPE_ANY:
+            return true;
+
+        case CURL_SCOPE_HOST:
+            return curl_hash_get(&frontier->scope_hosts, host, host_length) != nullptr;
+
+        case CURL_SCOPE_DOMAIN:
+            // match host and its parent domains
+            for (;;) {
+                if (curl_hash_get(&frontier->scope_hosts, host, host_length)) {
+                    return true;
+                }
+                char* dot = memchr(host, '.', host_length);
+                if (!dot) {
+                    return false;
+                }
+                host_length -= dot + 1 - host;
+                host = dot + 1;
+            }
+    }
+    return false;
+}
+
+/****************************************************************
+ * robots.txt
+ */
+
+static void robots_ready(void* arg, char* origin, unsigned origin_length)
+{
+    CurlFrontier* frontier = arg;
+    FrontierHost* host = curl_hash_get(&frontier->hosts, origin, origin_length);
+    if (host && host->robots_waiting) {
+        host->robots_waiting = false;
+        frontier->num_robots_waiting--;
+        if (!schedule_host(frontier, host)) {
+            fprintf(stderr, "WARNING: %s: cannot schedule host %.*s\n", __func__, (int) origin_length, origin);
+        }
+    }
+}
+
+static CurlRobotsVerdict check_robots(CurlFrontier* frontier, FrontierHost* host)
+/*
+ * Check URL at the head of host queue and update host delay
+ * with Crawl-delay if the URL is allowed, or ready time
+ * with robots.txt retry time if the host is unreachable.
+ */
+{
+    unsigned length, depth;
+    char* url = curl_url_queue_peek(&host->queue, &length, &depth);
+    if (!url) {
+        return CURL_ROBOTS_ALLOWED;
+    }
+
+    // robots.txt rules apply to the path as requested, don't sort query
+    unsigned size = length * 3 + 2;
+    char stack_buffer[STACK_BUFFER_SIZE];
+    CanonicalUrl cu = { .canonical = stack_buffer };
+    if (size > sizeof(stack_buffer)) {
+        cu.canonical = default_allocator.allocate(size, false);
+        if (!cu.canonical) {
+            return CURL_ROBOTS_ALLOWED;
+        }
+    }
+    CurlRobotsVerdict verdict = CURL_ROBOTS_ALLOWED;
+    cu.canonical_length = curl_url_canonicalize_cstr(url, length, CURL_CANON_KEEP_QUERY_ORDER,
+                                                     cu.canonical, size);
+    if (cu.canonical_length && split_canonical(&cu)) {
+        verdict = curl_robots_check(frontier->robots, cu.canonical, cu.origin_length,
+                                    cu.canonical + cu.origin_length, cu.canonical_length - cu.origin_length);
+        if (verdict == CURL_ROBOTS_ALLOWED) {
+            uint64_t delay = curl_robots_crawl_delay(frontier->robots, cu.canonical, cu.origin_length) * 1000ULL;
+            uint64_t politeness_delay = frontier->options.politeness_delay * 1000ULL;
+            host->delay = (delay > politeness_delay)? delay : politeness_delay;
+        } else if (verdict == CURL_ROBOTS_UNREACHABLE) {
+            // always in the future, expired rules are refetched by curl_robots_check
+            host->ready_time = curl_robots_retry_time(frontier->robots, cu.canonical, cu.origin_length);
+        }
+    }
+    if (cu.canonical != stack_buffer) {
+        default_allocator.release((void**) &cu.canonical, size);
+    }
+    return verdict;
+}
+
+/****************************************************************
+ * Public API
+ */
+
+void* create_curl_frontier(void* session, CurlFrontierOptions* options)
+{
+    static CurlFrontierOptions default_options = CURL_FRONTIER_DEFAULT_OPTIONS;
+
+    CurlFrontier* frontier = default_allocator.allocate(sizeof(CurlFrontier), true);
+    if (!frontier) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return nullptr;
+    }
+    frontier->options = options? *options : default_options;
+    if (frontier->options.max_per_host == 0) {
+        frontier->options.max_per_host = 1;
+    }
+    frontier->session = (CurlSession*) session;
+
+    if (!curl_hash_init(&frontier->hosts, 64)
+        || !curl_hash_init(&frontier->scope_hosts, 16)
+        || !seen_init(&frontier->seen, 1024)) {
+
+        delete_curl_frontier(frontier);
+        return nullptr;
+    }
+    if (frontier->options.seen_capacity) {
+        double fp_rate = frontier->options.seen_fp_rate? frontier->options.seen_fp_rate : 0.001;
+        if (!curl_bloom_create(&frontier->seen_filter, frontier->options.seen_capacity, fp_rate)) {
+            delete_curl_frontier(frontier);
+            return nullptr;
+        }
+        frontier->use_filter = true;
+
+        if (frontier->options.seen_file) {
+            if (!curl_bloom_open(&frontier->done_filter, frontier->options.seen_file,
+                                 frontier->options.seen_capacity, fp_rate)) {
+                delete_curl_frontier(frontier);
+                return nullptr;
+            }
+            frontier->use_done_filter = true;
+        }
+    }
+    // the file name is not needed anymore and may not outlive options
+    frontier->options.seen_file = nullptr;
+
+    if (frontier->options.robots_agent) {
+        frontier->robots = create_curl_robots(session, frontier->options.robots_agent, frontier->options.robots_ttl);
+        if (!frontier->robots) {
+            delete_curl_frontier(frontier);
+            return nullptr;
+        }
+        curl_robots_set_callback(frontier->robots, robots_ready, frontier);
+        frontier->options.robots_agent = nullptr;
+    }
+    return (void*) frontier;
+}
+
+void delete_curl_frontier(void* frontier)
+{
+    CurlFrontier* f = (CurlFrontier*) frontier;
+
+    curl_hash_fini(&f->hosts, release_host);
+    curl_hash_fini(&f->scope_hosts, nullptr);
+    seen_fini(&f->seen);
+    curl_bloom_close(&f->seen_filter);
+    curl_bloom_close(&f->done_filter);
+    if (f->robots) {
+        delete_curl_robots(f->robots);
+    }
+    if (f->heap) {
+        default_allocator.release((void**) &f->heap, f->heap_capacity * sizeof(FrontierHost*));
+    }
+    default_allocator.release((void**) &f, sizeof(CurlFrontier));
+}
+
+[[nodiscard]] static bool add_url(CurlFrontier* frontier, char* url, unsigned length, unsigned depth, bool seed)
+{
+    if (depth > frontier->options.max_depth) {
+        frontier->stats.too_deep++;
+        return true;
+    }
+
+    unsigned size = length * 3 + 2;
+    char stack_buffer[STACK_BUFFER_SIZE];
+    CanonicalUrl cu = { .canonical = stack_buffer };
+    if (size > sizeof(stack_buffer)) {
+        cu.canonical = default_allocator.allocate(size, false);
+        if (!cu.canonical) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            return false;
+        }
+    }
+    bool ret = true;
+    cu.canonical_length = curl_url_canonicalize_cstr(url, length, frontier->options.canon_flags, cu.canonical, size);
+    if (cu.canonical_length == 0 || !split_canonical(&cu)) {
+        frontier->stats.malformed++;
+        goto out;
+    }
+    if (seed) {
+        char* host = cu.host;
+        unsigned host_length = cu.host_length;
+        if (frontier->options.scope == CURL_SCOPE_DOMAIN && host_length > 4 && memcmp(host, "www.", 4) == 0) {
+            host += 4;
+            host_length -= 4;
+        }
+        if (!curl_hash_get(&frontier->scope_hosts, host, host_length)) {
+            if (!curl_hash_put(&frontier->scope_hosts, host, host_length, (void*) frontier)) {
+                ret = false;
+                goto out;
+            }
+        }
+    } else if (!in_scope(frontier, cu.host, cu.host_length)) {
+        frontier->stats.out_of_scope++;
+        goto out;
+    }
+
+    bool added;
+    CurlFingerprint fp = curl_hash128(cu.canonical, cu.canonical_length, 0);
+    if (frontier->use_done_filter && curl_bloom_contains(&frontier->done_filter, &fp)) {
+        frontier->stats.done_before++;
+        goto out;
+    }
+    if (frontier->use_filter) {
+        added = curl_bloom_add(&frontier->seen_filter, &fp);
+    } else if (!seen_add(&frontier->seen, fp, &added)) {
+        ret = false;
+        goto out;
+    }
+    if (!added) {
+        frontier->stats.duplicates++;
+        goto out;
+    }
+
+    FrontierHost* host = curl_hash_get(&frontier->hosts, cu.canonical, cu.origin_length);
+    if (!host) {
+        host = default_allocator.allocate(sizeof(FrontierHost), true);
+        if (!host) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            ret = false;
+            goto out;
+        }
+        host->heap_index = NOT_IN_HEAP;
+        host->delay = frontier->options.politeness_delay * 1000ULL;
+        if (!curl_hash_put(&frontier->hosts, cu.canonical, cu.origin_length, host)) {
+            release_host(host);
+            ret = false;
+            goto out;
+        }
+        if (frontier->prefetch_tail) {
+            frontier->prefetch_tail->next_prefetch = host;
+        } else {
+            frontier->prefetch_head = host;
+        }
+        frontier->prefetch_tail = host;
+        frontier->stats.hosts++;
+    }
+    if (!curl_url_queue_push(&host->queue, url, length, depth)) {
+        ret = false;
+        goto out;
+    }
+    frontier->stats.queued++;
+    if (!schedule_host(frontier, host)) {
+        ret = false;
+        goto out;
+    }
+    prefetch_dns(frontier);
+
+out:
+    if (cu.canonical != stack_buffer) {
+        default_allocator.release((void**) &cu.canonical, size);
+    }
+    return ret;
+}
+
+[[nodiscard]] bool curl_frontier_add_seed(void* frontier, PwValuePtr url)
+{
+    PW_CSTRING_LOCAL(url_cstr, url);
+    return add_url((CurlFrontier*) frontier, url_cstr, strlen(url_cstr), 0, true);
+}
+
+[[nodiscard]] bool curl_frontier_add(void* frontier, PwValuePtr url, unsigned depth)
+{
+    PW_CSTRING_LOCAL(url_cstr, url);
+    return add_url((CurlFrontier*) frontier, url_cstr, strlen(url_cstr), depth, false);
+}
+
+[[nodiscard]] bool curl_frontier_add_cstr(void* frontier, char* url, unsigned length, unsigned depth)
+{
+    return add_url((CurlFrontier*) frontier, url, length, depth, false);
+}
+
+[[nodiscard]] bool curl_frontier_next(void* frontier, PwValuePtr url, unsigned* depth)
+{
+    CurlFrontier* f = (CurlFrontier*) frontier;
+
+    pw_destroy(url);
+    uint64_t now = curl_now_usec();
+    FrontierHost* host;
+    for (;;) {
+        if (f->heap_length == 0) {
+            return true;
+        }
+        host = f->heap[0];
+        if (host->ready_time > now) {
+            return true;
+        }
+        if (!f->robots) {
+            break;
+        }
+        CurlRobotsVerdict verdict = check_robots(f, host);
+        if (verdict == CURL_ROBOTS_ALLOWED) {
+            break;
+        }
+        if (verdict == CURL_ROBOTS_PENDING) {
+            heap_pop(f);
+            host->burst_left = 0;
+            host->robots_waiting = true;
+            f->num_robots_waiting++;
+            continue;
+        }
+        if (verdict == CURL_ROBOTS_UNREACHABLE) {
+            // keep URLs until robots.txt is fetched again
+            host->burst_left = 0;
+            heap_sift_down(f, 0);
+            continue;
+        }
+        // disallowed, drop the URL and try the next one
+        unsigned length, entry_depth;
+        curl_url_queue_pop(&host->queue, &length, &entry_depth);
+        f->stats.queued--;
+        f->stats.disallowed++;
+        if (host->queue.length == 0) {
+            curl_url_queue_fini(&host->queue);
+            heap_pop(f);
+            host->burst_left = 0;
+            if (host->dns_prefetched && !host->dispatched) {
+                // free prefetch slot of the host that was never dispatched
+                host->dns_prefetched = false;
+                f->num_prefetched--;
+                prefetch_dns(f);
+            }
+        }
+    }
+
+    unsigned length, entry_depth;
+    char* entry_url = curl_url_queue_pop(&host->queue, &length, &entry_depth);
+    if (!entry_url) {
+        return false;
+    }
+    bool ret = pw_create_string(entry_url, url);
+    if (depth) {
+        *depth = entry_depth;
+    }
+    if (host->queue.length == 0) {
+        // release the last decoded URL too
+        curl_url_queue_fini(&host->queue);
+    }
+
+    host->in_flight++;
+    if (f->options.burst > 1) {
+        if (host->burst_left == 0) {
+            host->burst_left = f->options.burst;
+            f->stats.bursts++;
+        }
+        host->burst_left--;
+        if (host->queue.length == 0 || host->in_flight >= f->options.max_per_host) {
+            host->burst_left = 0;
+        }
+    }
+    if (host->burst_left == 0) {
+        heap_pop(f);
+        host->ready_time = now + host->delay;
+    }
+    if (!host->dispatched) {
+        host->dispatched = true;
+        if (host->dns_prefetched) {
+            f->num_prefetched--;
+        }
+    }
+    f->stats.queued--;
+    f->stats.dispatched++;
+
+    if (!schedule_host(f, host)) {
+        return false;
+    }
+    prefetch_dns(f);
+    return ret;
+}
+
+void curl_frontier_done(void* frontier, PwValuePtr url, bool fetched)
+{
+    CurlFrontier* f = (CurlFrontier*) frontier;
+
+    PW_CSTRING_LOCAL(url_cstr, url);
+    unsigned length = strlen(url_cstr);
+
+    unsigned size = length * 3 + 2;
+    char stack_buffer[STACK_BUFFER_SIZE];
+    CanonicalUrl cu = { .canonical = stack_buffer };
+    if (size > sizeof(stack_buffer)) {
+        cu.canonical = default_allocator.allocate(size, false);
+        if (!cu.canonical) {
+            return;
+        }
+    }
+    cu.canonical_length = curl_url_canonicalize_cstr(url_cstr, length, f->options.canon_flags, cu.canonical, size);
+    if (cu.canonical_length && split_canonical(&cu)) {
+        if (fetched && f->use_done_filter) {
+            CurlFingerprint fp = curl_hash128(cu.canonical, cu.canonical_length, 0);
+            curl_bloom_add(&f->done_filter, &fp);
+        }
+        FrontierHost* host = curl_hash_get(&f->hosts, cu.canonical, cu.origin_length);
+        if (host && host->in_flight) {
+            host->in_flight--;
+            f->stats.completed++;
+
+            uint64_t ready_time = curl_now_usec() + host->delay;
+            if (ready_time > host->ready_time && host->burst_left == 0) {
+                host->ready_time = ready_time;
+                if (host->heap_index != NOT_IN_HEAP) {
+                    heap_sift_down(f, host->heap_index);
+                }
+            }
+            if (!schedule_host(f, host)) {
+                fprintf(stderr, "WARNING: %s: cannot schedule host %s\n", __func__, url_cstr);
+            }
+        }
+    }
+    if (cu.canonical != stack_buffer) {
+        default_allocator.release((void**) &cu.canonical, size);
+    }
+}
+
+uint64_t curl_frontier_wait_time(void* frontier)
+{
+    CurlFrontier* f = (CurlFrontier*) frontier;
+
+    if (f->heap_length == 0) {
+        // hosts waiting for robots.txt return when its request completes
+        return f->num_robots_waiting? 0 : UINT64_MAX;
+    }
+    uint64_t now = curl_now_usec();
+    uint64_t ready_time = f->heap[0]->ready_time;
+    return (ready_time > now)? ready_time - now : 0;
+}
+
+void curl_frontier_stats(void* frontier, CurlFrontierStats* stats)
+{
+    CurlFrontier* f = (CurlFrontier*) frontier;
+
+    *stats = f->stats;
+    if (f->use_filter) {
+        stats->seen = curl_bloom_count(&f->seen_filter);
+        stats->seen_fp_rate = curl_bloom_measure_fp_rate(&f->seen_filter, 10000);
+    } else {
+        stats->seen = f->seen.count;
+    }
+}
+
+uint64_t curl_frontier_queued(void* frontier)
+{
+    return ((CurlFrontier*) frontier)->stats.queued;
+}
@@ -0,0 +1,691 @@
+/*
+ * Streaming HTML link extractor.
+ *
+ * This is a subset of HTML tokenizer that keeps its state between chunks,
+ * so content is scanned as it arrives and never buffered as a whole.
+ * Text is skipped with memchr, only tags are examined char by char.
+ * Comments, and contents of script, style, title, and textarea elements
+ * are skipped too, because they may contain anything that looks like a tag.
+ *
+ * Extracted references are resolved in batches, once per chunk,
+ * with URL resolver bound to the document URL or to the first <base href>.
+ * References that precede <base> are resolved against the document URL,
+ * which differs from browsers but does not require look-ahead.
+ *
+ * Attribute values longer than CURL_LINK_MAX_LENGTH, such as data: URLs,
+ * are dropped without buffering them.
+ *
+ * Content is treated as ASCII-compatible bytes, UTF-16 pages yield nothing.
+ */
+
+#include <string.h>
+#include <strings.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+#include "pw_http_scan.h"
+
+enum {
+    STATE_DATA = 0,
+    STATE_TAG_OPEN,         // after '<'
+    STATE_END_TAG,          // skipping to '>'
+    STATE_MARKUP,           // after "<!"
+    STATE_MARKUP_DASH,      // after "<!-"
+    STATE_COMMENT,          // after "<!--"
+    STATE_TAG_NAME,
+    STATE_BEFORE_ATTR_NAME,
+    STATE_ATTR_NAME,
+    STATE_AFTER_ATTR_NAME,
+    STATE_BEFORE_ATTR_VALUE,
+    STATE_ATTR_VALUE_QUOTED,
+    STATE_ATTR_VALUE_UNQUOTED,
+    STATE_RAWTEXT,          // inside script, style, etc.
+    STATE_RAWTEXT_END_TAG   // matching "</name" in raw text
+};
+
+enum {
+    TAG_OTHER = 0,
+    TAG_A,
+    TAG_AREA,
+    TAG_LINK,
+    TAG_BASE,
+    TAG_IMG,
+    TAG_SCRIPT,
+    TAG_IFRAME,
+    TAG_FRAME,
+    TAG_EMBED,
+    TAG_SOURCE,
+    TAG_AUDIO,
+    TAG_VIDEO,
+    TAG_TRACK,
+    TAG_INPUT,
+    TAG_STYLE,
+    TAG_TITLE,
+    TAG_TEXTAREA
+};
+
+enum {
+    ATTR_OTHER  = 0,
+    ATTR_HREF   = 1 << 0,
+    ATTR_SRC    = 1 << 1,
+    ATTR_SRCSET = 1 << 2
+};
+
+static struct {
+    char* name;
+    unsigned attrs;  // attributes that contain links
+    bool raw_text;
+} tags[] = {
+    [TAG_OTHER]    = { "",         0,                     false },
+    [TAG_A]        = { "a",        ATTR_HREF,             false },
+    [TAG_AREA]     = { "area",     ATTR_HREF,             false },
+    [TAG_LINK]     = { "link",     ATTR_HREF,             false },
+    [TAG_BASE]     = { "base",     ATTR_HREF,             false },
+    [TAG_IMG]      = { "img",      ATTR_SRC | ATTR_SRCSET, false },
+    [TAG_SCRIPT]   = { "script",   ATTR_SRC,              true  },
+    [TAG_IFRAME]   = { "iframe",   ATTR_SRC,              false },
+    [TAG_FRAME]    = { "frame",    ATTR_SRC,              false },
+    [TAG_EMBED]    = { "embed",    ATTR_SRC,              false },
+    [TAG_SOURCE]   = { "source",   ATTR_SRC | ATTR_SRCSET, false },
+    [TAG_AUDIO]    = { "audio",    ATTR_SRC,              false },
+    [TAG_VIDEO]    = { "video",    ATTR_SRC,              false },
+    [TAG_TRACK]    = { "track",    ATTR_SRC,              false },
+    [TAG_INPUT]    = { "input",    ATTR_SRC,              false },
+    [TAG_STYLE]    = { "style",    0,                     true  },
+    [TAG_TITLE]    = { "title",    0,                     true  },
+    [TAG_TEXTAREA] = { "textarea", 0,                     true  }
+};
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t' || c == '\n' || c == '\r' || c == '\f';
+}
+
+static inline char lower_char(char c)
+{
+    return ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+}
+
+static inline void append_name_char(CurlLinkExtractor* ext, char c)
+/*
+ * Names longer than the buffer match nothing.
+ */
+{
+    if (ext->name_length < sizeof(ext->name)) {
+        ext->name[ext->name_length] = lower_char(c);
+    }
+    if (ext->name_length <= sizeof(ext->name)) {
+        ext->name_length++;
+    }
+}
+
+static unsigned lookup_tag(CurlLinkExtractor* ext)
+{
+    if (ext->name_length < sizeof(ext->name)) {
+        for (unsigned i = 1; i < PW_LENGTH(tags); i++) {
+            if (strlen(tags[i].name) == ext->name_length
+                && memcmp(tags[i].name, ext->name, ext->name_length) == 0) {
+                return i;
+            }
+        }
+    }
+    return TAG_OTHER;
+}
+
+static unsigned lookup_attr(CurlLinkExtractor* ext)
+{
+    unsigned attr = ATTR_OTHER;
+    if (ext->name_length == 4 && memcmp(ext->name, "href", 4) == 0) {
+        attr = ATTR_HREF;
+    } else if (ext->name_length == 3 && memcmp(ext->name, "src", 3) == 0) {
+        attr = ATTR_SRC;
+    } else if (ext->name_length == 6 && memcmp(ext->name, "srcset", 6) == 0) {
+        attr = ATTR_SRCSET;
+    }
+    return attr & tags[ext->tag].attrs;
+}
+
+static unsigned encode_utf8(uint32_t c, char* out)
+{
+    if (c == 0 || c > 0x10FFFF || (0xD800 <= c && c <= 0xDFFF)) {
+        c = 0xFFFD;
+    }
+    if (c < 0x80) {
+        out[0] = c;
+        return 1;
+    }
+    if (c < 0x800) {
+        out[0] = 0xC0 | (c >> 6);
+        out[1] = 0x80 | (c & 0x3F);
+        return 2;
+    }
+    if (c < 0x10000) {
+        out[0] = 0xE0 | (c >> 12);
+        out[1] = 0x80 | ((c >> 6) & 0x3F);
+        out[2] = 0x80 | (c & 0x3F);
+        return 3;
+    }
+    out[0] = 0xF0 | (c >> 18);
+    out[1] = 0x80 | ((c >> 12) & 0x3F);
+    out[2] = 0x80 | ((c >> 6) & 0x3F);
+    out[3] = 0x80 | (c & 0x3F);
+    return 4;
+}
+
+static unsigned decode_char_refs(char* value, unsigned length)
+/*
+ * Decode numeric character references and the few named ones
+ * that occur in URLs, in place. Return new length.
+ * Decoded form is never longer than the reference.
+ */
+{
+    static struct {
+        char* name;
+        unsigned length;
+        char c;
+    } named_refs[] = {
+        { "amp;",  4, '&'  },
+        { "lt;",   3, '<'  },
+        { "gt;",   3, '>'  },
+        { "quot;", 5, '"'  },
+        { "apos;", 5, '\'' }
+    };
+    char* src = memchr(value, '&', length);
+    if (!src) {
+        return length;
+    }
+    char* end = value + length;
+    char* dest = src;
+    while (src < end) {
+        if (*src != '&') {
+            *dest++ = *src++;
+            continue;
+        }
+        char* p = src + 1;
+        if (p < end && *p == '#') {
+            p++;
+            bool hex = p < end && (*p == 'x' || *p == 'X');
+            if (hex) {
+                p++;
+            }
+            char* digits = p;
+            uint32_t c = 0;
+            while (p < end && (hex? curl_hex_value[(unsigned char) *p] >= 0 : ('0' <= *p && *p <= '9'))) {
+                if (c <= 0x10FFFF) {
+                    c = hex? c * 16 + curl_hex_value[(unsigned char) *p] : c * 10 + (*p - '0');
+                }
+                p++;
+            }
+            if (p != digits) {
+                if (p < end && *p == ';') {
+                    p++;
+                }
+                dest += encode_utf8(c, dest);
+                src = p;
+                continue;
+            }
+        } else {
+            bool found = false;
+            for (unsigned i = 0; i < PW_LENGTH(named_refs); i++) {
+                if ((unsigned) (end - p) >= named_refs[i].length
+                    && memcmp(p, named_refs[i].name, named_refs[i].length) == 0) {
+                    *dest++ = named_refs[i].c;
+                    src = p + named_refs[i].length;
+                    found = true;
+                    break;
+                }
+            }
+            if (found) {
+                continue;
+            }
+        }
+        *dest++ = *src++;
+    }
+    return dest - value;
+}
+
+static bool is_followed(char* ref, unsigned length)
+/*
+ * Return false for references with schemes other than HTTP(S),
+ * such as javascript:, mailto:, and data:
+ */
+{
+    for (unsigned i = 0; i < length; i++) {
+        char c = ref[i];
+        if (c == ':') {
+            return (i == 4 && strncasecmp(ref, "http", 4) == 0)
+                || (i == 5 && strncasecmp(ref, "https", 5) == 0);
+        }
+        if (!(('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || (i && (('0' <= c && c <= '9') || c == '+' || c == '-' || c == '.')))) {
+            // not a scheme
+            return true;
+        }
+    }
+    return true;
+}
+
+[[nodiscard]] static bool add_ref(CurlLinkExtractor* ext, char* ref, unsigned length)
+{
+    // strip leading and trailing whitespace, as URL parser does
+    while (length && is_space(*ref)) {
+        ref++;
+        length--;
+    }
+    while (length && is_space(ref[length - 1])) {
+        length--;
+    }
+    if (length == 0 || !is_followed(ref, length)) {
+        ext->num_skipped++;
+        return true;
+    }
+    if (pw_is_null(&ext->refs)) {
+        if (!pw_create_array(&ext->refs)) {
+            return false;
+        }
+    }
+    PwValue str = PW_STRING("");
+    if (!pw_string_append(&str, ref, ref + length)) {
+        return false;
+    }
+    return pw_array_append(&ext->refs, &str);
+}
+
+[[nodiscard]] static bool add_srcset(CurlLinkExtractor* ext, char* value, unsigned length)
+/*
+ * Candidates are separated by commas, each is URL optionally followed by descriptor.
+ */
+{
+    char* p = value;
+    char* end = value + length;
+    while (p < end) {
+        while (p < end && (is_space(*p) || *p == ',')) {
+            p++;
+        }
+        char* url = p;
+        while (p < end && !is_space(*p)) {
+            p++;
+        }
+        char* url_end = p;
+        while (url_end > url && url_end[-1] == ',') {
+            url_end--;
+        }
+        if (url_end == p) {
+            // no trailing comma, skip descriptor
+            while (p < end && *p != ',') {
+                p++;
+            }
+        }
+        if (url_end > url) {
+            if (!add_ref(ext, url, url_end - url)) {
+                return false;
+            }
+        }
+    }
+    return true;
+}
+
+[[nodiscard]] static bool flush_refs(CurlLinkExtractor* ext, PwValuePtr links)
+/*
+ * Resolve collected references and append valid ones to links.
+ */
+{
+    if (pw_is_null(&ext->refs) || pw_array_length(&ext->refs) == 0) {
+        return true;
+    }
+    PwValue results = PW_NULL;
+    if (!curl_url_resolve_batch(&ext->resolver, &ext->refs, &results)) {
+        return false;
+    }
+    pw_destroy(&ext->refs);
+
+    unsigned n = pw_array_length(&results);
+    for (unsigned i = 0; i < n; i++) {{
+        PwValue url = PW_NULL;
+        if (!pw_array_item(&results, i, &url)) {
+            return false;
+        }
+        if (pw_is_null(&url)) {
+            ext->num_skipped++;
+            continue;
+        }
+        if (!pw_array_append(links, &url)) {
+            return false;
+        }
+        ext->num_links++;
+    }}
+    return true;
+}
+
+[[nodiscard]] static bool set_base(CurlLinkExtractor* ext, char* href, unsigned length, PwValuePtr links)
+/*
+ * Handle the first <base href>, ignore subsequent ones.
+ */
+{
+    ext->base_seen = true;
+
+    while (length && is_space(*href)) {
+        href++;
+        length--;
+    }
+    while (length && is_space(href[length - 1])) {
+        length--;
+    }
+    if (length == 0) {
+        return true;
+    }
+    // references seen so far use the previous base
+    if (!flush_refs(ext, links)) {
+        return false;
+    }
+    PwValue base = PW_NULL;
+    if (!curl_url_resolve(&ext->resolver, href, length, &base)) {
+        // malformed base is ignored
+        return true;
+    }
+    PW_CSTRING_LOCAL(base_cstr, &base);
+    CurlUrlResolver resolver;
+    if (!curl_url_resolver_init(&resolver, base_cstr)) {
+        return true;
+    }
+    curl_url_resolver_fini(&ext->resolver);
+    ext->resolver = resolver;
+    return true;
+}
+
+[[nodiscard]] static bool end_attr_value(CurlLinkExtractor* ext, PwValuePtr links)
+{
+    if (ext->attr == ATTR_OTHER) {
+        return true;
+    }
+    unsigned attr = ext->attr;
+    ext->attr = ATTR_OTHER;
+    if (ext->value_overflow) {
+        ext->num_skipped++;
+        return true;
+    }
+    unsigned length = decode_char_refs(ext->value, ext->value_length);
+
+    if (ext->tag == TAG_BASE) {
+        if (ext->base_seen) {
+            return true;
+        }
+        return set_base(ext, ext->value, length, links);
+    }
+    if (attr == ATTR_SRCSET) {
+        return add_srcset(ext, ext->value, length);
+    }
+    return add_ref(ext, ext->value, length);
+}
+
+static inline void start_attr_value(CurlLinkExtractor* ext)
+{
+    ext->value_length = 0;
+    ext->value_overflow = false;
+}
+
+static inline void append_value(CurlLinkExtractor* ext, char* start, char* end)
+{
+    if (ext->attr == ATTR_OTHER || ext->value_overflow) {
+        return;
+    }
+    unsigned length = end - start;
+    if (ext->value_length + length > CURL_LINK_MAX_LENGTH) {
+        ext->value_overflow = true;
+        return;
+    }
+    memcpy(ext->value + ext->value_length, start, length);
+    ext->value_length += length;
+}
+
+static inline unsigned end_tag(CurlLinkExtractor* ext)
+/*
+ * Return state after '>'
+ */
+{
+    if (ext->is_end_tag || !tags[ext->tag].raw_text) {
+        return STATE_DATA;
+    }
+    ext->raw_tag = ext->tag;
+    return STATE_RAWTEXT;
+}
+
+[[nodiscard]] bool curl_links_init(CurlLinkExtractor* ext, char* base_url)
+{
+    memset(ext, 0, sizeof(CurlLinkExtractor));
+    ext->refs = PwNull();
+    return curl_url_resolver_init(&ext->resolver, base_url);
+}
+
+void curl_links_fini(CurlLinkExtractor* ext)
+{
+    curl_url_resolver_fini(&ext->resolver);
+    pw_destroy(&ext->refs);
+}
+
+[[nodiscard]] bool curl_links_feed(CurlLinkExtractor* ext, char* data, size_t size, PwValuePtr links)
+{
+    char* p = data;
+    char* end = data + size;
+    unsigned state = ext->state;
+
+    while (p < end) {
+        char c = *p;
+        switch (state) {
+
+            case STATE_DATA: {
+                char* lt = memchr(p, '<', end - p);
+                if (!lt) {
+                    p = end;
+                    continue;
+                }
+                p = lt + 1;
+                state = STATE_TAG_OPEN;
+                continue;
+            }
+
+            case STATE_TAG_OPEN:
+                ext->is_end_tag = false;
+                ext->tag = TAG_OTHER;
+                ext->name_length = 0;
+                if (c == '!') {
+                    state = STATE_MARKUP;
+                    p++;
+                } else if (c == '/') {
+                    ext->is_end_tag = true;
+                    state = STATE_END_TAG;
+                    p++;
+                } else if (('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z')) {
+                    state = STATE_TAG_NAME;
+                } else if (c == '?') {
+                    // processing instruction, bogus comment in HTML
+                    state = STATE_END_TAG;
+                } else {
+                    state = STATE_DATA;
+                }
+                continue;
+
+            case STATE_END_TAG: {
+                // end tags have no links, skip them along with bogus comments
+                char* gt = memchr(p, '>', end - p);
+                if (!gt) {
+                    p = end;
+                    continue;
+                }
+                p = gt + 1;
+                state = STATE_DATA;
+                continue;
+            }
+
+            case STATE_MARKUP:
+                state = (c == '-')? STATE_MARKUP_DASH : STATE_END_TAG;
+                if (c == '-') {
+                    p++;
+                }
+                continue;
+
+            case STATE_MARKUP_DASH:
+                if (c == '-') {
+                    ext->match = 0;
+                    state = STATE_COMMENT;
+                    p++;
+                } else {
+                    state = STATE_END_TAG;
+                }
+                continue;
+
+            case STATE_COMMENT:
+                // match counts dashes before '>'
+                if (c == '>' && ext->match >= 2) {
+                    state = STATE_DATA;
+                } else if (c == '-') {
+                    ext->match++;
+                } else {
+                    ext->match = 0;
+                }
+                p++;
+                continue;
+
+            case STATE_TAG_NAME:
+                if (is_space(c) || c == '/' || c == '>') {
+                    ext->tag = lookup_tag(ext);
+                    state = STATE_BEFORE_ATTR_NAME;
+                    continue;
+                }
+                append_name_char(ext, c);
+                p++;
+                continue;
+
+            case STATE_BEFORE_ATTR_NAME:
+                if (c == '>') {
+                    state = end_tag(ext);
+                } else if (!(is_space(c) || c == '/')) {
+                    ext->name_length = 0;
+                    append_name_char(ext, c);
+                    state = STATE_ATTR_NAME;
+                }
+                p++;
+                continue;
+
+            case STATE_ATTR_NAME:
+                if (is_space(c) || c == '/' || c == '>' || c == '=') {
+                    ext->attr = lookup_attr(ext);
+                    state = (c == '=')? STATE_BEFORE_ATTR_VALUE : STATE_AFTER_ATTR_NAME;
+                    if (c == '=') {
+                        p++;
+                    }
+                    continue;
+                }
+                append_name_char(ext, c);
+                p++;
+                continue;
+
+            case STATE_AFTER_ATTR_NAME:
+                if (c == '=') {
+                    state = STATE_BEFORE_ATTR_VALUE;
+                    p++;
+                } else if (is_space(c)) {
+                    p++;
+                } else {
+                    // attribute without value
+                    ext->attr = ATTR_OTHER;
+                    state = STATE_BEFORE_ATTR_NAME;
+                }
+                continue;
+
+            case STATE_BEFORE_ATTR_VALUE:
+                if (is_space(c)) {
+                    p++;
+                    continue;
+                }
+                start_attr_value(ext);
+                if (c == '"' || c == '\'') {
+                    ext->quote = c;
+                    state = STATE_ATTR_VALUE_QUOTED;
+                    p++;
+                } else if (c == '>') {
+                    ext->attr = ATTR_OTHER;
+                    state = STATE_BEFORE_ATTR_NAME;
+                } else {
+                    state = STATE_ATTR_VALUE_UNQUOTED;
+                }
+                continue;
+
+            case STATE_ATTR_VALUE_QUOTED: {
+                char* q = memchr(p, ext->quote, end - p);
+                if (!q) {
+                    append_value(ext, p, end);
+                    p = end;
+                    continue;
+                }
+                append_value(ext, p, q);
+                if (!end_attr_value(ext, links)) {
+                    ext->state = state;
+                    return false;
+                }
+                p = q + 1;
+                state = STATE_BEFORE_ATTR_NAME;
+                continue;
+            }
+
+            case STATE_ATTR_VALUE_UNQUOTED: {
+                char* start = p;
+                while (p < end && !is_space(*p) && *p != '>') {
+                    p++;
+                }
+                append_value(ext, start, p);
+                if (p < end) {
+                    if (!end_attr_value(ext, links)) {
+                        ext->state = state;
+                        return false;
+                    }
+                    state = STATE_BEFORE_ATTR_NAME;
+                }
+                continue;
+            }
+
+            case STATE_RAWTEXT: {
+                char* lt = memchr(p, '<', end - p);
+                if (!lt) {
+                    p = end;
+                    continue;
+                }
+                p = lt + 1;
+                ext->match = 0;
+                state = STATE_RAWTEXT_END_TAG;
+                continue;
+            }
+
+            case STATE_RAWTEXT_END_TAG: {
+                // match counts chars of "/name" matched so far
+                char* name = tags[ext->raw_tag].name;
+                unsigned name_length = strlen(name);
+                if (ext->match == 0) {
+                    if (c == '/') {
+                        ext->match = 1;
+                        p++;
+                    } else {
+                        state = STATE_RAWTEXT;
+                    }
+                } else if (ext->match <= name_length) {
+                    if (lower_char(c) == name[ext->match - 1]) {
+                        ext->match++;
+                        p++;
+                    } else {
+                        state = STATE_RAWTEXT;
+                    }
+                } else if (is_space(c) || c == '/' || c == '>') {
+                    ext->is_end_tag = true;
+                    state = STATE_END_TAG;
+                } else {
+                    state = STATE_RAWTEXT;
+                }
+                continue;
+            }
+        }
+    }
+    ext->state = state;
+
+    // resolve references found in this chunk
+    return flush_refs(ext, links);
+}
@@ -0,0 +1,197 @@
+#include <string.h>
+
+#include "pw_http_scan.h"
+
+#if defined(__x86_64__) || defined(__i386__)
+#   include <immintrin.h>
+#   define HAVE_X86_SIMD
+#endif
+
+#define C  CURL_CC_CTL
+#define S  CURL_CC_SEP
+#define T  CURL_CC_TOKEN
+#define M  CURL_CC_CHARSETC
+#define A  CURL_CC_ATTR
+#define X  CURL_CC_HEX
+#define W  CURL_CC_LWSP
+#define Q  CURL_CC_QDTEXT
+
+const uint8_t curl_char_class[256] = {
+    /* 00 */ C,          C,          C,          C,          C,          C,          C,          C,
+    /* 08 */ C,          C|S|W|Q,    C|W,        C,          C,          C|W,        C,          C,
+    /* 10 */ C,          C,          C,          C,          C,          C,          C,          C,
+    /* 18 */ C,          C,          C,          C,          C,          C,          C,          C,
+    /* 20 */ S|W|Q,      T|M|A|Q,    S,          T|M|A|Q,    T|M|A|Q,    T|M|Q,      T|M|A|Q,    T|Q,
+    /* 28 */ S|Q,        S|Q,        T|Q,        T|M|A|Q,    S|Q,        T|M|A|Q,    T|A|Q,      S|Q,
+    /* 30 */ T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,
+    /* 38 */ T|M|A|X|Q,  T|M|A|X|Q,  S|Q,        S|Q,        S|Q,        S|Q,        S|Q,        S|Q,
+    /* 40 */ S|Q,        T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|Q,
+    /* 48 */ T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,
+    /* 50 */ T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,
+    /* 58 */ T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    S|Q,        S,          S|Q,        T|M|A|Q,    T|M|A|Q,
+    /* 60 */ T|M|A|Q,    T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|X|Q,  T|M|A|Q,
+    /* 68 */ T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,
+    /* 70 */ T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    T|M|A|Q,
+    /* 78 */ T|M|A|Q,    T|M|A|Q,    T|M|A|Q,    S|M|Q,      T|A|Q,      S|M|Q,      T|M|A|Q,    C,
+    /* 80 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* 88 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* 90 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* 98 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* a0 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* a8 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* b0 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* b8 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* c0 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* c8 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* d0 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* d8 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* e0 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* e8 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* f0 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+    /* f8 */ T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,        T|Q,
+};
+
+#undef C
+#undef S
+#undef T
+#undef M
+#undef A
+#undef X
+#undef W
+#undef Q
+
+const int8_t curl_hex_value[256] = {
+    /* 00 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 10 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 20 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 30 */  0,  1,  2,  3,  4,  5,  6,  7,  8,  9, -1, -1, -1, -1, -1, -1,
+    /* 40 */ -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 50 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 60 */ -1, 10, 11, 12, 13, 14, 15, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 70 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 80 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* 90 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* a0 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* b0 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* c0 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* d0 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* e0 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+    /* f0 */ -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1, -1,
+};
+
+CurlScanSet curl_scan_token   = { .char_class = CURL_CC_TOKEN };
+CurlScanSet curl_scan_qdtext  = { .char_class = CURL_CC_QDTEXT };
+CurlScanSet curl_scan_attr    = { .char_class = CURL_CC_ATTR,     .stop_on_high = true };
+CurlScanSet curl_scan_charset = { .char_class = CURL_CC_CHARSETC, .stop_on_high = true };
+
+static void init_scan_set(CurlScanSet* set)
+/*
+ * Build nibble tables for the complement of set->char_class.
+ * Each of eight high nibbles of ASCII gets its own bit,
+ * so any subset of ASCII is represented exactly.
+ */
+{
+    memset(set->lo, 0, sizeof(set->lo));
+    memset(set->hi, 0, sizeof(set->hi));
+    for (unsigned c = 0; c < 128; c++) {
+        if (!curl_char_is(c, set->char_class)) {
+            set->lo[c & 15] |= 1 << (c >> 4);
+        }
+    }
+    for (unsigned h = 0; h < 8; h++) {
+        set->hi[h] = 1 << h;
+    }
+}
+
+char* curl_scan_scalar(char* str, CurlScanSet* set)
+{
+    unsigned char* p = (unsigned char*) str;
+    uint8_t char_class = set->char_class;
+    // classes never include nul
+    while (curl_char_class[*p] & char_class) {
+        p++;
+    }
+    return (char*) p;
+}
+
+#ifdef HAVE_X86_SIMD
+
+__attribute__((target("ssse3"), no_sanitize_address))
+static char* scan_ssse3(char* str, CurlScanSet* set)
+{
+    __m128i lo_table = _mm_loadu_si128((__m128i*) set->lo);
+    __m128i hi_table = _mm_loadu_si128((__m128i*) set->hi);
+    __m128i nibble_mask = _mm_set1_epi8(0x0f);
+    __m128i zero = _mm_setzero_si128();
+
+    unsigned misalignment = ((uintptr_t) str) & 15;
+    char* block = str - misalignment;
+    unsigned valid = 0xffffu << misalignment;  // ignore bytes before str in the first block
+
+    for (;;) {
+        __m128i v = _mm_load_si128((__m128i*) block);
+        __m128i lo = _mm_shuffle_epi8(lo_table, _mm_and_si128(v, nibble_mask));
+        __m128i hi = _mm_shuffle_epi8(hi_table, _mm_and_si128(_mm_srli_epi16(v, 4), nibble_mask));
+        unsigned stop = ~_mm_movemask_epi8(_mm_cmpeq_epi8(_mm_and_si128(lo, hi), zero)) & 0xffff;
+        if (set->stop_on_high) {
+            stop |= _mm_movemask_epi8(v);
+        }
+        stop &= valid;
+        if (stop) {
+            return block + __builtin_ctz(stop);
+        }
+        valid = 0xffff;
+        block += 16;
+    }
+}
+
+__attribute__((target("avx2"), no_sanitize_address))
+static char* scan_avx2(char* str, CurlScanSet* set)
+{
+    __m256i lo_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*) set->lo));
+    __m256i hi_table = _mm256_broadcastsi128_si256(_mm_loadu_si128((__m128i*) set->hi));
+    __m256i nibble_mask = _mm256_set1_epi8(0x0f);
+    __m256i zero = _mm256_setzero_si256();
+
+    unsigned misalignment = ((uintptr_t) str) & 31;
+    char* block = str - misalignment;
+    uint32_t valid = 0xffffffffu << misalignment;
+
+    for (;;) {
+        __m256i v = _mm256_load_si256((__m256i*) block);
+        __m256i lo = _mm256_shuffle_epi8(lo_table, _mm256_and_si256(v, nibble_mask));
+        __m256i hi = _mm256_shuffle_epi8(hi_table, _mm256_and_si256(_mm256_srli_epi16(v, 4), nibble_mask));
+        uint32_t stop = ~(uint32_t) _mm256_movemask_epi8(_mm256_cmpeq_epi8(_mm256_and_si256(lo, hi), zero));
+        if (set->stop_on_high) {
+            stop |= (uint32_t) _mm256_movemask_epi8(v);
+        }
+        stop &= valid;
+        if (stop) {
+            return block + __builtin_ctz(stop);
+        }
+        valid = 0xffffffffu;
+        block += 32;
+    }
+}
+
+#endif
+
+char* (*curl_scan_long)(char* str, CurlScanSet* set) = curl_scan_scalar;
+
+[[ gnu::constructor ]]
+static void init()
+{
+    init_scan_set(&curl_scan_token);
+    init_scan_set(&curl_scan_qdtext);
+    init_scan_set(&curl_scan_attr);
+    init_scan_set(&curl_scan_charset);
+
+#   ifdef HAVE_X86_SIMD
+        __builtin_cpu_init();
+        if (__builtin_cpu_supports("avx2")) {
+            curl_scan_long = scan_avx2;
+        } else if (__builtin_cpu_supports("ssse3")) {
+            curl_scan_long = scan_ssse3;
+        }
+#   endif
+}
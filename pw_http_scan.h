@@ -0,0 +1,70 @@
+#pragma once
+
+/*
+ * Character classes of HTTP grammar and fast scanning of nul-terminated strings.
+ */
+
+#include <stdbool.h>
+#include <stdint.h>
+
+enum {
+    CURL_CC_CTL      = 1 << 0,  // CTL: 0-31, 127
+    CURL_CC_SEP      = 1 << 1,  // separators, RFC 2616, 2.2
+    CURL_CC_TOKEN    = 1 << 2,  // neither CTL nor separator
+    CURL_CC_CHARSETC = 1 << 3,  // mime-charsetc, RFC 8187, 3.2.1
+    CURL_CC_ATTR     = 1 << 4,  // attr-char, RFC 8187, 3.2.1
+    CURL_CC_HEX      = 1 << 5,  // HEXDIG
+    CURL_CC_LWSP     = 1 << 6,  // SP, HT, CR, LF
+    CURL_CC_QDTEXT   = 1 << 7   // qdtext, RFC 7230, 3.2.6
+};
+
+extern const uint8_t curl_char_class[256];
+extern const int8_t curl_hex_value[256];  // -1 for non-hex digits
+
+static inline bool curl_char_is(unsigned char c, uint8_t char_class)
+{
+    return curl_char_class[c] & char_class;
+}
+
+typedef struct {
+    /*
+     * Set of characters that stop scanning, represented as nibble lookup tables
+     * for pshufb: byte c < 128 is in the set if lo[c & 15] & hi[c >> 4]
+     */
+    uint8_t lo[16];
+    uint8_t hi[16];
+    bool stop_on_high;    // bytes >= 128 are in the set
+    uint8_t char_class;   // class of chars to skip, for scalar code
+} CurlScanSet;
+
+extern CurlScanSet curl_scan_token;    // stops at non-token chars
+extern CurlScanSet curl_scan_qdtext;   // stops at DQUOTE, backslash, and CTL except HT
+extern CurlScanSet curl_scan_attr;     // stops at non attr-chars, percent sign included
+extern CurlScanSet curl_scan_charset;  // stops at non mime-charsetc
+
+extern char* (*curl_scan_long)(char* str, CurlScanSet* set);
+/*
+ * Return pointer to the first char of nul-terminated str that belongs to the set.
+ * Nul is always in the set.
+ *
+ * Vectorized implementations read aligned blocks that may extend
+ * beyond the terminator but never cross page boundary.
+ */
+
+char* curl_scan_scalar(char* str, CurlScanSet* set);
+/*
+ * Reference implementation, exported for benchmarks.
+ */
+
+static inline char* curl_scan(char* str, CurlScanSet* set)
+/*
+ * Most header tokens are short, check first bytes without vector setup.
+ */
+{
+    for (unsigned i = 0; i < 8; i++) {
+        if (!curl_char_is(str[i], set->char_class)) {
+            return str + i;
+        }
+    }
+    return curl_scan_long(str + 8, set);
+}
@@ -1,78 +1,293 @@
-#include <ctype.h>
 #include <stdio.h>
 #include <stdlib.h>
 #include <string.h>
+#include <time.h>
 
 #include <pw.h>
 
-#include "pw_curl.h"
+#include "pw_curl_internal.h"
+#include "pw_http_scan.h"
 
-static char* get_response_header(CURL* easy_handle, char* name)
+/****************************************************************
+ * Header index
+ */
+
+static inline uint32_t hash_header_name(char* name, unsigned length)
 /*
- * Return the pointer to an internally allocated memory.
- * The header should be parsed immediately, otherwise subsequent calls to CURL API
- * will clobber it.
+ * Case-insensitive FNV-1a
  */
 {
-    char* last_value = nullptr;
-    int last_request = 0;
-    int last_amount = 1;
+    uint32_t h = 0x811c9dc5;
+    for (unsigned i = 0; i < length; i++) {
+        unsigned char c = name[i];
+        if ('A' <= c && c <= 'Z') {
+            c |= 0x20;
+        }
+        h ^= c;
+        h *= 0x01000193;
+    }
+    return h;
+}
 
-    struct curl_header* hdr;
+static inline bool header_name_equal(char* a, char* b, unsigned length)
+{
+    for (unsigned i = 0; i < length; i++) {
+        unsigned char ca = a[i];
+        unsigned char cb = b[i];
+        if ('A' <= ca && ca <= 'Z') { ca |= 0x20; }
+        if ('A' <= cb && cb <= 'Z') { cb |= 0x20; }
+        if (ca != cb) {
+            return false;
+        }
+    }
+    return true;
+}
 
-    // iterate over requests made to get the last header
-    for (int i = 0;; i++) {
-        CURLHcode res = curl_easy_header(easy_handle, name, 0, CURLH_HEADER, i, &hdr);
-        if (res == CURLHE_OK) {
-            last_value = hdr->value;
-            last_amount = hdr->amount;
-            last_request = i;
-        } else {
-            break;
+[[nodiscard]] static bool grow_array(void** array, unsigned* capacity, unsigned item_size, unsigned min_capacity)
+{
+    unsigned new_capacity = *capacity? *capacity * 2 : 16;
+    while (new_capacity < min_capacity) {
+        new_capacity *= 2;
+    }
+    void* new_array = default_allocator.allocate(new_capacity * item_size, false);
+    if (!new_array) {
+        return false;
+    }
+    if (*array) {
+        memcpy(new_array, *array, *capacity * item_size);
+        default_allocator.release(array, *capacity * item_size);
+    }
+    *array = new_array;
+    *capacity = new_capacity;
+    return true;
+}
+
+static unsigned* find_slot(CurlHeaderIndex* index, char* name, unsigned length, uint32_t hash)
+/*
+ * Return slot that contains last header with given name or empty slot.
+ */
+{
+    unsigned mask = index->num_slots - 1;
+    for (unsigned i = hash & mask;; i = (i + 1) & mask) {
+        unsigned* slot = &index->slots[i];
+        if (*slot == 0) {
+            return slot;
+        }
+        CurlHeader* hdr = &index->headers[*slot - 1];
+        if (hdr->hash == hash && hdr->name_length == length
+            && header_name_equal(&index->buffer[hdr->name], name, length)) {
+            return slot;
         }
     }
-    if (last_value == nullptr) {
-        return nullptr;
+}
+
+[[nodiscard]] static bool grow_slots(CurlHeaderIndex* index)
+{
+    unsigned* old_slots = index->slots;
+    unsigned old_num_slots = index->num_slots;
+
+    index->num_slots = old_num_slots? old_num_slots * 2 : 32;
+    index->slots = default_allocator.allocate(index->num_slots * sizeof(unsigned), true);
+    if (!index->slots) {
+        index->slots = old_slots;
+        index->num_slots = old_num_slots;
+        return false;
     }
-    // get last instance of header
-    CURLHcode res = curl_easy_header(easy_handle, name, last_amount - 1, CURLH_HEADER, last_request, &hdr);
-    if (res == CURLHE_OK) {
-        return hdr->value;
-    } else {
-        return last_value;
+    unsigned mask = index->num_slots - 1;
+    for (unsigned i = 0; i < old_num_slots; i++) {
+        if (old_slots[i]) {
+            unsigned j = index->headers[old_slots[i] - 1].hash & mask;
+            while (index->slots[j]) {
+                j = (j + 1) & mask;
+            }
+            index->slots[j] = old_slots[i];
+        }
     }
+    if (old_slots) {
+        default_allocator.release((void**) &old_slots, old_num_slots * sizeof(unsigned));
+    }
+    return true;
 }
 
-static inline bool is_ctl(unsigned char c)
+[[nodiscard]] static bool append_to_buffer(CurlHeaderIndex* index, char* data, unsigned length, unsigned* offset)
 /*
- * https://datatracker.ietf.org/doc/html/rfc2616#section-2.2
- *
- * CTL = <any US-ASCII control character
- *       (octets 0 - 31) and DEL (127)>
+ * Append nul-terminated copy of data.
  */
 {
-    return (0 <= c && c <= 31) || c == 127;
+    if (index->buffer_size + length + 1 > index->buffer_capacity) {
+        if (!grow_array((void**) &index->buffer, &index->buffer_capacity, 1, index->buffer_size + length + 1)) {
+            return false;
+        }
+    }
+    *offset = index->buffer_size;
+    memcpy(&index->buffer[index->buffer_size], data, length);
+    index->buffer_size += length;
+    index->buffer[index->buffer_size++] = 0;
+    return true;
+}
+
+static inline void trim(char** start, char** end)
+{
+    char* s = *start;
+    char* e = *end;
+    while (s < e && (*s == ' ' || *s == '\t')) {
+        s++;
+    }
+    while (e > s && (e[-1] == ' ' || e[-1] == '\t' || e[-1] == '\r' || e[-1] == '\n')) {
+        e--;
+    }
+    *start = s;
+    *end = e;
 }
 
-static inline bool is_separator(unsigned char c)
+[[nodiscard]] static bool parse_status_line(CurlHeaderIndex* index, char* line, char* end)
 /*
- * https://datatracker.ietf.org/doc/html/rfc2616#section-2.2
- *
- * separators = "(" | ")" | "<" | ">" | "@"
- *            | "," | ";" | ":" | "\" | <">
- *            | "/" | "[" | "]" | "?" | "="
- *            | "{" | "}" | SP  | HT
+ * status-line = HTTP-version SP status-code SP [ reason-phrase ]
+ */
+{
+    char* p = line;
+    while (p < end && *p != ' ') {
+        p++;
+    }
+    unsigned status = 0;
+    for (p++; p < end && '0' <= *p && *p <= '9'; p++) {
+        status = status * 10 + (*p - '0');
+    }
+    if (100 <= status && status < 200) {
+        // informational response, its headers are not indexed
+        index->skip = true;
+        return true;
+    }
+    index->skip = false;
+    if (index->num_hops < CURL_MAX_HOPS) {
+        index->status[index->num_hops] = status;
+    }
+    index->num_hops++;
+    return true;
+}
+
+[[nodiscard]] bool curl_header_index_add_line(CurlHeaderIndex* index, char* line, unsigned length)
+/*
+ * Add raw header line as passed to CURLOPT_HEADERFUNCTION.
  */
 {
-    switch (c) {
-        case '(':  case ')':  case '<':  case '>':  case '@':
-        case ',':  case ';':  case ':':  case '\\': case '"':
-        case '/':  case '[':  case ']':  case '?':  case '=':
-        case '{':  case '}':  case ' ':  case '\t':
+    char* end = line + length;
+
+    if (length >= 5 && memcmp(line, "HTTP/", 5) == 0) {
+        return parse_status_line(index, line, end);
+    }
+    if (index->skip) {
+        return true;
+    }
+    if (index->num_hops == 0) {
+        // should not happen, but make sure header belongs to some hop
+        index->status[0] = 0;
+        index->num_hops = 1;
+    }
+    if (length && (line[0] == ' ' || line[0] == '\t')) {
+        // obsolete line folding, append to the value of previous header
+        if (index->num_headers == 0) {
+            return true;
+        }
+        char* start = line;
+        trim(&start, &end);
+        if (start == end) {
             return true;
-        default:
+        }
+        CurlHeader* hdr = &index->headers[index->num_headers - 1];
+        // previous value is the last one in the buffer, replace its terminator with space
+        index->buffer[index->buffer_size - 1] = ' ';
+        unsigned offset;
+        if (!append_to_buffer(index, start, end - start, &offset)) {
+            return false;
+        }
+        hdr->value_length = index->buffer_size - 1 - hdr->value;
+        return true;
+    }
+
+    char* colon = memchr(line, ':', length);
+    if (!colon) {
+        // blank line at the end of headers or malformed line
+        return true;
+    }
+    char* name_start = line;
+    char* name_end = colon;
+    trim(&name_start, &name_end);
+    if (name_start == name_end) {
+        return true;
+    }
+    char* value_start = colon + 1;
+    char* value_end = end;
+    trim(&value_start, &value_end);
+
+    if (index->num_headers == index->headers_capacity) {
+        if (!grow_array((void**) &index->headers, &index->headers_capacity, sizeof(CurlHeader), 0)) {
             return false;
+        }
+    }
+    if ((index->num_names + 1) * 2 > index->num_slots) {
+        if (!grow_slots(index)) {
+            return false;
+        }
+    }
+    CurlHeader* hdr = &index->headers[index->num_headers];
+    hdr->hop = index->num_hops - 1;
+    hdr->name_length = name_end - name_start;
+    hdr->value_length = value_end - value_start;
+    hdr->hash = hash_header_name(name_start, hdr->name_length);
+    if (!append_to_buffer(index, name_start, hdr->name_length, &hdr->name)) {
+        return false;
+    }
+    if (!append_to_buffer(index, value_start, hdr->value_length, &hdr->value)) {
+        return false;
+    }
+    unsigned* slot = find_slot(index, name_start, hdr->name_length, hdr->hash);
+    if (*slot == 0) {
+        index->num_names++;
+    }
+    hdr->prev = *slot;
+    *slot = ++index->num_headers;
+    return true;
+}
+
+void curl_header_index_fini(CurlHeaderIndex* index)
+{
+    if (index->buffer) {
+        default_allocator.release((void**) &index->buffer, index->buffer_capacity);
+    }
+    if (index->headers) {
+        default_allocator.release((void**) &index->headers, index->headers_capacity * sizeof(CurlHeader));
+    }
+    if (index->slots) {
+        default_allocator.release((void**) &index->slots, index->num_slots * sizeof(unsigned));
+    }
+    *index = (CurlHeaderIndex) {};
+}
+
+CurlHeader* curl_header_index_get(CurlHeaderIndex* index, char* name, int hop)
+{
+    if (index->num_names == 0) {
+        return nullptr;
+    }
+    unsigned length = strlen(name);
+    unsigned i = *find_slot(index, name, length, hash_header_name(name, length));
+    while (i) {
+        CurlHeader* hdr = &index->headers[i - 1];
+        if (hop < 0 || hdr->hop == (unsigned) hop) {
+            return hdr;
+        }
+        if (hdr->hop < (unsigned) hop) {
+            break;
+        }
+        i = hdr->prev;
     }
+    return nullptr;
+}
+
+char* curl_request_get_header(CurlRequestData* req, char* name, int hop)
+{
+    CurlHeader* hdr = curl_header_index_get(&req->header_index, name, hop);
+    return hdr? &req->header_index.buffer[hdr->value] : nullptr;
 }
 
 static inline void skip_lwsp(char** current_char)
@@ -83,44 +298,71 @@ static inline void skip_lwsp(char** current_char)
 {
     // simplified, not strictly follows the grammar
     char* ptr = *current_char;
-    for (;;) {
-        char c = *ptr;
-        if (c == 0) {
-            break;
-        }
-        if (c != ' ' && c != '\t' && c != '\r' && c != '\n') {
-            break;
-        }
+    while (curl_char_is(*ptr, CURL_CC_LWSP)) {
         ptr++;
     }
     *current_char = ptr;
 }
 
-[[nodiscard]] static bool parse_token(char** current_char, PwValuePtr result)
+/*
+ * Parsers below work on borrowed views into the copy of header
+ * kept in the header index and never modify it.
+ * PwValues are created only when parsed header is materialized.
+ */
+
+typedef struct {
+    char* ptr;
+    unsigned length;
+} StrView;
+
+typedef enum {
+    PARAM_TOKEN,
+    PARAM_QUOTED,  // value is the content of quoted string, may contain quoted-pairs
+    PARAM_EXT      // value is percent-encoded
+} ParamKind;
+
+typedef struct {
+    StrView name;
+    StrView value;
+    StrView charset;   // ext-value only
+    StrView language;  // ext-value only
+    ParamKind kind;
+} HeaderParam;
+
+#define MAX_HEADER_PARAMS  16
+
+typedef struct {
+    StrView type;
+    StrView subtype;
+    unsigned num_params;
+    HeaderParam params[MAX_HEADER_PARAMS];
+} ParsedHeader;
+
+static inline StrView parse_token(char** current_char)
 /*
  * https://datatracker.ietf.org/doc/html/rfc2616#section-2.2
  *
  * token = 1*<any CHAR except CTLs or separators>
  *
- * Return token.
+ * CTL = <any US-ASCII control character
+ *       (octets 0 - 31) and DEL (127)>
+ *
+ * separators = "(" | ")" | "<" | ">" | "@"
+ *            | "," | ";" | ":" | "\" | <">
+ *            | "/" | "[" | "]" | "?" | "="
+ *            | "{" | "}" | SP  | HT
+ *
+ * Return token, possibly empty.
  */
 {
     char* token_start = *current_char;
-    char* token_end = token_start;
+    char* token_end = curl_scan(token_start, &curl_scan_token);
 
-    while (!(is_separator(*token_end) || is_ctl(*token_end))) {
-        token_end++;
-    }
-    PwValue token = PW_STRING("");
-    if (!pw_string_append(&token, token_start, token_end)) {
-        return false;
-    }
     *current_char = token_end;
-    pw_move(&token, result);
-    return true;
+    return (StrView) { token_start, token_end - token_start };
 }
 
-[[nodiscard]] static bool parse_quoted_string(char** current_char, PwValuePtr result)
+static bool parse_quoted_string(char** current_char, StrView* result)
 /*
  * https://datatracker.ietf.org/doc/html/rfc7230#section-3.2.6
  *
@@ -129,449 +371,1160 @@ static inline void skip_lwsp(char** current_char)
  * obs-text      = %x80-FF
  * quoted-pair   = "\" ( HTAB / SP / VCHAR / obs-text )
  *
- * Return string or null value if not a quoted string.
+ * Return content of quoted string without quotes, quoted-pairs are left as is.
+ * Return false if not a quoted string or if the string is malformed.
  */
 {
     char* qstr_start = *current_char;
 
-    pw_destroy(result);  // this makes result Null
-
     if (*qstr_start != '"') {
-        return true;
+        return false;
     }
     qstr_start++;
 
-    *result = PwString("");
-
     char* qstr_end = qstr_start;
     for (;;) {
-        unsigned char c = *qstr_end;
-        if (is_ctl(c)) {
-            if (c != ' ' && c != '\t') {
-                break;
-            }
-        }
-        if (c == '"') {
+        qstr_end = curl_scan(qstr_end, &curl_scan_qdtext);
+        if (*qstr_end != '\\' || qstr_end[1] == 0) {
             break;
         }
-        if (c != '\\') {
-            qstr_end++;
-            continue;
-        }
-        // append what we've got and skip quote char
-        if (!pw_string_append(result, qstr_start, qstr_end)) {
-            return false;
-        }
-        qstr_end++;
-        qstr_start = qstr_end;
+        // skip quoted char
+        qstr_end += 2;
     }
     if (*qstr_end != '"') {
         // strict parsing, ignore malformed string
-        if (!pw_string_truncate(result, 0)) {
-            return false;
-        }
-    } else {
-        if (!pw_string_append(result, qstr_start, qstr_end)) {
-            return false;
-        }
-        qstr_end++;  // skip closing quote
+        *current_char = qstr_end;
+        return false;
     }
-    *current_char = qstr_end;
+    *result = (StrView) { qstr_start, qstr_end - qstr_start };
+    *current_char = qstr_end + 1;  // skip closing quote
     return true;
 }
 
-static inline bool is_mime_charsetc(char c)
+static bool parse_ext_value(char** current_char, HeaderParam* param)
 /*
- * mime-charsetc = ALPHA / DIGIT
- *                 / "!" / "#" / "$" / "%" / "&"
- *                 / "+" / "-" / "^" / "_" / "`"
- *                 / "{" / "}" / "~"
- *                 ; as <mime-charset> in Section 2.3 of [RFC2978]
- *                 ; except that the single quote is not included
- *                 ; SHOULD be registered in the IANA charset registry
+ * current_char must point to the first non-space character
+ *
+ * ext-value           = charset  "'" [ language ] "'" value-chars
+ *
+ * charset             = "UTF-8" / "ISO-8859-1" / mime-charset
+ *
+ * mime-charset        = 1*mime-charsetc
+ *
+ * mime-charsetc       = ALPHA / DIGIT
+ *                       / "!" / "#" / "$" / "%" / "&"
+ *                       / "+" / "-" / "^" / "_" / "`"
+ *                       / "{" / "}" / "~"
+ *                       ; as <mime-charset> in Section 2.3 of [RFC2978]
+ *                       ; except that the single quote is not included
+ *                       ; SHOULD be registered in the IANA charset registry
+ *
+ * language            = <Language-Tag, defined in [RFC5646], Section 2.1>
+ *
+ * Return false if ext-value is malformed.
  */
 {
-    if (isalnum(c)) {
-        return true;
-    }
-    switch (c) {
-        case '!':  case '#':  case '$':  case '%':  case '&':
-        case '+':  case '-':  case '^':  case '_':  case '`':
-        case '{':  case '}':  case '~':
-            return true;
-        default:
-            return false;
+    char* charset_ptr = *current_char;
+    char* ptr = curl_scan(charset_ptr, &curl_scan_charset);
+
+    *current_char = ptr;
+    if (*ptr != '\'') {
+        // malformed ext-value
+        return false;
     }
-}
+    param->charset = (StrView) { charset_ptr, ptr - charset_ptr };
 
-static inline char xdigit_to_num(char** current_char)
-{
-    char c = **current_char;
+    char* language_ptr = ++ptr;
 
-    if (!isxdigit(c)) {
-        return 0;
+    // get language tag by simply searching closing single quote
+    while (*ptr != '\'' && *ptr != 0) {
+        ptr++;
     }
-    (*current_char)++;
-    if (isdigit(c)) {
-        return c - '0';
-    } else if (islower(c)) {
-        return 10 + c - 'a';
-    } else {
-        return 10 + c - 'A';
+    *current_char = ptr;
+    if (*ptr != '\'') {
+        // malformed ext-value
+        return false;
     }
+    param->language = (StrView) { language_ptr, ptr - language_ptr };
+
+    char* value_ptr = ++ptr;
+    for (;;) {
+        ptr = curl_scan(ptr, &curl_scan_attr);
+        if (*ptr != '%' || curl_hex_value[(unsigned char) ptr[1]] < 0 || curl_hex_value[(unsigned char) ptr[2]] < 0) {
+            break;
+        }
+        ptr += 3;
+    }
+
+    param->value = (StrView) { value_ptr, ptr - value_ptr };
+    param->kind = PARAM_EXT;
+    *current_char = ptr;
+    return true;
 }
 
-static inline char32_t parse_value_char(char** current_char)
+static void parse_parameters(char** current_char, ParsedHeader* result, bool allow_ext)
 /*
- * value-chars = *( pct-encoded / attr-char )
+ * parameters = *( OWS ";" OWS parameter )
+ * parameter  = token "=" ( token / quoted-string )
  *
- * pct-encoded = "%" HEXDIG HEXDIG
- *               ; see [RFC3986], Section 2.1
+ * if allow_ext:
+ *
+ * parameter  =/ ext-token "=" ext-value
+ * ext-token  = <the characters in token, followed by "*">
  *
- * attr-char   = ALPHA / DIGIT
- *               / "!" / "#" / "$" / "&" / "+" / "-" / "."
- *               / "^" / "_" / "`" / "|" / "~"
- *               ; token except ( "*" / "'" / "%" )
+ * XXX: replaced OWS with LWSP
  */
 {
-    char c = **current_char;
+    result->num_params = 0;
 
-    if (isalnum(c)) {
+    while (result->num_params < MAX_HEADER_PARAMS) {
+        skip_lwsp(current_char);
+        if (**current_char == 0) {
+            break;
+        }
+        if (**current_char != ';') {
+            // malformed header, but we've got as most as we could, haven't we?
+            break;
+        }
         (*current_char)++;
-        return c;
-    }
-    switch (c) {
-        case '!':  case '#':  case '$':  case '&':  case '+':  case '-':  case '.':
-        case '^':  case '_':  case '`':  case '|':  case '~':
-            (*current_char)++;
-            return c;
-        case '%':
+        skip_lwsp(current_char);
+
+        HeaderParam* param = &result->params[result->num_params];
+        param->kind = PARAM_TOKEN;
+
+        // asterisk is a token char, check if it terminates the name
+        param->name = parse_token(current_char);
+        bool is_ext_value = false;
+        if (allow_ext && param->name.length > 1 && param->name.ptr[param->name.length - 1] == '*') {
+            is_ext_value = true;
+            param->name.length--;
+        }
+        skip_lwsp(current_char);
+        if (**current_char != '=') {
             break;
-        default:
-            return 0;
-    }
-    // pct-encoded
-    (*current_char)++;
-    char high_nibble = xdigit_to_num(current_char);
-    if (high_nibble == 0) {
-        return 0;
-    }
-    c = xdigit_to_num(current_char);
-    if (c == 0) {
-        return 0;
+        }
+        (*current_char)++;
+        skip_lwsp(current_char);
+
+        if (**current_char == 0) {
+            break;
+        }
+        if (is_ext_value) {
+            if (!parse_ext_value(current_char, param)) {
+                break;
+            }
+        } else if (**current_char == '"') {
+            if (!parse_quoted_string(current_char, &param->value)) {
+                break;
+            }
+            param->kind = PARAM_QUOTED;
+        } else {
+            param->value = parse_token(current_char);
+        }
+        result->num_params++;
     }
-    return (((char32_t) high_nibble) << 4) | c;
 }
 
-[[nodiscard]] static bool parse_ext_value(char** current_char, PwValuePtr result)
+static bool parse_media_type(char** current_char, ParsedHeader* result)
 /*
- * current_char must point to the first non-space character
+ * https://datatracker.ietf.org/doc/html/rfc7231#section-3.1.1.1
  *
- * ext-value           = charset  "'" [ language ] "'" value-chars
+ * media-type = type "/" subtype *( OWS ";" OWS parameter )
+ * type       = token
+ * subtype    = token
  *
- * charset             = "UTF-8" / "ISO-8859-1" / mime-charset
+ * parameter  = token "=" ( token / quoted-string )
+ */
+{
+    result->type = parse_token(current_char);
+    if (**current_char != '/') {
+        return false;
+    }
+    (*current_char)++;
+
+    result->subtype = parse_token(current_char);
+    parse_parameters(current_char, result, false);
+    return true;
+}
+
+static bool parse_content_disposition(char** current_char, ParsedHeader* result)
+/*
+ * content-disposition = "Content-Disposition" ":"
+ *                             disposition-type *( ";" disposition-parm )
  *
- * mime-charset        = 1*mime-charsetc
+ * disposition-type    = "inline" | "attachment" | disp-ext-type
+ *                       ; case-insensitive
  *
- * language            = <Language-Tag, defined in [RFC5646], Section 2.1>
+ * disp-ext-type       = token
  *
- * Return string or null value if not a quoted string.
+ * disposition-parm    = filename-parm | disp-ext-parm
+ *
+ * filename-parm       = "filename" "=" value
+ *                     | "filename*" "=" ext-value
+ *
+ * disp-ext-parm       = token "=" value
+ *                     | ext-token "=" ext-value
+ *
+ * ext-token           = <the characters in token, followed by "*">
+ */
+{
+    result->type = parse_token(current_char);
+    result->subtype = (StrView) {};
+    parse_parameters(current_char, result, true);
+    return true;
+}
+
+/*
+ * Materializing parsed headers
+ */
+
+[[nodiscard]] static bool view_to_string(StrView* view, PwValuePtr result)
+{
+    PwValue str = PW_STRING("");
+    if (!pw_string_append(&str, view->ptr, view->ptr + view->length)) {
+        return false;
+    }
+    pw_move(&str, result);
+    return true;
+}
+
+[[nodiscard]] static bool view_to_atom(StrView* view, CurlAtom** atom, PwValuePtr result)
+/*
+ * Make lowercased string from case-insensitive token, interning it.
+ * Interned tokens refer to atom names instead of making new strings.
+ */
+{
+    *atom = curl_atom(view->ptr, view->length);
+    if (*atom) {
+        pw_destroy(result);
+        *result = PwString((*atom)->name);
+        return true;
+    }
+    return view_to_string(view, result) && pw_string_lower(result);
+}
+
+[[nodiscard]] static bool token_to_string(StrView* view, PwValuePtr result)
+/*
+ * Make string from parameter value. Values are arbitrary, so they are
+ * not interned, but well-known ones like utf-8 refer to existing atoms.
+ */
+{
+    CurlAtom* atom = curl_atom_find(view->ptr, view->length);
+    if (atom) {
+        pw_destroy(result);
+        *result = PwString(atom->name);
+        return true;
+    }
+    return view_to_string(view, result);
+}
+
+[[nodiscard]] static bool unquote_string(StrView* view, PwValuePtr result)
+/*
+ * Make string from the content of quoted-string, removing quote chars.
+ */
+{
+    PwValue str = PW_STRING("");
+    char* start = view->ptr;
+    char* end = start + view->length;
+    for (char* p = start; p < end; p++) {
+        if (*p == '\\') {
+            // append what we've got and skip quote char
+            if (!pw_string_append(&str, start, p)) {
+                return false;
+            }
+            start = ++p;
+        }
+    }
+    if (!pw_string_append(&str, start, end)) {
+        return false;
+    }
+    pw_move(&str, result);
+    return true;
+}
+
+[[nodiscard]] static bool decode_ext_value(HeaderParam* param, PwValuePtr result)
+/*
+ * Make map containing charset, language, and decoded value.
+ *
+ * value-chars = *( pct-encoded / attr-char )
+ * pct-encoded = "%" HEXDIG HEXDIG
+ *
+ * The value is already validated by parse_ext_value.
+ * Decoded bytes are transcoded from the declared charset.
+ */
+{
+    char charset_name[40];
+    unsigned charset_length = param->charset.length;
+    if (charset_length >= sizeof(charset_name)) {
+        charset_length = 0;
+    }
+    for (unsigned i = 0; i < charset_length; i++) {
+        char c = param->charset.ptr[i];
+        charset_name[i] = ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+    }
+    charset_name[charset_length] = 0;
+
+    PwValue value = PW_NULL;
+    if (!pw_create_empty_string(param->value.length + 1, 1, &value)) {
+        return false;
+    }
+    if (!curl_percent_decode(param->value.ptr, param->value.ptr + param->value.length, charset_name, &value)) {
+        return false;
+    }
+    PwValue charset = PW_NULL;
+    if (!token_to_string(&param->charset, &charset)) {
+        return false;
+    }
+    PwValue language = PW_NULL;
+    if (!view_to_string(&param->language, &language)) {
+        return false;
+    }
+    return pw_map_va(
+        result,
+        PwString("charset"),  pw_clone(&charset),
+        PwString("language"), pw_clone(&language),
+        PwString("value"),    pw_clone(&value)
+    );
+}
+
+[[nodiscard]] static bool materialize_params(ParsedHeader* parsed, PwValuePtr result)
+/*
+ * Make map of parameters with lowercased names.
+ * Ext-values are preferred over plain values of the same parameter (RFC 6266, 4.3)
+ * so they are processed on the second pass.
+ */
+{
+    PwValue params = PW_NULL;
+    if (!pw_create_map(&params)) {
+        return false;
+    }
+    for (unsigned i = 0; i < parsed->num_params * 2; i++) {{
+        HeaderParam* param = &parsed->params[i % parsed->num_params];
+        if ((param->kind == PARAM_EXT) != (i >= parsed->num_params)) {
+            continue;
+        }
+
+        PwValue param_name = PW_NULL;
+        CurlAtom* name_atom;
+        if (!view_to_atom(&param->name, &name_atom, &param_name)) {
+            return false;
+        }
+        PwValue param_value = PW_NULL;
+        switch (param->kind) {
+            case PARAM_TOKEN:
+                if (!token_to_string(&param->value, &param_value)) {
+                    return false;
+                }
+                break;
+            case PARAM_QUOTED:
+                if (!unquote_string(&param->value, &param_value)) {
+                    return false;
+                }
+                break;
+            case PARAM_EXT:
+                if (!decode_ext_value(param, &param_value)) {
+                    return false;
+                }
+                break;
+        }
+        if (!pw_map_update(&params, &param_name, &param_value)) {
+            return false;
+        }
+    }}
+    pw_move(&params, result);
+    return true;
+}
+
+static bool view_equal_nocase(StrView* view, char* str)
+/*
+ * Compare view with lowercase str.
+ */
+{
+    unsigned length = strlen(str);
+    return view->length == length && header_name_equal(view->ptr, str, length);
+}
+
+static inline int last_hop(CurlRequestData* req)
+{
+    return ((int) req->header_index.num_hops) - 1;
+}
+
+void curl_request_parse_content_type(CurlRequestData* req)
+/*
+ * Parse content-type header
+ */
+{
+    req->parsed_headers |= CURL_PARSED_CONTENT_TYPE;
+
+    // drop results for previous response of redirect chain
+    pw_destroy(&req->media_type_params);
+    pw_destroy(&req->media_type);
+    pw_destroy(&req->media_subtype);
+    req->media_type    = PwString("");
+    req->media_subtype = PwString("");
+    req->media_type_atom    = nullptr;
+    req->media_subtype_atom = nullptr;
+
+    char* content_type = curl_request_get_header(req, "Content-Type", last_hop(req));
+    if (!content_type) {
+        return;
+    }
+    char* ct = content_type;
+    ParsedHeader parsed;
+    if (!parse_media_type(&ct, &parsed)) {
+        fprintf(stderr, "WARNING: failed to parse content type %s\n", content_type);
+        return;
+    }
+    PwValue media_type = PW_NULL;
+    PwValue media_subtype = PW_NULL;
+    PwValue params = PW_NULL;
+    CurlAtom* type_atom;
+    CurlAtom* subtype_atom;
+    if (!view_to_atom(&parsed.type, &type_atom, &media_type)
+        || !view_to_atom(&parsed.subtype, &subtype_atom, &media_subtype)
+        || !materialize_params(&parsed, &params)) {
+        fprintf(stderr, "WARNING: failed to parse content type %s\n", content_type);
+        return;
+    }
+    req->media_type_atom    = type_atom;
+    req->media_subtype_atom = subtype_atom;
+    pw_move(&media_type,    &req->media_type);
+    pw_move(&media_subtype, &req->media_subtype);
+    pw_move(&params,        &req->media_type_params);
+}
+
+unsigned curl_request_get_charset(CurlRequestData* req, char* charset, unsigned size)
+{
+    char* content_type = curl_request_get_header(req, "Content-Type", last_hop(req));
+    if (!content_type) {
+        return 0;
+    }
+    ParsedHeader parsed;
+    if (!parse_media_type(&content_type, &parsed)) {
+        return 0;
+    }
+    for (unsigned i = 0; i < parsed.num_params; i++) {
+        HeaderParam* param = &parsed.params[i];
+        if (view_equal_nocase(&param->name, "charset")) {
+            if (param->value.length == 0 || param->value.length >= size) {
+                return 0;
+            }
+            for (unsigned j = 0; j < param->value.length; j++) {
+                char c = param->value.ptr[j];
+                charset[j] = ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+            }
+            charset[param->value.length] = 0;
+            return param->value.length;
+        }
+    }
+    return 0;
+}
+
+void curl_request_parse_content_disposition(CurlRequestData* req)
+/*
+ * Parse content-disposition header
  */
 {
-    char* charset_ptr = *current_char;
-    char* language_ptr = *current_char;
+    req->parsed_headers |= CURL_PARSED_CONTENT_DISPOSITION;
+
+    pw_destroy(&req->disposition_type);
+    pw_destroy(&req->disposition_params);
+    req->disposition_type_atom = nullptr;
+
+    char* content_disposition = curl_request_get_header(req, "Content-Disposition", -1);
+    if (!content_disposition) {
+        return;
+    }
+    char* p = content_disposition;
+    ParsedHeader parsed;
+    parse_content_disposition(&p, &parsed);
+
+    PwValue disposition_type = PW_NULL;
+    PwValue params = PW_NULL;
+    CurlAtom* type_atom;
+    if (!view_to_atom(&parsed.type, &type_atom, &disposition_type)
+        || !materialize_params(&parsed, &params)) {
+        fprintf(stderr, "WARNING: failed to parse content dispostion %s\n", content_disposition);
+        return;
+    }
+    req->disposition_type_atom = type_atom;
+    pw_move(&disposition_type, &req->disposition_type);
+    pw_move(&params,           &req->disposition_params);
+}
+
+void curl_request_parse_headers(CurlRequestData* req)
+{
+    curl_request_parse_content_type(req);
+    curl_request_parse_content_disposition(req);
+}
+
+PwValuePtr curl_request_media_type(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_TYPE)) {
+        curl_request_parse_content_type(req);
+    }
+    return &req->media_type;
+}
+
+PwValuePtr curl_request_media_subtype(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_TYPE)) {
+        curl_request_parse_content_type(req);
+    }
+    return &req->media_subtype;
+}
+
+PwValuePtr curl_request_media_type_params(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_TYPE)) {
+        curl_request_parse_content_type(req);
+    }
+    return &req->media_type_params;
+}
+
+PwValuePtr curl_request_disposition_type(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_DISPOSITION)) {
+        curl_request_parse_content_disposition(req);
+    }
+    return &req->disposition_type;
+}
+
+PwValuePtr curl_request_disposition_params(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_DISPOSITION)) {
+        curl_request_parse_content_disposition(req);
+    }
+    return &req->disposition_params;
+}
+
+CurlAtom* curl_request_media_type_atom(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_TYPE)) {
+        curl_request_parse_content_type(req);
+    }
+    return req->media_type_atom;
+}
+
+CurlAtom* curl_request_media_subtype_atom(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_TYPE)) {
+        curl_request_parse_content_type(req);
+    }
+    return req->media_subtype_atom;
+}
+
+CurlAtom* curl_request_disposition_type_atom(CurlRequestData* req)
+{
+    if (!(req->parsed_headers & CURL_PARSED_CONTENT_DISPOSITION)) {
+        curl_request_parse_content_disposition(req);
+    }
+    return req->disposition_type_atom;
+}
+
+/*
+ * Extended headers
+ */
+
+static unsigned get_headers(CurlRequestData* req, char* name, int hop, char** values, unsigned max_values)
+/*
+ * Collect values of all headers with given name in the order of arrival.
+ * Return number of values, at most max_values last ones.
+ */
+{
+    CurlHeaderIndex* index = &req->header_index;
+    unsigned n = 0;
+    for (CurlHeader* hdr = curl_header_index_get(index, name, hop); hdr && n < max_values; ) {
+        // going from the last one, so excess headers are dropped from the beginning
+        values[n++] = &index->buffer[hdr->value];
+        if (!hdr->prev) {
+            break;
+        }
+        CurlHeader* prev = &index->headers[hdr->prev - 1];
+        if (prev->hop != hdr->hop) {
+            break;
+        }
+        hdr = prev;
+    }
+    // collected backwards, reverse
+    for (unsigned i = 0; i < n / 2; i++) {
+        char* v = values[i];
+        values[i] = values[n - 1 - i];
+        values[n - 1 - i] = v;
+    }
+    return n;
+}
+
+static bool parse_number(char** current_char, curl_off_t* result)
+/*
+ * 1*DIGIT, return false if there are no digits or the number overflows.
+ */
+{
+    char* ptr = *current_char;
+    if (!('0' <= *ptr && *ptr <= '9')) {
+        return false;
+    }
+    curl_off_t n = 0;
+    while ('0' <= *ptr && *ptr <= '9') {
+        int digit = *ptr++ - '0';
+        if (n > (INT64_MAX - digit) / 10) {
+            return false;
+        }
+        n = n * 10 + digit;
+    }
+    *current_char = ptr;
+    *result = n;
+    return true;
+}
+
+static long view_to_delta_seconds(StrView* view)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc9111#section-1.2.2
+ *
+ * delta-seconds = 1*DIGIT
+ *
+ * Values greater than 2^31 are replaced with 2^31 as the spec recommends.
+ * Return -1 if view is not a number.
+ */
+{
+    if (view->length == 0) {
+        return -1;
+    }
+    long n = 0;
+    for (unsigned i = 0; i < view->length; i++) {
+        char c = view->ptr[i];
+        if (!('0' <= c && c <= '9')) {
+            return -1;
+        }
+        if (n < 2147483648L) {
+            n = n * 10 + (c - '0');
+        }
+    }
+    return (n > 2147483648L)? 2147483648L : n;
+}
+
+static inline bool skip_list_delimiter(char** current_char)
+/*
+ * Skip OWS "," OWS between list elements. Return false at the end of string.
+ */
+{
+    skip_lwsp(current_char);
+    while (**current_char == ',') {
+        (*current_char)++;
+        skip_lwsp(current_char);
+    }
+    return **current_char != 0;
+}
+
+static void parse_cache_control(char** current_char, CurlCacheControl* cc)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc9111#section-5.2
+ *
+ * Cache-Control   = #cache-directive
+ * cache-directive = token [ "=" ( token / quoted-string ) ]
+ */
+{
+    while (skip_list_delimiter(current_char)) {
+
+        StrView name = parse_token(current_char);
+        if (name.length == 0) {
+            // malformed directive, skip to the next one
+            while (**current_char != ',' && **current_char != 0) {
+                (*current_char)++;
+            }
+            continue;
+        }
+        StrView arg = { *current_char, 0 };
+        skip_lwsp(current_char);
+        if (**current_char == '=') {
+            (*current_char)++;
+            skip_lwsp(current_char);
+            if (**current_char == '"') {
+                if (!parse_quoted_string(current_char, &arg)) {
+                    return;
+                }
+            } else {
+                arg = parse_token(current_char);
+            }
+        }
+
+        if (view_equal_nocase(&name, "max-age")) {
+            cc->max_age = view_to_delta_seconds(&arg);
+        } else if (view_equal_nocase(&name, "s-maxage")) {
+            cc->s_maxage = view_to_delta_seconds(&arg);
+        } else if (view_equal_nocase(&name, "no-cache")) {
+            cc->no_cache = true;
+        } else if (view_equal_nocase(&name, "no-store")) {
+            cc->no_store = true;
+        } else if (view_equal_nocase(&name, "no-transform")) {
+            cc->no_transform = true;
+        } else if (view_equal_nocase(&name, "must-revalidate")) {
+            cc->must_revalidate = true;
+        } else if (view_equal_nocase(&name, "proxy-revalidate")) {
+            cc->proxy_revalidate = true;
+        } else if (view_equal_nocase(&name, "public")) {
+            cc->is_public = true;
+        } else if (view_equal_nocase(&name, "private")) {
+            cc->is_private = true;
+        } else if (view_equal_nocase(&name, "immutable")) {
+            cc->immutable = true;
+        } else if (view_equal_nocase(&name, "stale-while-revalidate")) {
+            cc->stale_while_revalidate = view_to_delta_seconds(&arg);
+        } else if (view_equal_nocase(&name, "stale-if-error")) {
+            cc->stale_if_error = view_to_delta_seconds(&arg);
+        }
+    }
+}
+
+static bool parse_content_range(char** current_char, CurlContentRange* range)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc9110#section-14.4
+ *
+ * Content-Range       = range-unit SP ( range-resp / unsatisfied-range )
+ * range-resp          = incl-range "/" ( complete-length / "*" )
+ * incl-range          = first-pos "-" last-pos
+ * unsatisfied-range   = "*" "/" complete-length
+ */
+{
+    StrView unit = parse_token(current_char);
+    if (!view_equal_nocase(&unit, "bytes")) {
+        return false;
+    }
+    skip_lwsp(current_char);
+
+    if (**current_char == '*') {
+        (*current_char)++;
+        range->unsatisfied = true;
+        range->first = -1;
+        range->last = -1;
+    } else {
+        if (!parse_number(current_char, &range->first)) {
+            return false;
+        }
+        if (**current_char != '-') {
+            return false;
+        }
+        (*current_char)++;
+        if (!parse_number(current_char, &range->last)) {
+            return false;
+        }
+        if (range->last < range->first) {
+            return false;
+        }
+    }
+    if (**current_char != '/') {
+        return false;
+    }
+    (*current_char)++;
+    if (**current_char == '*' && !range->unsatisfied) {
+        (*current_char)++;
+        range->complete_length = -1;
+    } else {
+        if (!parse_number(current_char, &range->complete_length)) {
+            return false;
+        }
+        if (!range->unsatisfied && range->last >= range->complete_length) {
+            return false;
+        }
+    }
+    return true;
+}
+
+static bool parse_entity_tag(char** current_char, StrView* result, bool* weak)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc9110#section-8.8.3
+ *
+ * entity-tag = [ weak ] opaque-tag
+ * weak       = %s"W/"
+ * opaque-tag = DQUOTE *etagc DQUOTE
+ * etagc      = %x21 / %x23-7E / obs-text
+ *
+ * Result includes weak prefix and quotes.
+ */
+{
+    char* start = *current_char;
+    char* ptr = start;
+    *weak = false;
+    if (ptr[0] == 'W' && ptr[1] == '/') {
+        *weak = true;
+        ptr += 2;
+    }
+    if (*ptr != '"') {
+        return false;
+    }
+    ptr++;
+    while (*ptr != '"') {
+        unsigned char c = *ptr;
+        if (c <= 0x20 || c == 0x7F) {
+            return false;
+        }
+        ptr++;
+    }
+    ptr++;
+    *result = (StrView) { start, ptr - start };
+    *current_char = ptr;
+    return true;
+}
+
+[[nodiscard]] static bool parse_link(char** current_char, PwValuePtr links)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc8288#section-3
+ *
+ * Link       = #link-value
+ * link-value = "<" URI-Reference ">" *( OWS ";" OWS link-param )
+ * link-param = token BWS [ "=" BWS ( token / quoted-string ) ]
+ *
+ * Append maps to links array. Return false on allocation errors only,
+ * malformed values are skipped.
+ */
+{
+    while (skip_list_delimiter(current_char)) {
+
+        if (**current_char != '<') {
+            return true;
+        }
+        char* url_start = ++(*current_char);
+        while (**current_char != '>' && **current_char != 0) {
+            (*current_char)++;
+        }
+        if (**current_char != '>') {
+            return true;
+        }
+        StrView url = { url_start, *current_char - url_start };
+        (*current_char)++;
+
+        ParsedHeader parsed;
+        parse_parameters(current_char, &parsed, true);
+
+        PwValue link = PW_NULL;
+        if (!materialize_params(&parsed, &link)) {
+            return false;
+        }
+        PwValue url_value = PW_NULL;
+        if (!view_to_string(&url, &url_value)) {
+            return false;
+        }
+        PwValue url_key = PwString("url");
+        if (!pw_map_update(&link, &url_key, &url_value)) {
+            return false;
+        }
+        if (pw_is_null(links)) {
+            if (!pw_create_array(links)) {
+                return false;
+            }
+        }
+        if (!pw_array_append(links, &link)) {
+            return false;
+        }
+        // parse_parameters stops at comma or at malformed parameter
+        while (**current_char != ',' && **current_char != 0) {
+            (*current_char)++;
+        }
+    }
+    return true;
+}
+
+void curl_request_hop_cache_control(CurlRequestData* req, int hop, CurlCacheControl* cc)
+{
+    *cc = (CurlCacheControl) {
+        .max_age = -1,
+        .s_maxage = -1,
+        .stale_while_revalidate = -1,
+        .stale_if_error = -1
+    };
+    char* values[16];
+    unsigned n = get_headers(req, "Cache-Control", hop, values, PW_LENGTH(values));
+    for (unsigned i = 0; i < n; i++) {
+        char* p = values[i];
+        parse_cache_control(&p, cc);
+    }
+    cc->present = n > 0;
+}
+
+CurlCacheControl* curl_request_cache_control(CurlRequestData* req)
+{
+    if (req->parsed_headers & CURL_PARSED_CACHE_CONTROL) {
+        return &req->cache_control;
+    }
+    req->parsed_headers |= CURL_PARSED_CACHE_CONTROL;
 
-    for (;;) {
-        if (!is_mime_charsetc(*charset_ptr)) {
-            break;
-        }
-        charset_ptr++;
+    curl_request_hop_cache_control(req, last_hop(req), &req->cache_control);
+    return &req->cache_control;
+}
+
+CurlContentRange* curl_request_content_range(CurlRequestData* req)
+{
+    if (req->parsed_headers & CURL_PARSED_CONTENT_RANGE) {
+        return &req->content_range;
     }
+    req->parsed_headers |= CURL_PARSED_CONTENT_RANGE;
 
-    pw_destroy(result);  // this makes result Null
+    CurlContentRange* range = &req->content_range;
+    *range = (CurlContentRange) {};
 
-    *current_char = language_ptr;
-    if (*language_ptr != '\'') {
-        // malformed ext-value
-        return true;
-    };
+    char* content_range = curl_request_get_header(req, "Content-Range", last_hop(req));
+    if (!content_range) {
+        return range;
+    }
+    char* p = content_range;
+    if (parse_content_range(&p, range)) {
+        range->present = true;
+    } else {
+        fprintf(stderr, "WARNING: failed to parse content range %s\n", content_range);
+        *range = (CurlContentRange) {};
+    }
+    return range;
+}
+
+CurlValidators* curl_request_validators(CurlRequestData* req)
+{
+    CurlValidators* validators = &req->validators;
 
-    *language_ptr++ = 0;  // terminate charset part
+    if (req->parsed_headers & CURL_PARSED_VALIDATORS) {
+        return validators;
+    }
+    req->parsed_headers |= CURL_PARSED_VALIDATORS;
 
-    char* value_ptr = language_ptr;
+    pw_destroy(&validators->etag);
+    validators->etag_weak = false;
+    validators->last_modified = -1;
 
-    // get language tag by simply searching closing single quote
-    for (;;) {
-        char c = *value_ptr;
-        if (c == '\'' || c == 0) {
-            break;
+    char* etag = curl_request_get_header(req, "ETag", last_hop(req));
+    if (etag) {
+        char* p = etag;
+        StrView tag;
+        bool weak;
+        if (parse_entity_tag(&p, &tag, &weak)) {
+            if (view_to_string(&tag, &validators->etag)) {
+                validators->etag_weak = weak;
+            }
+        } else {
+            fprintf(stderr, "WARNING: failed to parse etag %s\n", etag);
         }
-        value_ptr++;
     }
-    *current_char = value_ptr;
+    char* last_modified = curl_request_get_header(req, "Last-Modified", last_hop(req));
+    if (last_modified) {
+        validators->last_modified = curl_getdate(last_modified, nullptr);
+    }
+    return validators;
+}
 
-    if (*value_ptr != '\'') {
-        // malformed ext-value
-        return true;
+long curl_request_retry_after(CurlRequestData* req)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc9110#section-10.2.3
+ *
+ * Retry-After = HTTP-date / delay-seconds
+ */
+{
+    if (req->parsed_headers & CURL_PARSED_RETRY_AFTER) {
+        return req->retry_after;
     }
-    *value_ptr++ = 0;  // terminate language part
-    *current_char = value_ptr;
+    req->parsed_headers |= CURL_PARSED_RETRY_AFTER;
+    req->retry_after = -1;
 
-    PwValue value = PW_NULL;
-    if (!pw_create_empty_string(strlen(value_ptr) + 1, 1, &value)) {
-        return false;
+    char* retry_after = curl_request_get_header(req, "Retry-After", last_hop(req));
+    if (!retry_after) {
+        return -1;
     }
-    for (;;) {
-        char32_t c = parse_value_char(current_char);
-        if (c == 0) {
-            break;
-        }
-        if (!pw_string_append(&value, c)) {
-            return false;
-        }
+    StrView delay = { retry_after, strlen(retry_after) };
+    req->retry_after = view_to_delta_seconds(&delay);
+    if (req->retry_after >= 0) {
+        return req->retry_after;
     }
-    PwValue charset = PW_NULL;
-    if (!pw_create_string(charset_ptr, &charset)) {
-        return false;
+    time_t retry_time = curl_getdate(retry_after, nullptr);
+    if (retry_time == -1) {
+        fprintf(stderr, "WARNING: failed to parse retry-after %s\n", retry_after);
+        return -1;
     }
-    PwValue language = PW_NULL;
-    if (!pw_create_string(language_ptr, &language)) {
-        return false;
+    time_t now = -1;
+    char* date = curl_request_get_header(req, "Date", last_hop(req));
+    if (date) {
+        now = curl_getdate(date, nullptr);
     }
-    return pw_map_va(
-        result,
-        PwString("charset"),  pw_clone(&charset),
-        PwString("language"), pw_clone(&language),
-        PwString("value"),    pw_clone(&value)
-    );
+    if (now == -1) {
+        now = time(nullptr);
+    }
+    req->retry_after = (retry_time > now)? retry_time - now : 0;
+    return req->retry_after;
 }
 
-[[nodiscard]] static bool parse_media_type(char** current_char, CurlRequestData* req)
+long curl_request_age(CurlRequestData* req)
 /*
- * https://datatracker.ietf.org/doc/html/rfc7231#section-3.1.1.1
- *
- * media-type = type "/" subtype *( OWS ";" OWS parameter )
- * type       = token
- * subtype    = token
- *
- * parameter  = token "=" ( token / quoted-string )
+ * https://datatracker.ietf.org/doc/html/rfc9111#section-5.1
  *
- * XXX: replaced OWS with LWSP
+ * Age = delta-seconds
  */
 {
-    PwValue media_type = PW_NULL;
-    if (!parse_token(current_char, &media_type)) {
-        return false;
-    }
-    if (**current_char == 0) {
-        pw_set_status(PwStatus(PW_ERROR));
-        return false;
+    if (req->parsed_headers & CURL_PARSED_AGE) {
+        return req->age;
     }
-    if (**current_char != '/') {
-        pw_set_status(PwStatus(PW_ERROR_EOF));
-        return false;
-    }
-    (*current_char)++;
+    req->parsed_headers |= CURL_PARSED_AGE;
 
-    PwValue media_subtype = PW_NULL;
-    if (!parse_token(current_char, &media_subtype)) {
-        return false;
+    char* age = curl_request_get_header(req, "Age", last_hop(req));
+    if (!age) {
+        req->age = -1;
+        return -1;
     }
+    StrView view = { age, strlen(age) };
+    req->age = view_to_delta_seconds(&view);
+    return req->age;
+}
 
-    PwValue params = PW_NULL;
-    if (!pw_create_map(&params)) {
+static bool parse_alt_authority(StrView* authority, CurlAltSvc* service)
+/*
+ * alt-authority content = [ uri-host ] ":" port
+ */
+{
+    char* start = authority->ptr;
+    char* end = start + authority->length;
+    char* colon = end;
+    while (colon > start && colon[-1] != ':' && colon[-1] != ']') {
+        colon--;
+    }
+    if (colon == start || colon[-1] != ':' || colon == end || end - colon > 5) {
         return false;
     }
-    for (;;) {
-        skip_lwsp(current_char);
-        if (**current_char == 0) {
-            break;
+    unsigned port = 0;
+    for (char* p = colon; p < end; p++) {
+        if (!('0' <= *p && *p <= '9')) {
+            return false;
         }
-        if (**current_char != ';') {
-            // malformed header, but we've got as most as we could, haven't we?
-            break;
+        port = port * 10 + (*p - '0');
+    }
+    if (port == 0 || port > 65535) {
+        return false;
+    }
+    service->port = port;
+    char* host_end = colon - 1;
+    if (host_end > start) {
+        if (*start == '[' && host_end[-1] == ']') {
+            // IPv6 literal, keep it without brackets
+            start++;
+            host_end--;
         }
-        (*current_char)++;
-        skip_lwsp(current_char);
-        {
-            PwValue param_name = PW_NULL;
-            if (!parse_token(current_char, &param_name)) {
-                return false;
-            }
-            skip_lwsp(current_char);
-            if (**current_char != '=') {
-                break;
-            }
-            (*current_char)++;
-            skip_lwsp(current_char);
-
-            if (**current_char == 0) {
-                break;
-            }
-
-            PwValue param_value = PW_NULL;
-            if (**current_char == '"') {
-                if (!parse_quoted_string(current_char, &param_value)) {
-                    return false;
-                }
-            } else {
-                if (!parse_token(current_char, &param_value)) {
-                    return false;
-                }
-            }
-            if (!pw_is_string(&param_value)) {
-                break;
-            }
-
-            if (!pw_string_lower(&param_name)) {
-                return false;
-            }
-            if (!pw_map_update(&params, &param_name, &param_value)) {
+        for (char* p = start; p < host_end; p++) {
+            if (*p == '\\' || *p == '[' || *p == ']') {
                 return false;
             }
         }
+        service->host = start;
+        service->host_length = host_end - start;
     }
-    pw_move(&media_type,    &req->media_type);
-    pw_move(&media_subtype, &req->media_subtype);
-    pw_move(&params,        &req->media_type_params);
     return true;
 }
 
-[[nodiscard]] static bool parse_content_disposition(char** current_char, CurlRequestData* req)
+static unsigned parse_alt_svc(char** current_char, CurlAltSvc* services, unsigned n, unsigned max_services, bool* clear)
 /*
- * content-disposition = "Content-Disposition" ":"
- *                             disposition-type *( ";" disposition-parm )
- *
- * disposition-type    = "inline" | "attachment" | disp-ext-type
- *                       ; case-insensitive
- *
- * disp-ext-type       = token
- *
- * disposition-parm    = filename-parm | disp-ext-parm
- *
- * filename-parm       = "filename" "=" value
- *                     | "filename*" "=" ext-value
+ * https://datatracker.ietf.org/doc/html/rfc7838#section-3
  *
- * disp-ext-parm       = token "=" value
- *                     | ext-token "=" ext-value
+ * Alt-Svc       = clear / 1#alt-value
+ * clear         = %s"clear"
+ * alt-value     = alternative *( OWS ";" OWS parameter )
+ * alternative   = protocol-id "=" alt-authority
+ * protocol-id   = token
+ * alt-authority = quoted-string
+ * parameter     = token "=" ( token / quoted-string )
  *
- * ext-token           = <the characters in token, followed by "*">
+ * Append parsed alternatives to services, return their number.
  */
 {
-    PwValue disposition_type = PW_NULL;
-    if (!parse_token(current_char, &disposition_type)) {
-        return false;
-    }
-    if (!pw_string_lower(&disposition_type)) {
-        return false;
-    }
-    PwValue params = PW_NULL;
-    if (!pw_create_map(&params)) {
-        return false;
-    }
-    for (;;) {
+    while (skip_list_delimiter(current_char)) {
+
+        StrView protocol = parse_token(current_char);
         skip_lwsp(current_char);
-        if (**current_char == 0) {
-            break;
-        }
-        if (**current_char != ';') {
-            // malformed header, but we've got as most as we could, haven't we?
-            break;
+        if (protocol.length == 0 || **current_char != '=') {
+            if (protocol.length == 5 && memcmp(protocol.ptr, "clear", 5) == 0) {
+                *clear = true;
+            }
+            // skip to the next alternative
+            while (**current_char != ',' && **current_char != 0) {
+                (*current_char)++;
+            }
+            continue;
         }
         (*current_char)++;
         skip_lwsp(current_char);
-        {
-            bool is_ext_value = false;
 
-            PwValue param_name = PW_NULL;
-            if (!parse_token(current_char, &param_name)) {
-                return false;
-            }
-            if (**current_char == '*') {
-                is_ext_value = true;
-                (*current_char)++;
-            }
+        StrView authority;
+        if (!parse_quoted_string(current_char, &authority)) {
+            return n;
+        }
+        CurlAltSvc service = {
+            .protocol = protocol.ptr,
+            .protocol_length = protocol.length,
+            .max_age = 86400
+        };
+        bool valid = parse_alt_authority(&authority, &service);
+
+        for (;;) {
             skip_lwsp(current_char);
-            if (**current_char != '=') {
+            if (**current_char != ';') {
                 break;
             }
             (*current_char)++;
             skip_lwsp(current_char);
-
-            if (**current_char == 0) {
-                break;
-            }
-
-            PwValue param_value = PW_NULL;
-            if (is_ext_value) {
-                if (!parse_ext_value(current_char, &param_value)) {
-                    return false;
-                }
-            } else if (**current_char == '"') {
-                if (!parse_quoted_string(current_char, &param_value)) {
-                    return false;
-                }
-            } else {
-                if (!parse_token(current_char, &param_value)) {
-                    return false;
+            StrView name = parse_token(current_char);
+            StrView arg = { *current_char, 0 };
+            skip_lwsp(current_char);
+            if (**current_char == '=') {
+                (*current_char)++;
+                skip_lwsp(current_char);
+                if (**current_char == '"') {
+                    if (!parse_quoted_string(current_char, &arg)) {
+                        return n;
+                    }
+                } else {
+                    arg = parse_token(current_char);
                 }
             }
-            if (!pw_is_string(&param_value)) {
-                break;
-            }
-            if (!pw_string_lower(&param_name)) {
-                return false;
-            }
-            if (!pw_map_update(&params, &param_name, &param_value)) {
-                return false;
+            if (view_equal_nocase(&name, "ma")) {
+                long max_age = view_to_delta_seconds(&arg);
+                if (max_age >= 0) {
+                    service.max_age = max_age;
+                }
+            } else if (view_equal_nocase(&name, "persist")) {
+                service.persist = (arg.length == 1 && arg.ptr[0] == '1');
             }
         }
+        if (valid && n < max_services) {
+            services[n++] = service;
+        }
     }
-    pw_move(&disposition_type, &req->disposition_type);
-    pw_move(&params,           &req->disposition_params);
-    return true;
+    return n;
 }
 
-void curl_request_parse_content_type(CurlRequestData* req)
-/*
- * Parse content-type header
- */
+int curl_request_alt_svc(CurlRequestData* req, CurlAltSvc* services, unsigned max_services)
 {
-    CURLcode res;
-    char* content_type;
-    res = curl_easy_getinfo(req->easy_handle, CURLINFO_CONTENT_TYPE, &content_type);
-    if (res != CURLE_OK) {
-        return;
-    }
-    if (!content_type) {
-        return;
-    }
-    char* ct = content_type;
-    if (!parse_media_type(&ct, req)) {
-        fprintf(stderr, "WARNING: failed to parse content type %s\n", content_type);
+    char* values[8];
+    unsigned num_values = get_headers(req, "Alt-Svc", last_hop(req), values, PW_LENGTH(values));
+    bool clear = false;
+    unsigned n = 0;
+    for (unsigned i = 0; i < num_values; i++) {
+        char* p = values[i];
+        n = parse_alt_svc(&p, services, n, max_services, &clear);
     }
+    return clear? -1 : (int) n;
 }
 
-void curl_request_parse_content_disposition(CurlRequestData* req)
-/*
- * Parse content-disposition header
- */
+PwValuePtr curl_request_links(CurlRequestData* req)
 {
-    char* content_disposition = get_response_header(req->easy_handle, "Content-Disposition");
-    if (!content_disposition) {
-        return;
+    if (req->parsed_headers & CURL_PARSED_LINK) {
+        return &req->links;
     }
+    req->parsed_headers |= CURL_PARSED_LINK;
 
-    char* p = content_disposition;
-    if (!parse_content_disposition(&p, req)) {
-        fprintf(stderr, "WARNING: failed to parse content dispostion %s\n", content_disposition);
-    }
-}
+    pw_destroy(&req->links);
 
-void curl_request_parse_headers(CurlRequestData* req)
-{
-    curl_request_parse_content_type(req);
-    curl_request_parse_content_disposition(req);
+    char* values[16];
+    unsigned n = get_headers(req, "Link", last_hop(req), values, PW_LENGTH(values));
+    for (unsigned i = 0; i < n; i++) {
+        char* p = values[i];
+        if (!parse_link(&p, &req->links)) {
+            fprintf(stderr, "WARNING: failed to parse link %s\n", values[i]);
+            break;
+        }
+    }
+    return &req->links;
 }
 
 [[nodiscard]] bool curl_request_get_filename(CurlRequestData* req, PwValuePtr result)
@@ -582,14 +1535,16 @@ void curl_request_parse_headers(CurlRequestData* req)
  *   - URL
  *
  * Return map containing filename and charset.
+ * File names from URL are percent-decoded as UTF-8, charset is empty for them.
  *
  * If no filename found and URL ends with slash, return "index.html"
  */
 {
-    if (pw_is_map(&req->disposition_params)) {
-        if (pw_is_string(&req->disposition_type) && pw_equal(&req->disposition_type, "attachment")) {
+    PwValuePtr disposition_params = curl_request_disposition_params(req);
+    if (pw_is_map(disposition_params)) {
+        if (req->disposition_type_atom == &curl_atom_attachment) {
             PwValue filename = PW_NULL;
-            if (pw_map_get(&req->disposition_params, "filename", &filename)) {
+            if (pw_map_get(disposition_params, "filename", &filename)) {
                 if (pw_is_map(&filename)) {
                     PwValue fname = PW_NULL;
                     if (!pw_map_get(&filename, "value", &fname)) {
@@ -615,25 +1570,19 @@ void curl_request_parse_headers(CurlRequestData* req)
         }
     }
 
-    PwValue parts = PW_NULL;
-
-    char* last_location = get_response_header(req->easy_handle, "Location");
-    if (last_location) {
-        PwValue location = PW_NULL;
-        if (!pw_create_string(last_location, &location)) {
-            return false;
-        }
-        if (!pw_string_split_chr(&location, '/', 0, &parts)) {
-            return false;
-        }
-    } else {
-        if (!pw_string_split_chr(&req->url, '/', 0, &parts)) {
-            return false;
-        }
+    // last path segment of Location or URL, without query and fragment
+    PW_CSTRING_LOCAL(url_cstr, &req->url);
+    char* url = curl_request_get_header(req, "Location", -1);
+    if (!url) {
+        url = url_cstr;
     }
-
-    PwValue filename = PW_NULL;
-    if (!pw_array_item(&parts, -1, &filename)) {
+    char* end = url + strcspn(url, "?#");
+    char* start = end;
+    while (start > url && start[-1] != '/') {
+        start--;
+    }
+    PwValue filename = PW_STRING("");
+    if (!curl_percent_decode(start, end, nullptr, &filename)) {
         return false;
     }
     if (pw_strlen(&filename) == 0) {
@@ -648,41 +1597,95 @@ void curl_request_parse_headers(CurlRequestData* req)
     );
 }
 
-[[nodiscard]] bool urljoin_cstr(char* base_url, char* other_url, PwValuePtr result)
-{
-    CURLU* handle = curl_url();
-    if (!handle) {
-        pw_set_status(PwStatus(PW_ERROR_OOM));
-        return false;
-    }
-
-    CURLUcode rc;
+/****************************************************************
+ * Response filters
+ */
 
-    rc = curl_url_set(handle, CURLUPART_URL, base_url, 0);
-    if(rc) {
-        pw_set_status(PwStatus(PW_ERROR), "URL error: %s", curl_url_strerror(rc));
+static bool pattern_part_equal(StrView* view, char* pattern, unsigned length)
+{
+    return (length == 1 && pattern[0] == '*')
+           || (view->length == length && header_name_equal(view->ptr, pattern, length));
+}
 
-        curl_url_cleanup(handle);
-        return false;
+static bool media_type_allowed(char* content_type, char** patterns)
+/*
+ * Match type/subtype of Content-Type against patterns.
+ * Malformed header is treated as missing and allowed.
+ */
+{
+    char* current_char = content_type;
+    skip_lwsp(&current_char);
+    StrView type = parse_token(&current_char);
+    if (type.length == 0 || *current_char != '/') {
+        return true;
+    }
+    current_char++;
+    StrView subtype = parse_token(&current_char);
+    if (subtype.length == 0) {
+        return true;
+    }
+    for (char** pattern = patterns; *pattern; pattern++) {
+        char* slash = strchr(*pattern, '/');
+        if (!slash) {
+            continue;
+        }
+        if (pattern_part_equal(&type, *pattern, slash - *pattern)
+            && pattern_part_equal(&subtype, slash + 1, strlen(slash + 1))) {
+            return true;
+        }
     }
-    rc = curl_url_set(handle, CURLUPART_URL, other_url, 0);
-    if(rc) {
-        pw_set_status(PwStatus(PW_ERROR), "URL error: %s", curl_url_strerror(rc));
+    return false;
+}
 
-        curl_url_cleanup(handle);
-        return false;
+CurlFilterResult curl_request_filter_response(CurlRequestData* req, CurlResponseFilter* filter)
+{
+    CurlHeaderIndex* index = &req->header_index;
+    if (index->skip || index->num_hops == 0) {
+        // end of informational response
+        return CURL_FILTER_PASSED;
+    }
+    int hop = last_hop(req);
+    long status;
+    if (hop < CURL_MAX_HOPS) {
+        status = index->status[hop];
+    } else {
+        curl_easy_getinfo(req->easy_handle, CURLINFO_RESPONSE_CODE, &status);
+    }
+    if (300 <= status && status < 400 && curl_request_get_header(req, "Location", hop)) {
+        // redirect, libcurl is going to follow it
+        return CURL_FILTER_PASSED;
+    }
+    if ((filter->min_status && status < filter->min_status)
+        || (filter->max_status && status > filter->max_status)) {
+        return CURL_FILTERED_STATUS;
+    }
+    if (filter->max_content_length) {
+        char* content_length = curl_request_get_header(req, "Content-Length", hop);
+        curl_off_t length;
+        if (content_length && parse_number(&content_length, &length) && length > filter->max_content_length) {
+            return CURL_FILTERED_CONTENT_LENGTH;
+        }
+    }
+    if (filter->media_types) {
+        char* content_type = curl_request_get_header(req, "Content-Type", hop);
+        if (content_type && !media_type_allowed(content_type, filter->media_types)) {
+            return CURL_FILTERED_MEDIA_TYPE;
+        }
     }
-    char* url;
-    rc = curl_url_get(handle, CURLUPART_URL, &url, 0);
-    if(rc) {
-        pw_set_status(PwStatus(PW_ERROR), "URL error: %s", curl_url_strerror(rc));
+    return CURL_FILTER_PASSED;
+}
 
-        curl_url_cleanup(handle);
+[[nodiscard]] bool urljoin_cstr(char* base_url, char* other_url, PwValuePtr result)
+/*
+ * For many URLs with the same base use CurlUrlResolver directly.
+ */
+{
+    CurlUrlResolver resolver;
+    if (!curl_url_resolver_init(&resolver, base_url)) {
         return false;
     }
-    bool ret = pw_create_string(url, result);
-    curl_free(url);
-    curl_url_cleanup(handle);
+    bool ret = curl_url_resolve(&resolver, other_url, strlen(other_url), result);
+    curl_url_resolver_fini(&resolver);
     return ret;
 }
 
@@ -0,0 +1,872 @@
+/*
+ * robots.txt support, RFC 9309
+ *
+ * Rules of the group that matches our product token, or of the * group,
+ * are compiled once per host: patterns without wildcards go to a trie,
+ * so a path is checked against all of them in a single walk;
+ * the few patterns with * and $ are matched separately.
+ * The longest matching pattern wins, Allow wins ties.
+ *
+ * Compiled rules are cached per origin for a TTL. Expired rules
+ * keep answering while robots.txt is fetched again.
+ *
+ * Fetch results:
+ *   - 2xx: rules are parsed from the first CURL_ROBOTS_MAX_SIZE bytes
+ *   - 4xx except 429: robots.txt is unavailable, everything is allowed
+ *   - 429, 5xx and network errors: the host is unreachable, it is held back
+ *     until robots.txt is fetched again
+ *
+ * Crawl-delay is not in the RFC, but widely used; it is reported
+ * in milliseconds and the frontier takes it into account.
+ */
+
+#include <stdio.h>
+#include <string.h>
+#include <strings.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+#include "pw_http_scan.h"
+
+#define CURL_ROBOTS_MAX_SIZE  (500 * 1024)  // RFC 9309, 2.5
+#define MAX_CRAWL_DELAY       60000         // ms, larger values are clipped
+
+/****************************************************************
+ * Compiled rules
+ */
+
+enum {
+    RULE_ALLOW    = 1 << 0,
+    RULE_DISALLOW = 1 << 1
+};
+
+typedef struct {
+    uint32_t first_child;   // index of node, 0 if none
+    uint32_t next_sibling;
+    char c;
+    uint8_t rules;          // RULE_* bits of patterns ending here
+} TrieNode;
+
+typedef struct {
+    char* pattern;          // normalized, may contain * and trailing $
+    unsigned length;
+    bool allow;
+} WildcardRule;
+
+struct CurlRobotsRules {
+    TrieNode* nodes;        // node 0 is the root
+    unsigned num_nodes;
+    unsigned nodes_capacity;
+
+    WildcardRule* wildcards;
+    unsigned num_wildcards;
+    unsigned wildcards_capacity;
+
+    unsigned crawl_delay;   // ms
+    bool disallow_all;      // unreachable robots.txt
+};
+
+static CurlRobotsRules* create_rules()
+{
+    CurlRobotsRules* rules = default_allocator.allocate(sizeof(CurlRobotsRules), true);
+    if (!rules) {
+        return nullptr;
+    }
+    rules->nodes = default_allocator.allocate(16 * sizeof(TrieNode), true);
+    if (!rules->nodes) {
+        default_allocator.release((void**) &rules, sizeof(CurlRobotsRules));
+        return nullptr;
+    }
+    rules->nodes_capacity = 16;
+    rules->num_nodes = 1;
+    return rules;
+}
+
+void curl_robots_rules_delete(CurlRobotsRules* rules)
+{
+    if (!rules) {
+        return;
+    }
+    for (unsigned i = 0; i < rules->num_wildcards; i++) {
+        WildcardRule* w = &rules->wildcards[i];
+        default_allocator.release((void**) &w->pattern, w->length);
+    }
+    if (rules->wildcards) {
+        default_allocator.release((void**) &rules->wildcards, rules->wildcards_capacity * sizeof(WildcardRule));
+    }
+    default_allocator.release((void**) &rules->nodes, rules->nodes_capacity * sizeof(TrieNode));
+    default_allocator.release((void**) &rules, sizeof(CurlRobotsRules));
+}
+
+[[nodiscard]] static bool add_trie_rule(CurlRobotsRules* rules, char* pattern, unsigned length, bool allow)
+{
+    unsigned node = 0;
+    for (unsigned i = 0; i < length; i++) {
+        unsigned child = rules->nodes[node].first_child;
+        while (child && rules->nodes[child].c != pattern[i]) {
+            child = rules->nodes[child].next_sibling;
+        }
+        if (!child) {
+            if (rules->num_nodes == rules->nodes_capacity) {
+                unsigned new_capacity = rules->nodes_capacity * 2;
+                TrieNode* new_nodes = default_allocator.allocate(new_capacity * sizeof(TrieNode), true);
+                if (!new_nodes) {
+                    return false;
+                }
+                memcpy(new_nodes, rules->nodes, rules->num_nodes * sizeof(TrieNode));
+                default_allocator.release((void**) &rules->nodes, rules->nodes_capacity * sizeof(TrieNode));
+                rules->nodes = new_nodes;
+                rules->nodes_capacity = new_capacity;
+            }
+            child = rules->num_nodes++;
+            rules->nodes[child].c = pattern[i];
+            rules->nodes[child].next_sibling = rules->nodes[node].first_child;
+            rules->nodes[node].first_child = child;
+        }
+        node = child;
+    }
+    rules->nodes[node].rules |= allow? RULE_ALLOW : RULE_DISALLOW;
+    return true;
+}
+
+[[nodiscard]] static bool add_wildcard_rule(CurlRobotsRules* rules, char* pattern, unsigned length, bool allow)
+{
+    if (rules->num_wildcards == rules->wildcards_capacity) {
+        unsigned new_capacity = rules->wildcards_capacity? rules->wildcards_capacity * 2 : 8;
+        WildcardRule* new_wildcards = default_allocator.allocate(new_capacity * sizeof(WildcardRule), false);
+        if (!new_wildcards) {
+            return false;
+        }
+        if (rules->wildcards) {
+            memcpy(new_wildcards, rules->wildcards, rules->num_wildcards * sizeof(WildcardRule));
+            default_allocator.release((void**) &rules->wildcards, rules->wildcards_capacity * sizeof(WildcardRule));
+        }
+        rules->wildcards = new_wildcards;
+        rules->wildcards_capacity = new_capacity;
+    }
+    char* copy = default_allocator.allocate(length, false);
+    if (!copy) {
+        return false;
+    }
+    memcpy(copy, pattern, length);
+    rules->wildcards[rules->num_wildcards++] = (WildcardRule) {
+        .pattern = copy,
+        .length = length,
+        .allow = allow
+    };
+    return true;
+}
+
+static inline bool is_unreserved(unsigned char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9')
+           || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static unsigned normalize_pattern(char* pattern, unsigned length, char* buffer)
+/*
+ * Bring pattern to the same form as paths of canonical URLs:
+ * unreserved chars unescaped, uppercase hex digits in other escapes,
+ * non-ASCII and control chars escaped. Buffer must be three times longer.
+ */
+{
+    static char hex[] = "0123456789ABCDEF";
+    unsigned n = 0;
+    for (unsigned i = 0; i < length; i++) {
+        unsigned char c = pattern[i];
+        if (c == '%' && i + 2 < length && curl_hex_value[(unsigned char) pattern[i + 1]] >= 0
+            && curl_hex_value[(unsigned char) pattern[i + 2]] >= 0) {
+            unsigned char decoded = curl_hex_value[(unsigned char) pattern[i + 1]] * 16
+                                    + curl_hex_value[(unsigned char) pattern[i + 2]];
+            if (is_unreserved(decoded)) {
+                buffer[n++] = decoded;
+            } else {
+                buffer[n++] = '%';
+                buffer[n++] = hex[decoded >> 4];
+                buffer[n++] = hex[decoded & 15];
+            }
+            i += 2;
+        } else if (c <= 0x20 || c >= 0x7F || c == '"' || c == '<' || c == '>' || c == '\\'
+                   || c == '^' || c == '`' || c == '{' || c == '|' || c == '}') {
+            buffer[n++] = '%';
+            buffer[n++] = hex[c >> 4];
+            buffer[n++] = hex[c & 15];
+        } else {
+            buffer[n++] = c;
+        }
+    }
+    return n;
+}
+
+[[nodiscard]] static bool add_rule(CurlRobotsRules* rules, char* pattern, unsigned length, bool allow)
+{
+    char stack_buffer[1024];
+    char* buffer = stack_buffer;
+    unsigned size = length * 3;
+    if (size > sizeof(stack_buffer)) {
+        buffer = default_allocator.allocate(size, false);
+        if (!buffer) {
+            return false;
+        }
+    }
+    length = normalize_pattern(pattern, length, buffer);
+
+    // trailing stars do not change prefix match
+    while (length && buffer[length - 1] == '*') {
+        length--;
+    }
+    bool ret = true;
+    if (length) {
+        if (memchr(buffer, '*', length) || buffer[length - 1] == '$') {
+            ret = add_wildcard_rule(rules, buffer, length, allow);
+        } else {
+            ret = add_trie_rule(rules, buffer, length, allow);
+        }
+    }
+    if (buffer != stack_buffer) {
+        default_allocator.release((void**) &buffer, size);
+    }
+    return ret;
+}
+
+static bool wildcard_match(char* pattern, unsigned pattern_length, char* path, unsigned path_length)
+/*
+ * Match path against pattern with * wildcards. Pattern matches prefix of path
+ * unless it ends with $
+ */
+{
+    bool anchored = pattern[pattern_length - 1] == '$';
+    if (anchored) {
+        pattern_length--;
+    }
+    unsigned p = 0;
+    unsigned s = 0;
+    unsigned star_p = 0;  // position after the last star, 0 if none
+    unsigned star_s = 0;
+    while (s < path_length) {
+        if (p < pattern_length && pattern[p] == '*') {
+            star_p = ++p;
+            star_s = s;
+            continue;
+        }
+        if (p == pattern_length && !anchored) {
+            return true;
+        }
+        if (p < pattern_length && pattern[p] == path[s]) {
+            p++;
+            s++;
+            continue;
+        }
+        if (star_p) {
+            // let the last star consume one more char
+            p = star_p;
+            s = ++star_s;
+            continue;
+        }
+        return false;
+    }
+    while (p < pattern_length && pattern[p] == '*') {
+        p++;
+    }
+    return p == pattern_length;
+}
+
+bool curl_robots_rules_allowed(CurlRobotsRules* rules, char* path, unsigned length)
+{
+    if (rules->disallow_all) {
+        return false;
+    }
+    if (length == 11 && memcmp(path, "/robots.txt", 11) == 0) {
+        return true;
+    }
+    int best_length = -1;
+    bool allowed = true;
+
+    // walk the trie along the path, every node with rules is a matching prefix
+    unsigned node = 0;
+    for (unsigned i = 0; i < length; i++) {
+        unsigned child = rules->nodes[node].first_child;
+        while (child && rules->nodes[child].c != path[i]) {
+            child = rules->nodes[child].next_sibling;
+        }
+        if (!child) {
+            break;
+        }
+        node = child;
+        if (rules->nodes[node].rules) {
+            best_length = i + 1;
+            allowed = rules->nodes[node].rules & RULE_ALLOW;
+        }
+    }
+    for (unsigned i = 0; i < rules->num_wildcards; i++) {
+        WildcardRule* w = &rules->wildcards[i];
+        if ((int) w->length < best_length || ((int) w->length == best_length && allowed)) {
+            continue;
+        }
+        if (wildcard_match(w->pattern, w->length, path, length)) {
+            best_length = w->length;
+            allowed = w->allow;
+        }
+    }
+    return allowed;
+}
+
+unsigned curl_robots_rules_crawl_delay(CurlRobotsRules* rules)
+{
+    return rules->crawl_delay;
+}
+
+/****************************************************************
+ * Parser
+ */
+
+typedef struct {
+    char* pattern;
+    unsigned length;
+    bool allow;
+    bool specific;  // from group of our agent, otherwise from * group
+} RawRule;
+
+static inline bool is_space(char c)
+{
+    return c == ' ' || c == '\t';
+}
+
+static bool agent_matches(char* value, unsigned length, char* agent)
+/*
+ * Compare product token of user-agent line with our token, case-insensitively.
+ */
+{
+    unsigned n = 0;
+    while (n < length && (('a' <= (value[n] | 0x20) && (value[n] | 0x20) <= 'z') || value[n] == '-' || value[n] == '_')) {
+        n++;
+    }
+    return n && n == strlen(agent) && strncasecmp(value, agent, n) == 0;
+}
+
+static unsigned parse_delay(char* value, unsigned length)
+/*
+ * Parse seconds, possibly fractional, to milliseconds.
+ */
+{
+    unsigned ms = 0;
+    unsigned i = 0;
+    for (; i < length && '0' <= value[i] && value[i] <= '9'; i++) {
+        ms = ms * 10 + (value[i] - '0') * 1000;
+        if (ms > MAX_CRAWL_DELAY) {
+            return MAX_CRAWL_DELAY;
+        }
+    }
+    if (i < length && value[i] == '.') {
+        unsigned scale = 100;
+        for (i++; i < length && '0' <= value[i] && value[i] <= '9' && scale; i++) {
+            ms += (value[i] - '0') * scale;
+            scale /= 10;
+        }
+    }
+    return (ms > MAX_CRAWL_DELAY)? MAX_CRAWL_DELAY : ms;
+}
+
+CurlRobotsRules* curl_robots_parse(char* text, unsigned length, char* agent)
+{
+    RawRule* raw_rules = nullptr;
+    unsigned num_raw_rules = 0;
+    unsigned raw_rules_capacity = 0;
+    CurlRobotsRules* rules = nullptr;
+
+    bool in_agents = false;        // previous line was user-agent
+    bool group_specific = false;   // current group lists our agent
+    bool group_star = false;       // current group lists *
+    bool have_specific = false;    // some group lists our agent
+    unsigned delay_specific = 0;
+    unsigned delay_star = 0;
+
+    char* p = text;
+    char* end = text + length;
+    if (length >= 3 && memcmp(p, "\xEF\xBB\xBF", 3) == 0) {
+        p += 3;
+    }
+    while (p < end) {
+        char* line_end = memchr(p, '\n', end - p);
+        if (!line_end) {
+            line_end = end;
+        }
+        char* next_line = (line_end < end)? line_end + 1 : end;
+        char* comment = memchr(p, '#', line_end - p);
+        if (comment) {
+            line_end = comment;
+        }
+        char* colon = memchr(p, ':', line_end - p);
+        if (!colon) {
+            p = next_line;
+            continue;
+        }
+        char* key = p;
+        char* key_end = colon;
+        while (key < key_end && is_space(*key)) {
+            key++;
+        }
+        while (key_end > key && is_space(key_end[-1])) {
+            key_end--;
+        }
+        char* value = colon + 1;
+        char* value_end = line_end;
+        while (value < value_end && is_space(*value)) {
+            value++;
+        }
+        while (value_end > value && (is_space(value_end[-1]) || value_end[-1] == '\r')) {
+            value_end--;
+        }
+        unsigned key_length = key_end - key;
+        unsigned value_length = value_end - value;
+        p = next_line;
+
+        if (key_length == 10 && strncasecmp(key, "user-agent", 10) == 0) {
+            if (!in_agents) {
+                group_specific = false;
+                group_star = false;
+            }
+            in_agents = true;
+            if (value_length == 1 && *value == '*') {
+                group_star = true;
+            } else if (agent_matches(value, value_length, agent)) {
+                group_specific = true;
+                have_specific = true;
+            }
+            continue;
+        }
+        bool allow = key_length == 5 && strncasecmp(key, "allow", 5) == 0;
+        bool disallow = key_length == 8 && strncasecmp(key, "disallow", 8) == 0;
+        if (allow || disallow) {
+            in_agents = false;
+            if (!(group_specific || group_star) || value_length == 0) {
+                // empty disallow allows everything, same as no rule
+                continue;
+            }
+            if (num_raw_rules == raw_rules_capacity) {
+                unsigned new_capacity = raw_rules_capacity? raw_rules_capacity * 2 : 32;
+                RawRule* new_rules = default_allocator.allocate(new_capacity * sizeof(RawRule), false);
+                if (!new_rules) {
+                    goto out;
+                }
+                if (raw_rules) {
+                    memcpy(new_rules, raw_rules, num_raw_rules * sizeof(RawRule));
+                    default_allocator.release((void**) &raw_rules, raw_rules_capacity * sizeof(RawRule));
+                }
+                raw_rules = new_rules;
+                raw_rules_capacity = new_capacity;
+            }
+            raw_rules[num_raw_rules++] = (RawRule) {
+                .pattern = value,
+                .length = value_length,
+                .allow = allow,
+                .specific = group_specific
+            };
+            if (group_specific && group_star) {
+                // group lists both, rule applies to * too
+                raw_rules[num_raw_rules - 1].specific = true;
+            }
+            continue;
+        }
+        if (key_length == 11 && strncasecmp(key, "crawl-delay", 11) == 0) {
+            in_agents = false;
+            unsigned delay = parse_delay(value, value_length);
+            if (group_specific) {
+                delay_specific = delay;
+            }
+            if (group_star) {
+                delay_star = delay;
+            }
+            continue;
+        }
+        // other lines such as sitemap do not end the group
+    }
+
+    rules = create_rules();
+    if (!rules) {
+        goto out;
+    }
+    for (unsigned i = 0; i < num_raw_rules; i++) {
+        RawRule* r = &raw_rules[i];
+        if (r->specific != have_specific) {
+            continue;
+        }
+        if (!add_rule(rules, r->pattern, r->length, r->allow)) {
+            curl_robots_rules_delete(rules);
+            rules = nullptr;
+            goto out;
+        }
+    }
+    rules->crawl_delay = have_specific? delay_specific : delay_star;
+
+out:
+    if (raw_rules) {
+        default_allocator.release((void**) &raw_rules, raw_rules_capacity * sizeof(RawRule));
+    }
+    if (!rules) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+    }
+    return rules;
+}
+
+/****************************************************************
+ * Per-host cache
+ */
+
+#define UNREACHABLE_TTL  600  // seconds before retrying hosts that failed to serve robots.txt
+
+typedef struct {
+    CurlRobotsRules* rules;  // nullptr until the first fetch completes
+    uint64_t expires;        // usec
+    bool fetching;
+} RobotsEntry;
+
+typedef struct {
+    CurlSession* session;
+    char* agent;
+    uint64_t ttl;            // usec
+    CurlHashTable entries;   // origin -> RobotsEntry
+    void (*ready)(void* arg, char* origin, unsigned origin_length);
+    void* ready_arg;
+    CurlRobotsStats stats;
+} CurlRobots;
+
+// RobotsRequest type extends CurlRequest with response body
+
+typedef struct {
+    CurlRequestData curl_request;
+
+    CurlRobots* robots;
+    char* origin;
+    unsigned origin_length;
+    char* body;
+    unsigned body_length;
+    unsigned body_capacity;
+    bool truncated;
+    bool completed;
+} RobotsRequestData;
+
+#define robots_request_data_ptr(value)  ((RobotsRequestData*) ((value)->struct_data))
+
+static PwTypeId PwTypeId_RobotsRequest = 0;
+
+static void release_entry(void* value)
+{
+    RobotsEntry* entry = value;
+    curl_robots_rules_delete(entry->rules);
+    default_allocator.release((void**) &entry, sizeof(RobotsEntry));
+}
+
+static void set_rules(CurlRobots* robots, char* origin, unsigned origin_length,
+                      CurlRobotsRules* rules, unsigned ttl)
+{
+    RobotsEntry* entry = curl_hash_get(&robots->entries, origin, origin_length);
+    if (!entry) {
+        // should not happen, entries are never removed
+        curl_robots_rules_delete(rules);
+        return;
+    }
+    curl_robots_rules_delete(entry->rules);
+    entry->rules = rules;
+    entry->expires = curl_now_usec() + (uint64_t) ttl * 1000000;
+    entry->fetching = false;
+}
+
+static CurlRobotsRules* allow_all()
+{
+    CurlRobotsRules* rules = create_rules();
+    if (!rules) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+    }
+    return rules;
+}
+
+static CurlRobotsRules* disallow_all()
+{
+    CurlRobotsRules* rules = create_rules();
+    if (rules) {
+        rules->disallow_all = true;
+    } else {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+    }
+    return rules;
+}
+
+static size_t robots_write_data(void* data, size_t always_1, size_t size, PwValuePtr self)
+{
+    RobotsRequestData* req = robots_request_data_ptr(self);
+
+    curl_update_status(self);
+    if (req->curl_request.status < 200 || req->curl_request.status > 299) {
+        // error page, discard
+        return size;
+    }
+    if (req->body_length + size > CURL_ROBOTS_MAX_SIZE) {
+        // keep what fits and stop the transfer
+        size = CURL_ROBOTS_MAX_SIZE - req->body_length;
+        req->truncated = true;
+    }
+    if (req->body_length + size > req->body_capacity) {
+        unsigned new_capacity = req->body_capacity? req->body_capacity * 2 : 16384;
+        while (new_capacity < req->body_length + size) {
+            new_capacity *= 2;
+        }
+        if (new_capacity > CURL_ROBOTS_MAX_SIZE) {
+            new_capacity = CURL_ROBOTS_MAX_SIZE;
+        }
+        char* new_body = default_allocator.allocate(new_capacity, false);
+        if (!new_body) {
+            return 0;
+        }
+        if (req->body) {
+            memcpy(new_body, req->body, req->body_length);
+            default_allocator.release((void**) &req->body, req->body_capacity);
+        }
+        req->body = new_body;
+        req->body_capacity = new_capacity;
+    }
+    memcpy(req->body + req->body_length, data, size);
+    req->body_length += size;
+    return req->truncated? 0 : size;
+}
+
+static void robots_complete(PwValuePtr self)
+{
+    RobotsRequestData* req = robots_request_data_ptr(self);
+    req->completed = true;
+}
+
+static void fini_robots_request(PwValuePtr self)
+/*
+ * Install rules when the request is destroyed, whether it succeeded or not.
+ */
+{
+    RobotsRequestData* req = robots_request_data_ptr(self);
+    CurlRobots* robots = req->robots;
+    if (!robots) {
+        return;
+    }
+    CurlRobotsRules* rules;
+    unsigned status = req->curl_request.status;
+    unsigned ttl = robots->ttl / 1000000;
+
+    if (req->completed || req->truncated) {
+        if (200 <= status && status <= 299) {
+            rules = curl_robots_parse(req->body? req->body : "", req->body_length, robots->agent);
+            robots->stats.fetched++;
+        } else if (400 <= status && status <= 499 && status != 429) {
+            rules = allow_all();
+            robots->stats.unavailable++;
+        } else {
+            rules = disallow_all();
+            robots->stats.unreachable++;
+            if (ttl > UNREACHABLE_TTL) {
+                ttl = UNREACHABLE_TTL;
+            }
+        }
+    } else {
+        rules = disallow_all();
+        robots->stats.unreachable++;
+        if (ttl > UNREACHABLE_TTL) {
+            ttl = UNREACHABLE_TTL;
+        }
+    }
+    if (rules) {
+        set_rules(robots, req->origin, req->origin_length, rules, ttl);
+    } else {
+        fprintf(stderr, "WARNING: %s: cannot create rules for %.*s\n",
+                __func__, (int) req->origin_length, req->origin);
+        set_rules(robots, req->origin, req->origin_length, nullptr, 0);
+    }
+    if (robots->ready) {
+        robots->ready(robots->ready_arg, req->origin, req->origin_length);
+    }
+    if (req->body) {
+        default_allocator.release((void**) &req->body, req->body_capacity);
+    }
+    default_allocator.release((void**) &req->origin, req->origin_length + 1);
+    req->robots = nullptr;
+}
+
+static void register_robots_request()
+{
+    static PwType robots_request_type;
+
+    static PwInterface_Curl robots_curl_interface = {
+        .write_data = robots_write_data,
+        .complete   = robots_complete
+    };
+
+    if (PwTypeId_RobotsRequest) {
+        return;
+    }
+    PwTypeId_RobotsRequest = pw_struct_subtype(
+        &robots_request_type, "RobotsRequest",
+        PwTypeId_CurlRequest,
+        RobotsRequestData,
+        PwInterfaceId_Curl, &robots_curl_interface
+    );
+    robots_request_type.fini = fini_robots_request;
+}
+
+[[nodiscard]] static bool start_fetch(CurlRobots* robots, RobotsEntry* entry, char* origin, unsigned origin_length)
+{
+    char url_cstr[origin_length + sizeof("/robots.txt")];
+    memcpy(url_cstr, origin, origin_length);
+    strcpy(url_cstr + origin_length, "/robots.txt");
+
+    PwValue url = PW_NULL;
+    if (!pw_create_string(url_cstr, &url)) {
+        return false;
+    }
+    PwValue request = PW_NULL;
+    if (!pw_create(PwTypeId_RobotsRequest, &request)) {
+        return false;
+    }
+    RobotsRequestData* req = robots_request_data_ptr(&request);
+    req->origin = default_allocator.allocate(origin_length + 1, false);
+    if (!req->origin) {
+        return false;
+    }
+    memcpy(req->origin, origin, origin_length);
+    req->origin[origin_length] = 0;
+    req->origin_length = origin_length;
+
+    curl_request_set_url(&request, &url);
+
+    // session filter is meant for pages, robots.txt is text/plain and is truncated, not rejected
+    static CurlResponseFilter pass_all = {};
+    curl_request_set_filter(&request, &pass_all);
+
+    // RFC 9309 requires following at least five redirects, the default is ten
+    if (!add_curl_request(robots->session, &request)) {
+        return false;
+    }
+    // set last, fini must not touch the entry if the request was not started
+    req->robots = robots;
+    entry->fetching = true;
+    robots->stats.requests++;
+    return true;
+}
+
+void* create_curl_robots(void* session, char* agent, unsigned ttl)
+{
+    register_robots_request();
+
+    CurlRobots* robots = default_allocator.allocate(sizeof(CurlRobots), true);
+    if (!robots) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return nullptr;
+    }
+    robots->session = (CurlSession*) session;
+    robots->ttl = (uint64_t) (ttl? ttl : CURL_ROBOTS_DEFAULT_TTL) * 1000000;
+    robots->agent = default_allocator.allocate(strlen(agent) + 1, false);
+    if (!robots->agent) {
+        default_allocator.release((void**) &robots, sizeof(CurlRobots));
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return nullptr;
+    }
+    strcpy(robots->agent, agent);
+    if (!curl_hash_init(&robots->entries, 64)) {
+        default_allocator.release((void**) &robots->agent, strlen(agent) + 1);
+        default_allocator.release((void**) &robots, sizeof(CurlRobots));
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return nullptr;
+    }
+    return robots;
+}
+
+void delete_curl_robots(void* robots)
+{
+    CurlRobots* r = (CurlRobots*) robots;
+    curl_hash_fini(&r->entries, release_entry);
+    default_allocator.release((void**) &r->agent, strlen(r->agent) + 1);
+    default_allocator.release((void**) &r, sizeof(CurlRobots));
+}
+
+void curl_robots_set_callback(void* robots, void (*ready)(void* arg, char* origin, unsigned origin_length), void* arg)
+{
+    CurlRobots* r = (CurlRobots*) robots;
+    r->ready = ready;
+    r->ready_arg = arg;
+}
+
+static RobotsEntry* get_entry(CurlRobots* robots, char* origin, unsigned origin_length)
+/*
+ * Return entry for origin, creating it if necessary,
+ * and start fetching robots.txt if there are no fresh rules.
+ */
+{
+    RobotsEntry* entry = curl_hash_get(&robots->entries, origin, origin_length);
+    if (!entry) {
+        entry = default_allocator.allocate(sizeof(RobotsEntry), true);
+        if (!entry) {
+            return nullptr;
+        }
+        if (!curl_hash_put(&robots->entries, origin, origin_length, entry)) {
+            default_allocator.release((void**) &entry, sizeof(RobotsEntry));
+            return nullptr;
+        }
+        robots->stats.hosts++;
+    }
+    if (!entry->fetching && (!entry->rules || entry->expires <= curl_now_usec())) {
+        if (!start_fetch(robots, entry, origin, origin_length)) {
+            // do not stall the host, allow everything until the next attempt
+            fprintf(stderr, "WARNING: %s: cannot fetch robots.txt for %.*s\n",
+                    __func__, (int) origin_length, origin);
+            set_rules(robots, origin, origin_length, create_rules(), UNREACHABLE_TTL);
+        }
+    }
+    return entry;
+}
+
+CurlRobotsVerdict curl_robots_check(void* robots, char* origin, unsigned origin_length,
+                                    char* path, unsigned path_length)
+{
+    CurlRobots* r = (CurlRobots*) robots;
+    RobotsEntry* entry = get_entry(r, origin, origin_length);
+    if (!entry || !entry->rules) {
+        if (entry && entry->fetching) {
+            return CURL_ROBOTS_PENDING;
+        }
+        // out of memory, do not stall
+        return CURL_ROBOTS_ALLOWED;
+    }
+    if (entry->rules->disallow_all) {
+        // unreachable host waits for the retry or for the fetch in progress
+        return entry->fetching? CURL_ROBOTS_PENDING : CURL_ROBOTS_UNREACHABLE;
+    }
+    // expired rules keep answering while refetching
+    if (curl_robots_rules_allowed(entry->rules, path, path_length)) {
+        r->stats.allowed++;
+        return CURL_ROBOTS_ALLOWED;
+    }
+    r->stats.disallowed++;
+    return CURL_ROBOTS_DISALLOWED;
+}
+
+unsigned curl_robots_crawl_delay(void* robots, char* origin, unsigned origin_length)
+{
+    CurlRobots* r = (CurlRobots*) robots;
+    RobotsEntry* entry = curl_hash_get(&r->entries, origin, origin_length);
+    if (!entry || !entry->rules) {
+        return 0;
+    }
+    return entry->rules->crawl_delay;
+}
+
+uint64_t curl_robots_retry_time(void* robots, char* origin, unsigned origin_length)
+{
+    CurlRobots* r = (CurlRobots*) robots;
+    RobotsEntry* entry = curl_hash_get(&r->entries, origin, origin_length);
+    if (!entry || !entry->rules || !entry->rules->disallow_all) {
+        return 0;
+    }
+    return entry->expires;
+}
+
+void curl_robots_stats(void* robots, CurlRobotsStats* stats)
+{
+    *stats = ((CurlRobots*) robots)->stats;
+}
@@ -0,0 +1,799 @@
+/*
+ * URL resolver bound to a parsed base URL.
+ *
+ * The base is parsed by curl once. Common relative references
+ * (path, absolute path, query, and fragment) are resolved by string
+ * operations on the normalized base. Anything else goes to curl,
+ * using a copy of the already parsed base handle.
+ *
+ * Also URL canonicalization and fingerprints for deduplication.
+ */
+
+#include <stdio.h>
+#include <stdlib.h>
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+#include "pw_http_scan.h"
+
+#define STACK_BUFFER_SIZE  2048
+
+static bool fast_path_char[256] = {
+    // unreserved, sub-delims, and gen-delims except brackets;
+    // curl leaves them as is
+    ['a' ... 'z'] = true, ['A' ... 'Z'] = true, ['0' ... '9'] = true,
+    ['-'] = true, ['.'] = true, ['_'] = true, ['~'] = true,
+    ['!'] = true, ['$'] = true, ['&'] = true, ['\''] = true, ['('] = true, [')'] = true,
+    ['*'] = true, ['+'] = true, [','] = true, [';'] = true, ['='] = true,
+    [':'] = true, ['@'] = true, ['/'] = true, ['?'] = true, ['#'] = true, ['%'] = true
+};
+
+static void set_url_error(CURLUcode rc)
+{
+    pw_set_status(PwStatus(PW_ERROR), "URL error: %s", curl_url_strerror(rc));
+}
+
+[[nodiscard]] bool curl_url_resolver_init(CurlUrlResolver* resolver, char* base_url)
+{
+    *resolver = (CurlUrlResolver) {};
+
+    resolver->base_handle = curl_url();
+    if (!resolver->base_handle) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    CURLUcode rc = curl_url_set(resolver->base_handle, CURLUPART_URL, base_url, 0);
+    if (rc == CURLUE_OK) {
+        rc = curl_url_get(resolver->base_handle, CURLUPART_URL, &resolver->base, 0);
+    }
+    if (rc) {
+        set_url_error(rc);
+        curl_url_resolver_fini(resolver);
+        return false;
+    }
+
+    // split normalized base: scheme://authority/path?query#fragment
+    char* base = resolver->base;
+    unsigned length = strlen(base);
+    resolver->base_length = length;
+
+    char* authority = strstr(base, "://");
+    if (!authority) {
+        // no hierarchical part, only curl can deal with such base
+        return true;
+    }
+    authority += 3;
+    char* path = authority + strcspn(authority, "/?#");
+    if (*path != '/') {
+        // curl always makes path for hierarchical URLs, but be careful
+        return true;
+    }
+    char* query = path + strcspn(path, "?#");
+    char* fragment = query + strcspn(query, "#");
+    char* dir_end = query;
+    while (dir_end[-1] != '/') {
+        dir_end--;
+    }
+    resolver->path_start = path - base;
+    resolver->dir_end    = dir_end - base;
+    resolver->path_end   = query - base;
+    resolver->query_end  = fragment - base;
+    resolver->hierarchical = true;
+    return true;
+}
+
+void curl_url_resolver_fini(CurlUrlResolver* resolver)
+{
+    if (resolver->base) {
+        curl_free(resolver->base);
+    }
+    if (resolver->base_handle) {
+        curl_url_cleanup(resolver->base_handle);
+    }
+    *resolver = (CurlUrlResolver) {};
+}
+
+static unsigned remove_dot_segments(char* path, unsigned length)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc3986#section-5.2.4
+ *
+ * Path must start with slash. Work in place, return new length.
+ */
+{
+    char* out = path;
+    char* in = path;
+    char* end = path + length;
+    while (in < end) {
+        // in points to slash
+        char* segment = in + 1;
+        char* segment_end = memchr(segment, '/', end - segment);
+        if (!segment_end) {
+            segment_end = end;
+        }
+        unsigned segment_length = segment_end - segment;
+        if (segment_length == 1 && segment[0] == '.') {
+            if (segment_end == end) {
+                *out++ = '/';
+            }
+            in = segment_end;
+            continue;
+        }
+        if (segment_length == 2 && segment[0] == '.' && segment[1] == '.') {
+            while (out > path && *--out != '/') {}
+            if (segment_end == end) {
+                *out++ = '/';
+            }
+            in = segment_end;
+            continue;
+        }
+        memmove(out, in, segment_end - in);
+        out += segment_end - in;
+        in = segment_end;
+    }
+    if (out == path) {
+        *out++ = '/';
+    }
+    return out - path;
+}
+
+static bool has_dot_segment(char* path, char* end)
+{
+    for (char* p = path; p < end; p++) {
+        if (*p == '.' && (p == path || p[-1] == '/')) {
+            if (p + 1 == end || p[1] == '/' || (p[1] == '.' && (p + 2 == end || p[2] == '/'))) {
+                return true;
+            }
+        }
+    }
+    return false;
+}
+
+[[nodiscard]] static bool resolve_fallback(CurlUrlResolver* resolver, char* ref, unsigned length,
+                                          PwValuePtr result, bool* malformed)
+{
+    resolver->num_fallback++;
+
+    char stack_buffer[STACK_BUFFER_SIZE];
+    char* ref_cstr = stack_buffer;
+    if (length >= sizeof(stack_buffer)) {
+        ref_cstr = default_allocator.allocate(length + 1, false);
+        if (!ref_cstr) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            return false;
+        }
+    }
+    memcpy(ref_cstr, ref, length);
+    ref_cstr[length] = 0;
+
+    bool ret = false;
+    char* url = nullptr;
+    CURLU* handle = curl_url_dup(resolver->base_handle);
+    if (!handle) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        goto out;
+    }
+    CURLUcode rc = curl_url_set(handle, CURLUPART_URL, ref_cstr, 0);
+    if (rc == CURLUE_OK) {
+        rc = curl_url_get(handle, CURLUPART_URL, &url, 0);
+    }
+    if (rc) {
+        set_url_error(rc);
+        *malformed = rc != CURLUE_OUT_OF_MEMORY;
+        goto out;
+    }
+    ret = pw_create_string(url, result);
+
+out:
+    if (url) {
+        curl_free(url);
+    }
+    if (handle) {
+        curl_url_cleanup(handle);
+    }
+    if (ref_cstr != stack_buffer) {
+        default_allocator.release((void**) &ref_cstr, length + 1);
+    }
+    return ret;
+}
+
+[[nodiscard]] static bool resolve(CurlUrlResolver* resolver, char* ref, unsigned length,
+                                 PwValuePtr result, bool* malformed)
+{
+    if (!resolver->hierarchical || length == 0) {
+        return resolve_fallback(resolver, ref, length, result, malformed);
+    }
+    for (unsigned i = 0; i < length; i++) {
+        if (!fast_path_char[(unsigned char) ref[i]]) {
+            return resolve_fallback(resolver, ref, length, result, malformed);
+        }
+    }
+
+    // choose the part of base to keep
+    unsigned keep;
+    switch (ref[0]) {
+        case '#':
+            keep = resolver->query_end;
+            break;
+        case '?':
+            keep = resolver->path_end;
+            break;
+        case '/':
+            if (length > 1 && ref[1] == '/') {
+                // network-path reference
+                return resolve_fallback(resolver, ref, length, result, malformed);
+            }
+            keep = resolver->path_start;
+            break;
+        default: {
+            // relative path, make sure the first segment does not look like a scheme
+            for (unsigned i = 0; i < length && ref[i] != '/' && ref[i] != '?' && ref[i] != '#'; i++) {
+                if (ref[i] == ':') {
+                    return resolve_fallback(resolver, ref, length, result, malformed);
+                }
+            }
+            keep = resolver->dir_end;
+            break;
+        }
+    }
+    resolver->num_fast++;
+
+    unsigned url_length = keep + length;
+    char stack_buffer[STACK_BUFFER_SIZE];
+    char* url = stack_buffer;
+    if (url_length >= sizeof(stack_buffer)) {
+        url = default_allocator.allocate(url_length + 1, false);
+        if (!url) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            return false;
+        }
+    }
+    memcpy(url, resolver->base, keep);
+    memcpy(url + keep, ref, length);
+    url[url_length] = 0;
+
+    if (ref[0] != '#' && ref[0] != '?') {
+        // path changed, normalize it, leaving query and fragment as is
+        char* path = url + resolver->path_start;
+        char* path_end = path + strcspn(path, "?#");
+        if (has_dot_segment(path, path_end)) {
+            unsigned path_length = path_end - path;
+            unsigned new_length = remove_dot_segments(path, path_length);
+            memmove(path + new_length, path_end, url + url_length - path_end + 1);
+            url_length -= path_length - new_length;
+        }
+    }
+    bool ret = pw_create_string(url, result);
+
+    if (url != stack_buffer) {
+        default_allocator.release((void**) &url, keep + length + 1);
+    }
+    return ret;
+}
+
+[[nodiscard]] bool curl_url_resolve(CurlUrlResolver* resolver, char* ref, unsigned length, PwValuePtr result)
+{
+    bool malformed = false;
+    return resolve(resolver, ref, length, result, &malformed);
+}
+
+[[nodiscard]] bool curl_url_resolve_batch(CurlUrlResolver* resolver, PwValuePtr refs, PwValuePtr results)
+{
+    if (pw_is_null(results)) {
+        if (!pw_create_array(results)) {
+            return false;
+        }
+    }
+    unsigned n = pw_array_length(refs);
+    for (unsigned i = 0; i < n; i++) {{
+        PwValue ref = PW_NULL;
+        if (!pw_array_item(refs, i, &ref)) {
+            return false;
+        }
+        PW_CSTRING_LOCAL(ref_cstr, &ref);
+        PwValue url = PW_NULL;
+        bool malformed = false;
+        if (!resolve(resolver, ref_cstr, strlen(ref_cstr), &url, &malformed)) {
+            if (!malformed) {
+                return false;
+            }
+            // keep null in place of malformed reference
+        }
+        if (!pw_array_append(results, &url)) {
+            return false;
+        }
+    }}
+    return true;
+}
+
+/****************************************************************
+ * Canonicalization
+ */
+
+typedef struct {
+    char* ptr;
+    unsigned length;
+    unsigned size;
+    bool overflow;
+} OutBuffer;
+
+static inline void out_char(OutBuffer* out, char c)
+{
+    if (out->length < out->size) {
+        out->ptr[out->length++] = c;
+    } else {
+        out->overflow = true;
+    }
+}
+
+static inline void out_bytes(OutBuffer* out, char* p, unsigned length)
+{
+    if (out->length + length <= out->size) {
+        memcpy(out->ptr + out->length, p, length);
+        out->length += length;
+    } else {
+        out->overflow = true;
+    }
+}
+
+static inline bool is_unreserved(unsigned char c)
+{
+    return ('a' <= c && c <= 'z') || ('A' <= c && c <= 'Z') || ('0' <= c && c <= '9')
+           || c == '-' || c == '.' || c == '_' || c == '~';
+}
+
+static inline bool must_encode(unsigned char c)
+{
+    return c <= 0x20 || c >= 0x7F || c == '"' || c == '<' || c == '>' || c == '\\'
+           || c == '^' || c == '`' || c == '{' || c == '|' || c == '}';
+}
+
+static inline char lower_char(char c)
+{
+    return ('A' <= c && c <= 'Z')? c + ('a' - 'A') : c;
+}
+
+static void out_escape(OutBuffer* out, unsigned char c)
+{
+    static char hex[] = "0123456789ABCDEF";
+    out_char(out, '%');
+    out_char(out, hex[c >> 4]);
+    out_char(out, hex[c & 15]);
+}
+
+static void out_normalized(OutBuffer* out, char* p, char* end, bool lowercase)
+/*
+ * https://datatracker.ietf.org/doc/html/rfc3986#section-6.2.2
+ *
+ * Decode escaped unreserved chars, uppercase hex digits of other escapes,
+ * and escape chars that are not allowed in URLs.
+ */
+{
+    while (p < end) {
+        unsigned char c = *p;
+        if (c == '%' && end - p > 2) {
+            int high_nibble = curl_hex_value[(unsigned char) p[1]];
+            int low_nibble  = curl_hex_value[(unsigned char) p[2]];
+            if (high_nibble >= 0 && low_nibble >= 0) {
+                unsigned char decoded = (high_nibble << 4) | low_nibble;
+                if (is_unreserved(decoded)) {
+                    out_char(out, lowercase? lower_char(decoded) : decoded);
+                } else {
+                    out_escape(out, decoded);
+                }
+                p += 3;
+                continue;
+            }
+        }
+        if (must_encode(c)) {
+            out_escape(out, c);
+        } else {
+            out_char(out, lowercase? lower_char(c) : c);
+        }
+        p++;
+    }
+}
+
+typedef struct {
+    char* ptr;
+    unsigned length;
+} QueryParam;
+
+static int compare_params(const void* a, const void* b)
+{
+    const QueryParam* pa = a;
+    const QueryParam* pb = b;
+    unsigned length = (pa->length < pb->length)? pa->length : pb->length;
+    int rc = memcmp(pa->ptr, pb->ptr, length);
+    if (rc) {
+        return rc;
+    }
+    return (pa->length > pb->length) - (pa->length < pb->length);
+}
+
+static unsigned sort_query(char* query, unsigned length)
+/*
+ * Sort parameters of normalized query in place, dropping empty ones.
+ * Return new length. Queries with too many parameters are left as is.
+ */
+{
+    QueryParam params[64];
+    unsigned num_params = 0;
+    char* p = query;
+    char* end = query + length;
+    while (p < end) {
+        char* param_end = memchr(p, '&', end - p);
+        if (!param_end) {
+            param_end = end;
+        }
+        if (param_end != p) {
+            if (num_params == PW_LENGTH(params)) {
+                return length;
+            }
+            params[num_params++] = (QueryParam) { p, param_end - p };
+        }
+        p = param_end + 1;
+    }
+    qsort(params, num_params, sizeof(QueryParam), compare_params);
+
+    char stack_buffer[STACK_BUFFER_SIZE];
+    char* sorted = stack_buffer;
+    if (length > sizeof(stack_buffer)) {
+        sorted = default_allocator.allocate(length, false);
+        if (!sorted) {
+            return length;
+        }
+    }
+    unsigned new_length = 0;
+    for (unsigned i = 0; i < num_params; i++) {
+        if (i) {
+            sorted[new_length++] = '&';
+        }
+        memcpy(sorted + new_length, params[i].ptr, params[i].length);
+        new_length += params[i].length;
+    }
+    memcpy(query, sorted, new_length);
+    if (sorted != stack_buffer) {
+        default_allocator.release((void**) &sorted, length);
+    }
+    return new_length;
+}
+
+static unsigned default_port(char* scheme, unsigned length)
+{
+    static struct { char* scheme; unsigned port; } ports[] = {
+        { "http",  80 },
+        { "https", 443 },
+        { "ws",    80 },
+        { "wss",   443 },
+        { "ftp",   21 }
+    };
+    for (unsigned i = 0; i < PW_LENGTH(ports); i++) {
+        if (strlen(ports[i].scheme) == length && memcmp(ports[i].scheme, scheme, length) == 0) {
+            return ports[i].port;
+        }
+    }
+    return 0;
+}
+
+unsigned curl_url_canonicalize_cstr(char* url, unsigned length, unsigned flags, char* buffer, unsigned size)
+{
+    OutBuffer out = { .ptr = buffer, .size = size };
+    char* p = url;
+    char* end = url + length;
+
+    // scheme = ALPHA *( ALPHA / DIGIT / "+" / "-" / "." )
+    char* scheme_end = p;
+    while (scheme_end < end && (is_unreserved(*scheme_end) || *scheme_end == '+') && *scheme_end != '_' && *scheme_end != '~') {
+        scheme_end++;
+    }
+    if (scheme_end == p || scheme_end == end || *scheme_end != ':'
+        || !(('a' <= lower_char(*p) && lower_char(*p) <= 'z'))) {
+        // relative URL
+        return 0;
+    }
+    for (char* s = p; s < scheme_end; s++) {
+        out_char(&out, lower_char(*s));
+    }
+    unsigned scheme_length = out.length;
+    out_char(&out, ':');
+    p = scheme_end + 1;
+
+    if (end - p < 2 || p[0] != '/' || p[1] != '/') {
+        // not hierarchical, only normalize escapes
+        char* fragment = memchr(p, '#', end - p);
+        out_normalized(&out, p, (fragment && !(flags & CURL_CANON_KEEP_FRAGMENT))? fragment : end, false);
+        return out.overflow? 0 : out.length;
+    }
+    out_bytes(&out, "//", 2);
+    p += 2;
+
+    // authority = [ userinfo "@" ] host [ ":" port ]
+    char* authority_end = p;
+    while (authority_end < end && *authority_end != '/' && *authority_end != '?' && *authority_end != '#') {
+        authority_end++;
+    }
+    char* host = p;
+    for (char* s = p; s < authority_end; s++) {
+        if (*s == '@') {
+            host = s + 1;
+        }
+    }
+    if (host != p) {
+        out_normalized(&out, p, host, false);
+    }
+    char* host_end = authority_end;
+    char* port = nullptr;
+    for (char* s = authority_end; s > host; s--) {
+        if (s[-1] == ']') {
+            // IPv6 literal without port
+            break;
+        }
+        if (s[-1] == ':') {
+            host_end = s - 1;
+            port = s;
+            break;
+        }
+    }
+    if (host_end == host) {
+        return 0;
+    }
+    out_normalized(&out, host, host_end, true);
+    if (port) {
+        unsigned port_number = 0;
+        for (char* s = port; s < authority_end; s++) {
+            if (!('0' <= *s && *s <= '9')) {
+                return 0;
+            }
+            port_number = port_number * 10 + (*s - '0');
+            if (port_number > 65535) {
+                return 0;
+            }
+        }
+        if (port != authority_end && port_number != default_port(buffer, scheme_length)) {
+            char port_str[8];
+            unsigned port_length = snprintf(port_str, sizeof(port_str), ":%u", port_number);
+            out_bytes(&out, port_str, port_length);
+        }
+    }
+    p = authority_end;
+
+    // path
+    char* path_end = p;
+    while (path_end < end && *path_end != '?' && *path_end != '#') {
+        path_end++;
+    }
+    unsigned path_start = out.length;
+    if (p == path_end) {
+        out_char(&out, '/');
+    } else {
+        out_normalized(&out, p, path_end, false);
+    }
+    if (out.overflow) {
+        return 0;
+    }
+    char* path = buffer + path_start;
+    if (has_dot_segment(path, buffer + out.length)) {
+        out.length = path_start + remove_dot_segments(path, out.length - path_start);
+    }
+    p = path_end;
+
+    // query
+    if (p < end && *p == '?') {
+        char* query_end = memchr(p, '#', end - p);
+        if (!query_end) {
+            query_end = end;
+        }
+        unsigned query_start = out.length + 1;
+        out_char(&out, '?');
+        out_normalized(&out, p + 1, query_end, false);
+        if (out.overflow) {
+            return 0;
+        }
+        if (!(flags & CURL_CANON_KEEP_QUERY_ORDER)) {
+            out.length = query_start + sort_query(buffer + query_start, out.length - query_start);
+        }
+        if (out.length == query_start) {
+            // drop empty query
+            out.length--;
+        }
+        p = query_end;
+    }
+
+    // fragment
+    if (p < end && (flags & CURL_CANON_KEEP_FRAGMENT)) {
+        out_char(&out, '#');
+        out_normalized(&out, p + 1, end, false);
+    }
+    return out.overflow? 0 : out.length;
+}
+
+[[nodiscard]] bool curl_url_canonicalize(PwValuePtr url, unsigned flags, PwValuePtr result)
+{
+    PW_CSTRING_LOCAL(url_cstr, url);
+    unsigned length = strlen(url_cstr);
+
+    // escaping may triple the length
+    unsigned size = length * 3 + 2;
+    char stack_buffer[STACK_BUFFER_SIZE];
+    char* buffer = stack_buffer;
+    if (size > sizeof(stack_buffer)) {
+        buffer = default_allocator.allocate(size, false);
+        if (!buffer) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            return false;
+        }
+    }
+    bool ret = false;
+    unsigned canonical_length = curl_url_canonicalize_cstr(url_cstr, length, flags, buffer, size - 1);
+    if (canonical_length == 0) {
+        pw_set_status(PwStatus(PW_ERROR), "Cannot canonicalize URL %s", url_cstr);
+    } else {
+        buffer[canonical_length] = 0;
+        ret = pw_create_string(buffer, result);
+    }
+    if (buffer != stack_buffer) {
+        default_allocator.release((void**) &buffer, size);
+    }
+    return ret;
+}
+
+bool curl_url_host_port(char* url, unsigned length, char** host, unsigned* host_length, unsigned* port)
+{
+    char* p = url;
+    char* end = url + length;
+
+    char* scheme_end = memchr(p, ':', length);
+    if (!scheme_end || scheme_end == p || scheme_end - p > 8 || end - scheme_end < 3
+        || scheme_end[1] != '/' || scheme_end[2] != '/') {
+        return false;
+    }
+    char scheme[8];
+    unsigned scheme_length = scheme_end - p;
+    for (unsigned i = 0; i < scheme_length; i++) {
+        scheme[i] = lower_char(p[i]);
+    }
+    p = scheme_end + 3;
+
+    char* authority_end = p;
+    while (authority_end < end && *authority_end != '/' && *authority_end != '?' && *authority_end != '#') {
+        authority_end++;
+    }
+    char* host_start = p;
+    for (char* s = p; s < authority_end; s++) {
+        if (*s == '@') {
+            host_start = s + 1;
+        }
+    }
+    char* host_end = authority_end;
+    unsigned port_number = default_port(scheme, scheme_length);
+    for (char* s = authority_end; s > host_start; s--) {
+        if (s[-1] == ']') {
+            break;
+        }
+        if (s[-1] == ':') {
+            host_end = s - 1;
+            if (s != authority_end) {
+                port_number = 0;
+                for (; s < authority_end; s++) {
+                    if (!('0' <= *s && *s <= '9')) {
+                        return false;
+                    }
+                    port_number = port_number * 10 + (*s - '0');
+                    if (port_number > 65535) {
+                        return false;
+                    }
+                }
+            }
+            break;
+        }
+    }
+    if (host_end == host_start || port_number == 0) {
+        return false;
+    }
+    *host = host_start;
+    *host_length = host_end - host_start;
+    *port = port_number;
+    return true;
+}
+
+/****************************************************************
+ * Fingerprints
+ */
+
+static inline uint64_t rotl64(uint64_t x, int r)
+{
+    return (x << r) | (x >> (64 - r));
+}
+
+static inline uint64_t fmix64(uint64_t k)
+{
+    k ^= k >> 33;
+    k *= 0xff51afd7ed558ccdULL;
+    k ^= k >> 33;
+    k *= 0xc4ceb9fe1a85ec53ULL;
+    k ^= k >> 33;
+    return k;
+}
+
+CurlFingerprint curl_hash128(void* data, size_t length, uint64_t seed)
+/*
+ * MurmurHash3 x64 128, public domain code by Austin Appleby.
+ */
+{
+    uint8_t* bytes = data;
+    size_t num_blocks = length / 16;
+
+    uint64_t h1 = seed;
+    uint64_t h2 = seed;
+    const uint64_t c1 = 0x87c37b91114253d5ULL;
+    const uint64_t c2 = 0x4cf5ad432745937fULL;
+
+    for (size_t i = 0; i < num_blocks; i++) {
+        uint64_t k1, k2;
+        memcpy(&k1, bytes + i * 16, 8);
+        memcpy(&k2, bytes + i * 16 + 8, 8);
+
+        k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+        h1 = rotl64(h1, 27); h1 += h2; h1 = h1 * 5 + 0x52dce729;
+
+        k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+        h2 = rotl64(h2, 31); h2 += h1; h2 = h2 * 5 + 0x38495ab5;
+    }
+
+    uint8_t* tail = bytes + num_blocks * 16;
+    uint64_t k1 = 0;
+    uint64_t k2 = 0;
+    switch (length & 15) {
+        case 15: k2 ^= ((uint64_t) tail[14]) << 48; [[fallthrough]];
+        case 14: k2 ^= ((uint64_t) tail[13]) << 40; [[fallthrough]];
+        case 13: k2 ^= ((uint64_t) tail[12]) << 32; [[fallthrough]];
+        case 12: k2 ^= ((uint64_t) tail[11]) << 24; [[fallthrough]];
+        case 11: k2 ^= ((uint64_t) tail[10]) << 16; [[fallthrough]];
+        case 10: k2 ^= ((uint64_t) tail[ 9]) << 8;  [[fallthrough]];
+        case  9: k2 ^= ((uint64_t) tail[ 8]);
+                 k2 *= c2; k2 = rotl64(k2, 33); k2 *= c1; h2 ^= k2;
+                 [[fallthrough]];
+        case  8: k1 ^= ((uint64_t) tail[ 7]) << 56; [[fallthrough]];
+        case  7: k1 ^= ((uint64_t) tail[ 6]) << 48; [[fallthrough]];
+        case  6: k1 ^= ((uint64_t) tail[ 5]) << 40; [[fallthrough]];
+        case  5: k1 ^= ((uint64_t) tail[ 4]) << 32; [[fallthrough]];
+        case  4: k1 ^= ((uint64_t) tail[ 3]) << 24; [[fallthrough]];
+        case  3: k1 ^= ((uint64_t) tail[ 2]) << 16; [[fallthrough]];
+        case  2: k1 ^= ((uint64_t) tail[ 1]) << 8;  [[fallthrough]];
+        case  1: k1 ^= ((uint64_t) tail[ 0]);
+                 k1 *= c1; k1 = rotl64(k1, 31); k1 *= c2; h1 ^= k1;
+    }
+
+    h1 ^= length;
+    h2 ^= length;
+    h1 += h2;
+    h2 += h1;
+    h1 = fmix64(h1);
+    h2 = fmix64(h2);
+    h1 += h2;
+    h2 += h1;
+    return (CurlFingerprint) { .lo = h1, .hi = h2 };
+}
+
+bool curl_url_fingerprint(char* url, unsigned length, unsigned flags, CurlFingerprint* result)
+{
+    unsigned size = length * 3 + 2;
+    char stack_buffer[STACK_BUFFER_SIZE];
+    char* buffer = stack_buffer;
+    if (size > sizeof(stack_buffer)) {
+        buffer = default_allocator.allocate(size, false);
+        if (!buffer) {
+            return false;
+        }
+    }
+    unsigned canonical_length = curl_url_canonicalize_cstr(url, length, flags, buffer, size);
+    if (canonical_length) {
+        *result = curl_hash128(buffer, canonical_length, 0);
+    }
+    if (buffer != stack_buffer) {
+        default_allocator.release((void**) &buffer, size);
+    }
+    return canonical_length != 0;
+}
@@ -0,0 +1,242 @@
+/*
+ * FIFO of URLs with front coding.
+ *
+ * Each URL is stored as the length of prefix shared with the previous URL,
+ * the rest of URL, and a small tag such as crawl depth. URLs of one host
+ * share scheme and host name at least, so a record is usually
+ * a few bytes of varints plus the path.
+ *
+ * Records are appended to chunks of a bump-allocated arena and consumed
+ * from the head. Chunks are released as soon as they are read.
+ * When the queue is emptied, only the URL popped last is kept
+ * until the next push.
+ *
+ * Decoding needs the previous URL, which is always the one popped last,
+ * because records are read in the order they were written.
+ */
+
+#include <string.h>
+
+#include <pw.h>
+
+#include "pw_curl_internal.h"
+
+#define MIN_CHUNK_SIZE  128
+#define MAX_CHUNK_SIZE  65536
+
+struct CurlUrlQueueChunk {
+    CurlUrlQueueChunk* next;
+    unsigned size;  // capacity of data
+    unsigned used;
+    char data[];
+};
+
+static inline unsigned varint_size(unsigned n)
+{
+    unsigned size = 1;
+    while (n >= 0x80) {
+        n >>= 7;
+        size++;
+    }
+    return size;
+}
+
+static inline char* put_varint(char* p, unsigned n)
+{
+    while (n >= 0x80) {
+        *p++ = (char) (n | 0x80);
+        n >>= 7;
+    }
+    *p++ = (char) n;
+    return p;
+}
+
+static inline char* get_varint(char* p, unsigned* n)
+{
+    unsigned result = 0;
+    unsigned shift = 0;
+    unsigned char c;
+    do {
+        c = *p++;
+        result |= (unsigned) (c & 0x7F) << shift;
+        shift += 7;
+    } while (c & 0x80);
+    *n = result;
+    return p;
+}
+
+[[nodiscard]] static bool reserve(char** buffer, unsigned* capacity, unsigned size)
+{
+    if (size <= *capacity) {
+        return true;
+    }
+    unsigned new_capacity = *capacity? *capacity : 64;
+    while (new_capacity < size) {
+        new_capacity *= 2;
+    }
+    char* new_buffer = default_allocator.allocate(new_capacity, false);
+    if (!new_buffer) {
+        pw_set_status(PwStatus(PW_ERROR_OOM));
+        return false;
+    }
+    if (*buffer) {
+        memcpy(new_buffer, *buffer, *capacity);
+        default_allocator.release((void**) buffer, *capacity);
+    }
+    *buffer = new_buffer;
+    *capacity = new_capacity;
+    return true;
+}
+
+static void release_buffer(char** buffer, unsigned* capacity)
+{
+    if (*buffer) {
+        default_allocator.release((void**) buffer, *capacity);
+        *capacity = 0;
+    }
+}
+
+static void release_head(CurlUrlQueue* queue)
+{
+    CurlUrlQueueChunk* chunk = queue->head;
+    queue->head = chunk->next;
+    if (!queue->head) {
+        queue->tail = nullptr;
+    }
+    queue->read_pos = 0;
+    queue->memory -= sizeof(CurlUrlQueueChunk) + chunk->size;
+    default_allocator.release((void**) &chunk, sizeof(CurlUrlQueueChunk) + chunk->size);
+}
+
+void curl_url_queue_init(CurlUrlQueue* queue)
+{
+    *queue = (CurlUrlQueue) {};
+}
+
+void curl_url_queue_fini(CurlUrlQueue* queue)
+{
+    while (queue->head) {
+        release_head(queue);
+    }
+    release_buffer(&queue->last_pushed, &queue->last_pushed_capacity);
+    release_buffer(&queue->decoded, &queue->decoded_capacity);
+    curl_url_queue_init(queue);
+}
+
+[[nodiscard]] bool curl_url_queue_push(CurlUrlQueue* queue, char* url, unsigned length, unsigned tag)
+{
+    if (queue->length == 0 && queue->decoded) {
+        queue->memory -= queue->decoded_capacity;
+        release_buffer(&queue->decoded, &queue->decoded_capacity);
+    }
+    unsigned prefix = 0;
+    unsigned limit = (length < queue->last_pushed_length)? length : queue->last_pushed_length;
+    while (prefix < limit && url[prefix] == queue->last_pushed[prefix]) {
+        prefix++;
+    }
+    unsigned suffix = length - prefix;
+    unsigned record_size = varint_size(prefix) + varint_size(suffix) + varint_size(tag) + suffix;
+
+    CurlUrlQueueChunk* chunk = queue->tail;
+    if (!chunk || chunk->size - chunk->used < record_size) {
+        unsigned size = chunk? chunk->size * 2 : MIN_CHUNK_SIZE;
+        if (size > MAX_CHUNK_SIZE) {
+            size = MAX_CHUNK_SIZE;
+        }
+        if (size < record_size) {
+            size = record_size;
+        }
+        chunk = default_allocator.allocate(sizeof(CurlUrlQueueChunk) + size, false);
+        if (!chunk) {
+            pw_set_status(PwStatus(PW_ERROR_OOM));
+            return false;
+        }
+        chunk->next = nullptr;
+        chunk->size = size;
+        chunk->used = 0;
+        if (queue->tail) {
+            queue->tail->next = chunk;
+        } else {
+            queue->head = chunk;
+        }
+        queue->tail = chunk;
+        queue->memory += sizeof(CurlUrlQueueChunk) + size;
+    }
+    unsigned memory = queue->last_pushed_capacity;
+    if (!reserve(&queue->last_pushed, &queue->last_pushed_capacity, length)) {
+        return false;
+    }
+    queue->memory += queue->last_pushed_capacity - memory;
+
+    char* p = chunk->data + chunk->used;
+    p = put_varint(p, prefix);
+    p = put_varint(p, suffix);
+    p = put_varint(p, tag);
+    memcpy(p, url + prefix, suffix);
+    chunk->used += record_size;
+
+    memcpy(queue->last_pushed + prefix, url + prefix, suffix);
+    queue->last_pushed_length = length;
+    queue->length++;
+    return true;
+}
+
+static char* decode_head(CurlUrlQueue* queue, unsigned* length, unsigned* tag, unsigned* record_size)
+/*
+ * Decode the first record into decoded buffer. The buffer holds the previous URL,
+ * and the shared prefix is the same in both, so decoding is idempotent.
+ */
+{
+    if (queue->length == 0) {
+        return nullptr;
+    }
+    if (queue->read_pos == queue->head->used) {
+        // the head chunk is read and there are more records
+        release_head(queue);
+    }
+    char* start = queue->head->data + queue->read_pos;
+    unsigned prefix, suffix;
+    char* p = get_varint(start, &prefix);
+    p = get_varint(p, &suffix);
+    p = get_varint(p, tag);
+
+    unsigned memory = queue->decoded_capacity;
+    if (!reserve(&queue->decoded, &queue->decoded_capacity, prefix + suffix + 1)) {
+        return nullptr;
+    }
+    queue->memory += queue->decoded_capacity - memory;
+
+    memcpy(queue->decoded + prefix, p, suffix);
+    queue->decoded[prefix + suffix] = 0;
+    *length = prefix + suffix;
+    *record_size = p + suffix - start;
+    return queue->decoded;
+}
+
+char* curl_url_queue_peek(CurlUrlQueue* queue, unsigned* length, unsigned* tag)
+{
+    unsigned record_size;
+    return decode_head(queue, length, tag, &record_size);
+}
+
+char* curl_url_queue_pop(CurlUrlQueue* queue, unsigned* length, unsigned* tag)
+{
+    unsigned record_size;
+    char* url = decode_head(queue, length, tag, &record_size);
+    if (!url) {
+        return nullptr;
+    }
+    queue->read_pos += record_size;
+    queue->length--;
+    if (queue->length == 0) {
+        // start over: the next URL is coded without prefix, release everything
+        // except decoded URL which the caller is going to use
+        while (queue->head) {
+            release_head(queue);
+        }
+        queue->memory -= queue->last_pushed_capacity;
+        release_buffer(&queue->last_pushed, &queue->last_pushed_capacity);
+        queue->last_pushed_length = 0;
+    }
+    return url;
+}